@@ -0,0 +1,296 @@
+#ifndef BENCH_GENERATORS_H
+#define BENCH_GENERATORS_H
+
+#include <vector>
+#include <string>
+#include <random>
+#include <cmath>
+#include <algorithm>
+
+#include "tess/tess.h"
+#include "tess/tess.hpp"
+
+/**
+ * Synthetic point distributions for benchmarking.
+ *
+ * The domain is the periodic cube [0, side)^3, with side = cbrt(total points), so the mean
+ * interparticle spacing is 1 for every distribution. Every block generates its points from its
+ * own random stream, seeded with (seed, gid); global fields (the Zel'dovich displacement) are
+ * seeded with the seed alone. The point set is therefore a function of the distribution, seed,
+ * number of blocks, and number of points, and does not depend on the number of processes.
+ *
+ * Generated points lie in the domain but not necessarily in the bounds of the block that made
+ * them; redistribute them (tess_exchange() etc.) before tessellating.
+ */
+
+enum bench_dist_t
+{
+    DIST_UNIFORM,               // uniform random
+    DIST_LATTICE,               // jittered lattice
+    DIST_ZELDOVICH,             // lattice displaced by a random Zel'dovich-like field
+    DIST_SONEIRA_PEEBLES,       // Soneira-Peebles hierarchical clusters
+    DIST_SHEET,                 // thin Gaussian sheet in the z = side / 2 plane
+    DIST_NUM_DISTS
+};
+
+static const char* bench_dist_names[DIST_NUM_DISTS] =
+    { "uniform", "lattice", "zeldovich", "soneira-peebles", "sheet" };
+
+// returns DIST_NUM_DISTS for an unknown name
+inline int bench_dist(const std::string& name)
+{
+    for (int i = 0; i < DIST_NUM_DISTS; i++)
+        if (name == bench_dist_names[i])
+            return i;
+    return DIST_NUM_DISTS;
+}
+
+struct bench_gen_t
+{
+    int         dist;
+    long long   total;          // points in the domain
+    unsigned    seed;
+    float       jitter;         // lattice: displacement in lattice spacings
+    float       growth;         // zeldovich: rms displacement in lattice spacings
+    int         modes;          // zeldovich: Fourier modes of the displacement potential
+    int         eta;            // soneira-peebles: subclusters per cluster
+    float       lambda;         // soneira-peebles: radius ratio between levels
+    int         levels;         // soneira-peebles: levels below a top cluster
+    float       thickness;      // sheet: standard deviation of z in mean spacings
+
+    bench_gen_t():
+        dist(DIST_UNIFORM), total(0), seed(0), jitter(0.5f), growth(1.0f), modes(64), eta(4),
+        lambda(1.9f), levels(6), thickness(0.5f)                                            {}
+
+    float       side() const                    { return std::cbrt((double)total); }
+};
+
+// wraps a coordinate into [0, side)
+inline float bench_wrap(float x,
+                        float side)
+{
+    x = std::fmod(x, side);
+    if (x < 0)
+        x += side;
+    return x < side ? x : 0.0f;
+}
+
+// lattice sites of the global lattice whose centers lie in the core of the block
+inline void bench_lattice(const diy::ContinuousBounds&   core,
+                          const bench_gen_t&             gen,
+                          std::vector<float>&            pts)
+{
+    int   m = std::max(1, (int)std::lround(std::cbrt((double)gen.total)));
+    float h = gen.side() / m;
+    int   lo[3], hi[3];
+    for (int d = 0; d < 3; d++)
+    {
+        lo[d] = std::max(0, (int)std::ceil(core.min[d] / h - 0.5f));
+        hi[d] = std::min(m, (int)std::ceil(core.max[d] / h - 0.5f));
+    }
+    for (int i = lo[0]; i < hi[0]; i++)
+        for (int j = lo[1]; j < hi[1]; j++)
+            for (int k = lo[2]; k < hi[2]; k++)
+            {
+                pts.push_back((i + 0.5f) * h);
+                pts.push_back((j + 0.5f) * h);
+                pts.push_back((k + 0.5f) * h);
+            }
+}
+
+// displaces lattice sites by the gradient of a periodic random potential, x = q - D grad phi(q),
+// phi = sum_k a_k cos(k q + phase_k) with a_k ~ |k|^-2, normalized to an rms displacement of
+// gen.growth lattice spacings; the same field in every block
+inline void bench_zeldovich(std::vector<float>&  pts,
+                            const bench_gen_t&   gen)
+{
+    const double two_pi = 6.283185307179586;
+    float        side   = gen.side();
+    int          m      = std::max(1, (int)std::lround(std::cbrt((double)gen.total)));
+    int          kmax   = std::max(1, std::min(m / 2, 8));
+
+    std::mt19937                           rng(gen.seed);
+    std::uniform_int_distribution<int>     wave(-kmax, kmax);
+    std::uniform_real_distribution<double> phase(0.0, two_pi);
+    std::normal_distribution<double>       normal;
+
+    std::vector<double> k(3 * gen.modes), a(gen.modes), ph(gen.modes);
+    double              var = 0;
+    for (int i = 0; i < gen.modes; i++)
+    {
+        int n[3];
+        do
+        {
+            for (int d = 0; d < 3; d++)
+                n[d] = wave(rng);
+        } while (!n[0] && !n[1] && !n[2]);
+        double k2 = 0;
+        for (int d = 0; d < 3; d++)
+        {
+            k[3 * i + d] = two_pi * n[d] / side;
+            k2          += k[3 * i + d] * k[3 * i + d];
+        }
+        a[i]  = normal(rng) / k2;
+        ph[i] = phase(rng);
+        var  += a[i] * a[i] * k2 / 2;
+    }
+    double scale = var > 0 ? gen.growth * side / m / std::sqrt(var) : 0;
+
+    for (size_t p = 0; p < pts.size(); p += 3)
+    {
+        double disp[3] = { 0, 0, 0 };
+        for (int i = 0; i < gen.modes; i++)
+        {
+            double s = a[i] * std::sin(k[3 * i] * pts[p] + k[3 * i + 1] * pts[p + 1] +
+                                       k[3 * i + 2] * pts[p + 2] + ph[i]);
+            for (int d = 0; d < 3; d++)
+                disp[d] += s * k[3 * i + d];
+        }
+        for (int d = 0; d < 3; d++)
+            pts[p + d] = bench_wrap(pts[p + d] + scale * disp[d], side);
+    }
+}
+
+// Soneira-Peebles clusters centered uniformly in the core of the block until n points: every
+// cluster of radius r places eta subclusters uniformly in its sphere, with radius r / lambda,
+// down to gen.levels levels, whose centers are the points
+inline void bench_soneira_peebles(const diy::ContinuousBounds& core,
+                                  const bench_gen_t&           gen,
+                                  int                          n,
+                                  std::mt19937&                rng,
+                                  std::vector<float>&          pts)
+{
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    float side = gen.side();
+    float r0   = side;
+    for (int d = 0; d < 3; d++)
+        r0 = std::min(r0, (core.max[d] - core.min[d]) / 2);
+
+    struct cluster_t { float c[3]; float r; int level; };
+    std::vector<cluster_t> stack;
+    while ((int)pts.size() < 3 * n)
+    {
+        cluster_t top;
+        for (int d = 0; d < 3; d++)
+            top.c[d] = core.min[d] + unit(rng) * (core.max[d] - core.min[d]);
+        top.r     = r0;
+        top.level = 0;
+        stack.push_back(top);
+
+        while (!stack.empty() && (int)pts.size() < 3 * n)
+        {
+            cluster_t cl = stack.back();
+            stack.pop_back();
+            if (cl.level == gen.levels)
+            {
+                for (int d = 0; d < 3; d++)
+                    pts.push_back(bench_wrap(cl.c[d], side));
+                continue;
+            }
+            for (int i = 0; i < gen.eta; i++)
+            {
+                cluster_t sub;
+                float     x[3], r2;
+                do                                      // uniform in the unit ball
+                {
+                    r2 = 0;
+                    for (int d = 0; d < 3; d++)
+                    {
+                        x[d] = 2 * unit(rng) - 1;
+                        r2  += x[d] * x[d];
+                    }
+                } while (r2 > 1);
+                for (int d = 0; d < 3; d++)
+                    sub.c[d] = cl.c[d] + cl.r * x[d];
+                sub.r     = cl.r / gen.lambda;
+                sub.level = cl.level + 1;
+                stack.push_back(sub);
+            }
+        }
+        stack.clear();
+    }
+}
+
+// generates the points of block b, about n of them (the lattice distributions take the lattice
+// sites in the core of the block instead); returns the number of points
+inline int bench_generate(DBlock*            b,
+                          const bench_gen_t& gen,
+                          int                n)
+{
+    std::seed_seq seq = { gen.seed, (unsigned)b->gid, (unsigned)gen.dist };
+    std::mt19937  rng(seq);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::normal_distribution<float>       normal;
+
+    const diy::ContinuousBounds& core = b->bounds;
+    float                        side = gen.side();
+    std::vector<float>           pts;
+
+    switch (gen.dist)
+    {
+    case DIST_UNIFORM:
+        pts.resize(3 * n);
+        for (int i = 0; i < n; i++)
+            for (int d = 0; d < 3; d++)
+                pts[3 * i + d] = core.min[d] + unit(rng) * (core.max[d] - core.min[d]);
+        break;
+    case DIST_LATTICE:
+    {
+        bench_lattice(core, gen, pts);
+        float h = side / std::max(1, (int)std::lround(std::cbrt((double)gen.total)));
+        for (size_t i = 0; i < pts.size(); i++)
+            pts[i] = bench_wrap(pts[i] + gen.jitter * h * (unit(rng) - 0.5f), side);
+        break;
+    }
+    case DIST_ZELDOVICH:
+        bench_lattice(core, gen, pts);
+        bench_zeldovich(pts, gen);
+        break;
+    case DIST_SONEIRA_PEEBLES:
+        bench_soneira_peebles(core, gen, n, rng, pts);
+        break;
+    case DIST_SHEET:
+        pts.resize(3 * n);
+        for (int i = 0; i < n; i++)
+        {
+            for (int d = 0; d < 2; d++)
+                pts[3 * i + d] = core.min[d] + unit(rng) * (core.max[d] - core.min[d]);
+            pts[3 * i + 2] = bench_wrap(side / 2 + gen.thickness * normal(rng), side);
+        }
+        break;
+    }
+
+    b->num_particles      = pts.size() / 3;
+    b->num_orig_particles = b->num_particles;
+    b->particles = (float*)tess_malloc(std::max((size_t)1, pts.size()) * sizeof(float),
+                                       MEM_PARTICLES);
+    std::copy(pts.begin(), pts.end(), b->particles);
+    return b->num_particles;
+}
+
+// add block to master and generate benchmark particles
+struct AddAndGenerateBench: public AddBlock
+{
+    AddAndGenerateBench(diy::Master&       master_,
+                        const bench_gen_t& gen_,
+                        int                nblocks_):
+        AddBlock(master_),
+        gen(gen_),
+        nblocks(nblocks_)         {}
+
+    void  operator()(int gid,
+                     const diy::ContinuousBounds& core,
+                     const diy::ContinuousBounds& bounds,
+                     const diy::ContinuousBounds& domain,
+                     const RCLink& link) const
+        {
+            DBlock* b = AddBlock::operator()(gid, core, bounds, domain, link);
+            int     n = gen.total / nblocks + (gid < gen.total % nblocks ? 1 : 0);
+            bench_generate(b, gen, n);
+        }
+
+    const bench_gen_t&  gen;
+    int                 nblocks;
+};
+
+#endif
@@ -0,0 +1,376 @@
+//
+// benchmark of the tessellation pipeline on synthetic point distributions
+//
+// generates the points (see generators.h), redistributes them, and runs the selected stages,
+// printing one JSON line of times and throughputs per run to stdout (and appending it to
+// --json <file>); see SCALING for weak- and strong-scaling sweeps
+//
+#include "mpi.h"
+#include <vector>
+#include <string>
+#include <sstream>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <iostream>
+
+#include "tess/tess.h"
+#include "tess/tess.hpp"
+#include "tess/dense.hpp"
+#include "tess/volume.h"
+
+#include <diy/mpi.hpp>
+#include <diy/master.hpp>
+#include <diy/assigner.hpp>
+#include <diy/decomposition.hpp>
+
+#include "../examples/opts.h"
+
+#include "generators.h"
+
+typedef     diy::ContinuousBounds         Bounds;
+
+// times a collective stage: the slowest process decides
+struct StageTimer
+{
+    StageTimer(MPI_Comm comm_, double& time_):
+        comm(comm_), time(time_)        { MPI_Barrier(comm); start = MPI_Wtime(); }
+    ~StageTimer()                       { MPI_Barrier(comm); time = MPI_Wtime() - start; }
+
+    MPI_Comm    comm;
+    double&     time;
+    double      start;
+};
+
+// Voronoi cell volumes of the original particles of all local blocks; returns the number of
+// finite cells, their total volume in vol
+static long long cell_volumes(diy::Master& master,
+                              double&      vol)
+{
+    long long cells = 0;
+    vol = 0;
+    for (size_t i = 0; i < master.size(); ++i)
+    {
+        DBlock* b = master.block<DBlock>(i);
+        if (!b->num_tets)
+            continue;
+        if (!b->vert_to_tet)
+            fill_vert_to_tet(b);
+
+        std::vector<float> circumcenters;
+        fill_circumcenters(circumcenters, b->tets, b->num_tets, b->particles);
+        for (int p = 0; p < b->num_orig_particles; ++p)
+        {
+            if (b->vert_to_tet[p] < 0)
+                continue;
+            float v = volume(p, b->vert_to_tet, b->tets, b->num_tets, b->particles, circumcenters);
+            if (v < 0)
+                continue;
+            vol += v;
+            cells++;
+        }
+    }
+    return cells;
+}
+
+int main(int argc, char *argv[])
+{
+    diy::mpi::environment     env(argc, argv);
+    diy::mpi::communicator    world;
+    MPI_Comm                  comm = world;
+
+    int rank = world.rank();
+    int size = world.size();
+
+    using namespace opts;
+
+    // defaults
+    bench_gen_t gen;
+    std::string dist_name   = "uniform";
+    int         tot_blocks  = size;
+    int         num_threads = 1;
+    long long   per_block   = 20000;
+    long long   total       = 0;
+    std::string stages      = "tess,volume,dense,save";
+    std::string decomp      = "regular";
+    int         grid        = 128;
+    int         steps       = 0;
+    float       drift       = 0.05f;
+    std::string outfile     = "bench.out";
+    std::string json;
+    std::string prefix      = "./DIY.XXXXXX";
+
+    Options ops(argc, argv);
+
+    ops
+        >> Option('d', "dist",      dist_name,    "Distribution: uniform, lattice, zeldovich, soneira-peebles, sheet")
+        >> Option('n', "points",    per_block,    "Points per block (weak scaling)")
+        >> Option('N', "total",     total,        "Total points, overrides --points (strong scaling)")
+        >> Option('b', "blocks",    tot_blocks,   "Total number of blocks to use")
+        >> Option('t', "threads",   num_threads,  "Number of threads to use")
+        >> Option('s', "seed",      gen.seed,     "Random seed")
+        >> Option(     "stages",    stages,       "Comma-separated stages: tess, volume, dense, save")
+        >> Option(     "decomp",    decomp,       "Decomposition: regular, kdtree, sfc")
+        >> Option('g', "grid",      grid,         "Density grid points per side")
+        >> Option(     "steps",     steps,        "Time steps updated incrementally after tess")
+        >> Option(     "drift",     drift,        "Displacement per time step in mean spacings")
+        >> Option('o', "output",    outfile,      "Tessellation file of the save stage")
+        >> Option('j', "json",      json,         "Append the results to this file")
+        >> Option(     "storage",   prefix,       "Path for out-of-core storage")
+        >> Option(     "jitter",    gen.jitter,   "lattice: jitter in lattice spacings")
+        >> Option(     "growth",    gen.growth,   "zeldovich: rms displacement in lattice spacings")
+        >> Option(     "modes",     gen.modes,    "zeldovich: Fourier modes of the potential")
+        >> Option(     "eta",       gen.eta,      "soneira-peebles: subclusters per cluster")
+        >> Option(     "lambda",    gen.lambda,   "soneira-peebles: radius ratio between levels")
+        >> Option(     "levels",    gen.levels,   "soneira-peebles: levels of a cluster")
+        >> Option(     "thickness", gen.thickness, "sheet: thickness in mean spacings")
+        ;
+    bool wrap = ops >> Present('w', "wrap", "Use periodic boundary conditions");
+    bool async_save = ops >> Present("async-save", "Save in the background (tess_save_async)");
+    bool cic  = ops >> Present(     "cic",  "Use cloud-in-cell instead of tessellation density");
+
+    gen.dist  = bench_dist(dist_name);
+    gen.total = total > 0 ? total : per_block * tot_blocks;
+    if (ops >> Present('h', "help", "show help") || gen.dist == DIST_NUM_DISTS ||
+        (decomp != "regular" && decomp != "kdtree" && decomp != "sfc"))
+    {
+        if (rank == 0)
+        {
+            fprintf(stderr, "Usage: %s [OPTIONS]\n", argv[0]);
+            std::cout << ops;
+        }
+        return 1;
+    }
+
+    bool run_tess   = stages.find("tess")   != std::string::npos;
+    bool run_volume = stages.find("volume") != std::string::npos;
+    bool run_dense  = stages.find("dense")  != std::string::npos;
+    bool run_save   = stages.find("save")   != std::string::npos;
+    if ((run_volume || run_dense || run_save) && !run_tess)
+    {
+        if (rank == 0)
+            fprintf(stderr, "The volume, dense, and save stages need the tess stage\n");
+        return 1;
+    }
+
+    double times[TESS_MAX_TIMES];
+    timing(times, -1, -1, world);
+
+    Bounds domain { 3 };
+    for (int i = 0; i < 3; i++)
+    {
+        domain.min[i] = 0;
+        domain.max[i] = gen.side();
+    }
+
+    diy::FileStorage          storage(prefix);
+    diy::Master               master(world,
+                                     num_threads,
+                                     -1,
+                                     &create_block,
+                                     &destroy_block,
+                                     &storage,
+                                     &save_block,
+                                     &load_block);
+    diy::RoundRobinAssigner   assigner(world.size(), tot_blocks);
+    AddAndGenerateBench       create(master, gen, tot_blocks);
+
+    // generate
+    double gen_time;
+    {
+        StageTimer timer(comm, gen_time);
+        diy::RegularDecomposer<Bounds>::BoolVector          wraps;
+        diy::RegularDecomposer<Bounds>::BoolVector          share_face;
+        diy::RegularDecomposer<Bounds>::CoordinateVector    ghosts;
+        if (wrap)
+            wraps.assign(3, true);
+        diy::decompose(3, rank, domain, assigner, create, share_face, wraps, ghosts);
+    }
+
+    // redistribute to the owners of the points
+    double exch_time;
+    {
+        StageTimer timer(comm, exch_time);
+        if (decomp == "kdtree")
+            tess_kdtree_exchange(master, assigner, times, wrap);
+        else if (decomp == "sfc")
+            tess_sfc_exchange(master, assigner, times, wrap);
+        else
+            tess_exchange(master, assigner, times);
+    }
+
+    long long local_pts = 0, max_pts = 0, points = 0;
+    for (size_t i = 0; i < master.size(); ++i)
+    {
+        long long n = master.block<DBlock>(i)->num_orig_particles;
+        local_pts  += n;
+        max_pts     = std::max(max_pts, n);
+    }
+    MPI_Allreduce(&local_pts, &points, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &max_pts, 1, MPI_LONG_LONG, MPI_MAX, comm);
+
+    // results, as JSON members
+    std::ostringstream out;
+    out << "{\"dist\": \"" << bench_dist_names[gen.dist] << "\", \"decomp\": \"" << decomp
+        << "\", \"procs\": " << size << ", \"threads\": " << num_threads
+        << ", \"blocks\": " << tot_blocks << ", \"points\": " << points
+        << ", \"seed\": " << gen.seed << ", \"wrap\": " << (wrap ? "true" : "false")
+        << ", \"imbalance\": " << (points ? (double)max_pts * tot_blocks / points : 0.0)
+        << ", \"generate\": {\"time\": " << gen_time
+        << "}, \"redistribute\": {\"time\": " << exch_time
+        << ", \"points_per_s\": " << points / exch_time << "}";
+
+    if (run_tess)
+    {
+        double   tess_time;
+        size_t   rounds;
+        quants_t quants;
+        {
+            StageTimer timer(comm, tess_time);
+            rounds = tess(master, quants, times, steps > 0);   // tess_update() needs the ghosts
+        }
+        long long tets = 0;
+        for (size_t i = 0; i < master.size(); ++i)
+            tets += master.block<DBlock>(i)->num_tets;
+        MPI_Allreduce(MPI_IN_PLACE, &tets, 1, MPI_LONG_LONG, MPI_SUM, comm);
+
+        out << ", \"tess\": {\"time\": " << tess_time << ", \"rounds\": " << rounds
+            << ", \"tets\": " << tets << ", \"points_per_s\": " << points / tess_time
+            << ", \"tets_per_s\": " << tets / tess_time << "}";
+    }
+
+    if (run_tess && steps > 0)
+    {
+        // every step displaces the particles uniformly by up to drift mean spacings
+        double              update_time = 0;
+        tess_update_stats_t total, stats;
+        for (int step = 1; step <= steps; ++step)
+        {
+            std::vector< std::vector<float> > positions(master.size());
+            std::vector<float*>               ptrs(master.size());
+            for (size_t i = 0; i < master.size(); ++i)
+            {
+                DBlock*       b = master.block<DBlock>(i);
+                std::seed_seq seq = { gen.seed, (unsigned)b->gid, (unsigned)step };
+                std::mt19937  rng(seq);
+                std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+                float side = gen.side();
+
+                positions[i].assign(b->particles, b->particles + 3 * b->num_orig_particles);
+                for (size_t j = 0; j < positions[i].size(); ++j)
+                {
+                    float x = positions[i][j] + drift * unit(rng);
+                    positions[i][j] = wrap ? bench_wrap(x, side) : std::min(std::max(x, 0.0f), side);
+                }
+                ptrs[i] = positions[i].empty() ? NULL : &positions[i][0];
+            }
+
+            double t;
+            {
+                StageTimer timer(comm, t);
+                tess_update(master, assigner, ptrs, wrap, stats, times);
+            }
+            update_time          += t;
+            total.rounds         += stats.rounds;
+            total.moved          += stats.moved;
+            total.refreshed      += stats.refreshed;
+            total.moved_in_place += stats.moved_in_place;
+            total.reinserted     += stats.reinserted;
+            total.new_ghosts     += stats.new_ghosts;
+            total.blocks         += stats.blocks;
+            total.kept_tets      += stats.kept_tets;
+            total.kept_ghosts    += stats.kept_ghosts;
+        }
+
+        out << ", \"update\": {\"steps\": " << steps << ", \"drift\": " << drift
+            << ", \"time_per_step\": " << update_time / steps
+            << ", \"rounds\": " << total.rounds << ", \"moved\": " << total.moved
+            << ", \"refreshed\": " << total.refreshed
+            << ", \"moved_in_place\": " << total.moved_in_place
+            << ", \"reinserted\": " << total.reinserted
+            << ", \"new_ghosts\": " << total.new_ghosts
+            << ", \"kept_tets\": " << (total.blocks ? (double)total.kept_tets / total.blocks : 0.0)
+            << ", \"kept_ghosts\": " << (total.blocks ? (double)total.kept_ghosts / total.blocks : 0.0)
+            << ", \"points_per_s\": " << points * steps / update_time << "}";
+    }
+
+    if (run_volume)
+    {
+        double    vol_time, vol;
+        long long cells;
+        {
+            StageTimer timer(comm, vol_time);
+            cells = cell_volumes(master, vol);
+        }
+        MPI_Allreduce(MPI_IN_PLACE, &cells, 1, MPI_LONG_LONG, MPI_SUM, comm);
+        MPI_Allreduce(MPI_IN_PLACE, &vol, 1, MPI_DOUBLE, MPI_SUM, comm);
+
+        out << ", \"volume\": {\"time\": " << vol_time << ", \"cells\": " << cells
+            << ", \"total_volume\": " << vol << ", \"points_per_s\": " << points / vol_time << "}";
+    }
+
+    if (run_dense)
+    {
+        double dense_time;
+        float  given_mins[3], given_maxs[3], proj_plane[3] = { 0, 0, 1 };
+        float  data_mins[3], data_maxs[3], grid_phys_mins[3], grid_phys_maxs[3], grid_step_size[3];
+        int    glo_num_idx[3] = { grid, grid, grid };
+        {
+            StageTimer timer(comm, dense_time);
+            dense(cic ? DENSE_CIC : DENSE_TESS, 0, given_mins, given_maxs, false, proj_plane, 1.0f,
+                  data_mins, data_maxs, grid_phys_mins, grid_phys_maxs, grid_step_size, 0.0001f,
+                  glo_num_idx, master);
+        }
+        double grid_pts = (double)grid * grid * grid;
+
+        out << ", \"dense\": {\"time\": " << dense_time << ", \"grid_points\": " << grid_pts
+            << ", \"points_per_s\": " << points / dense_time
+            << ", \"grid_points_per_s\": " << grid_pts / dense_time << "}";
+    }
+
+    if (run_save)
+    {
+        // with async_save, time is what the caller is blocked for; wait, the rest of the write
+        double        save_time, wait_time = 0;
+        TessFileWrite pending;
+        {
+            StageTimer timer(comm, save_time);
+            if (async_save)
+                tess_save_async(master, outfile.c_str(), pending, times);
+            else
+                tess_save(master, outfile.c_str(), times);
+        }
+        if (async_save)
+        {
+            StageTimer timer(comm, wait_time);
+            tess_save_wait(pending);
+        }
+        struct stat st;
+        double      bytes = stat(outfile.c_str(), &st) == 0 ? (double)st.st_size : 0.0;
+
+        out << ", \"save\": {\"time\": " << save_time << ", \"wait\": " << wait_time
+            << ", \"bytes\": " << bytes
+            << ", \"bytes_per_s\": " << bytes / (save_time + wait_time) << "}";
+    }
+
+    out << "}\n";
+
+    if (rank == 0)
+    {
+        fputs(out.str().c_str(), stdout);
+        fflush(stdout);
+        if (!json.empty())
+        {
+            FILE* fd = fopen(json.c_str(), "a");
+            if (!fd)
+                fprintf(stderr, "Error: cannot open %s\n", json.c_str());
+            else
+            {
+                fputs(out.str().c_str(), fd);
+                fclose(fd);
+            }
+        }
+    }
+
+    return 0;
+}
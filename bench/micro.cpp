@@ -0,0 +1,594 @@
+//
+// microbenchmarks of the geometric and topological kernels (Google Benchmark)
+//
+// every kernel runs on the local triangulation of one block of uniform random points generated
+// from a fixed seed (generators.h), so runs with the same backend see the same input; besides the
+// time per op, the bytes and number of heap allocations per op are reported (B/op, allocs/op)
+//
+// to validate a kernel rewrite, save a baseline with the old code and compare the new one to it:
+//
+//   tess-microbench --benchmark_out=base.json
+//   tess-microbench --baseline=base.json [--threshold=0.05]
+//
+// the comparison prints the change of the CPU time of every benchmark, and the exit status is 1
+// if any of them slowed down by more than the threshold
+//
+#include <vector>
+#include <map>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+
+#include "tess/tess.h"
+#include "tess/tess.hpp"
+#include "tess/tet.hpp"
+#include "tess/tet-neighbors.h"
+#include "tess/volume.h"
+#include "tess/dense.hpp"
+#ifdef TESS_USE_CGAL
+#include "tess/tess-cgal.h"
+#endif
+
+#include "generators.h"
+
+#define MICRO_SEED       0              // seed of the points of every fixture
+#define MICRO_GRID_STEP  0.5f           // density grid spacing, in mean interparticle spacings
+
+// ---------------------------------------------------------------------------
+// heap allocations, counted for B/op and allocs/op
+//
+// with glibc every malloc, calloc, and realloc (and so every operator new) is counted,
+// otherwise only operator new; aligned allocations (posix_memalign, aligned_alloc, memalign, and
+// so the aligned operator new) are never counted, as glibc exports no internal entry point for
+// all of them to forward to
+
+static std::atomic<size_t> alloc_bytes(0);
+static std::atomic<size_t> alloc_count(0);
+
+static inline void count_alloc(size_t size)
+{
+    alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+#ifdef __GLIBC__
+extern "C"
+{
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+
+void* malloc(size_t size)               { count_alloc(size); return __libc_malloc(size); }
+void* calloc(size_t n, size_t size)     { count_alloc(n * size); return __libc_calloc(n, size); }
+void* realloc(void* p, size_t size)     { count_alloc(size); return __libc_realloc(p, size); }
+}
+#else
+#include <new>
+void* operator new(size_t size)
+{
+    count_alloc(size);
+    void* p = malloc(size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept              { free(p); }
+void operator delete(void* p, size_t) noexcept      { free(p); }
+#endif
+
+// sets the B/op and allocs/op counters of a benchmark from the allocations during its lifetime
+struct AllocCounter
+{
+    AllocCounter(benchmark::State& state_):
+        state(state_),
+        bytes(alloc_bytes.load()),
+        count(alloc_count.load())       {}
+
+    ~AllocCounter()
+    {
+        state.counters["B/op"] = benchmark::Counter(alloc_bytes.load() - bytes,
+                                                    benchmark::Counter::kAvgIterations);
+        state.counters["allocs/op"] = benchmark::Counter(alloc_count.load() - count,
+                                                         benchmark::Counter::kAvgIterations);
+    }
+
+    benchmark::State&   state;
+    size_t              bytes;
+    size_t              count;
+};
+
+// ---------------------------------------------------------------------------
+// fixtures
+
+// a vertex v with its neighbor u and a tet ut of u (an edge of the Voronoi cell of v)
+struct edge_t
+{
+    int v, u, ut;
+};
+
+// a finite Voronoi cell prepared for the density kernels
+struct cell_t
+{
+    int                         site;
+    float                       min[3], max[3];
+    std::vector<float>          normals;
+    std::vector< std::vector<float> > face_verts;
+    int                         grid_pts[3];            // grid points covered by the bounding box
+    int                         min_grid_idx[3];
+    float                       min_grid_pos[3];
+    float                       probe[3];               // point in the bounding box, in or out
+};
+
+// the triangulation of n points, with the inputs of every kernel derived from it
+struct Triangulation
+{
+    Triangulation(int n)
+    {
+        bench_gen_t gen;
+        gen.dist  = DIST_UNIFORM;
+        gen.total = n;
+        gen.seed  = MICRO_SEED;
+
+        b = static_cast<DBlock*>(create_block());
+        b->gid         = 0;
+        b->bounds      = diy::ContinuousBounds(3);
+        b->box         = diy::ContinuousBounds(3);
+        b->data_bounds = diy::ContinuousBounds(3);
+        for (int d = 0; d < 3; d++)
+        {
+            b->bounds.min[d] = b->box.min[d] = b->data_bounds.min[d] = 0;
+            b->bounds.max[d] = b->box.max[d] = b->data_bounds.max[d] = gen.side();
+        }
+        b->num_attrs    = 0;
+        b->attrs        = NULL;
+        b->num_tets     = 0;
+        b->tets         = NULL;
+        b->rem_gids     = NULL;
+        b->rem_lids     = NULL;
+        b->vert_to_tet  = NULL;
+        b->num_grid_pts = 0;
+        b->density      = NULL;
+        b->num_fields   = 0;
+        b->fields       = NULL;
+        bench_generate(b, gen, n);
+
+        local_cells(b);
+        fill_circumcenters(circumcenters, b->tets, b->num_tets, b->particles);
+
+        std::mt19937                          rng(MICRO_SEED);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        float grid_step[3]  = { MICRO_GRID_STEP, MICRO_GRID_STEP, MICRO_GRID_STEP };
+        float grid_mins[3]  = { 0, 0, 0 };
+        for (int v = 0; v < b->num_particles; v++)
+        {
+            int t = b->vert_to_tet[v];
+            if (t < 0)
+                continue;
+            std::vector< std::pair<int, int> > nbrs;
+            if (!neighbor_edges(nbrs, v, b->tets, t) || !complete(v, b->tets, b->num_tets, t))
+                continue;
+
+            cells.push_back(v);
+            for (size_t i = 0; i < nbrs.size(); i++)
+            {
+                edge_t e = { v, nbrs[i].first, nbrs[i].second };
+                edges.push_back(e);
+            }
+
+            // as in dense(), only the cells inside the data bounds
+            cell_t c;
+            c.site = v;
+            CellBounds(b, v, c.min, c.max, c.normals, c.face_verts);
+            bool outside = false;
+            for (int d = 0; d < 3; d++)
+                if (c.min[d] < b->data_bounds.min[d] || c.max[d] > b->data_bounds.max[d])
+                    outside = true;
+            if (outside)
+                continue;
+            int max_grid_idx[3];
+            phys2idx(c.min, c.min_grid_idx, grid_step, grid_mins);
+            phys2idx(c.max, max_grid_idx, grid_step, grid_mins);
+            idx2phys(c.min_grid_idx, c.min_grid_pos, grid_step, grid_mins);
+            for (int d = 0; d < 3; d++)
+            {
+                c.grid_pts[d] = max_grid_idx[d] - c.min_grid_idx[d] + 1;
+                c.probe[d]    = c.min[d] + unit(rng) * (c.max[d] - c.min[d]);
+            }
+            max_cell_grid_pts = std::max(max_cell_grid_pts,
+                                         c.grid_pts[0] * c.grid_pts[1] * c.grid_pts[2]);
+            dense_cells.push_back(c);
+        }
+    }
+
+    ~Triangulation()                    { destroy_block(b); }
+
+    DBlock*                 b;
+    std::vector<float>      circumcenters;
+    std::vector<int>        cells;              // sites of the finite, complete cells
+    std::vector<edge_t>     edges;              // Voronoi faces of those cells
+    std::vector<cell_t>     dense_cells;
+    int                     max_cell_grid_pts = 8;
+};
+
+// one triangulation per size, built on first use
+static Triangulation& fixture(int n)
+{
+    static std::map<int, Triangulation*> fixtures;
+    Triangulation*& tr = fixtures[n];
+    if (!tr)
+        tr = new Triangulation(n);
+    return *tr;
+}
+
+// ---------------------------------------------------------------------------
+// kernels; one op is one call of the kernel, over the elements of the fixture in turn
+
+static void BM_circumcenter(benchmark::State& state)
+{
+    Triangulation& tr = fixture(state.range(0));
+    AllocCounter   allocs(state);
+    int            t = 0;
+    float          c[3];
+    for (auto _ : state)
+    {
+        circumcenter(c, &tr.b->tets[t], tr.b->particles);
+        benchmark::DoNotOptimize(c);
+        if (++t == tr.b->num_tets)
+            t = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_side_of_plane(benchmark::State& state)
+{
+    Triangulation& tr = fixture(state.range(0));
+    AllocCounter   allocs(state);
+    int            t = 0, j = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(side_of_plane(tr.b->box, &tr.b->tets[t], tr.b->particles, j));
+        if (++j == 4)
+        {
+            j = 0;
+            if (++t == tr.b->num_tets)
+                t = 0;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_neighbor_edges(benchmark::State& state)
+{
+    Triangulation& tr = fixture(state.range(0));
+    AllocCounter   allocs(state);
+    size_t         i = 0;
+    std::vector< std::pair<int, int> > nbrs;
+    for (auto _ : state)
+    {
+        int v = tr.cells[i];
+        nbrs.clear();
+        benchmark::DoNotOptimize(neighbor_edges(nbrs, v, tr.b->tets, tr.b->vert_to_tet[v]));
+        if (++i == tr.cells.size())
+            i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_complete(benchmark::State& state)
+{
+    Triangulation& tr = fixture(state.range(0));
+    AllocCounter   allocs(state);
+    size_t         i = 0;
+    for (auto _ : state)
+    {
+        int v = tr.cells[i];
+        benchmark::DoNotOptimize(complete(v, tr.b->tets, tr.b->num_tets, tr.b->vert_to_tet[v]));
+        if (++i == tr.cells.size())
+            i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_fill_edge_link(benchmark::State& state)
+{
+    Triangulation& tr = fixture(state.range(0));
+    AllocCounter   allocs(state);
+    size_t         i = 0;
+    std::vector<int> edge_link;
+    for (auto _ : state)
+    {
+        const edge_t& e = tr.edges[i];
+        edge_link.clear();
+        fill_edge_link(edge_link, e.v, e.u, e.ut, tr.b->tets);
+        benchmark::DoNotOptimize(edge_link.data());
+        if (++i == tr.edges.size())
+            i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_volume(benchmark::State& state)
+{
+    Triangulation& tr = fixture(state.range(0));
+    AllocCounter   allocs(state);
+    size_t         i = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(volume(tr.cells[i], tr.b->vert_to_tet, tr.b->tets,
+                                        tr.b->num_tets, tr.b->particles, tr.circumcenters));
+        if (++i == tr.cells.size())
+            i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_PtInCell(benchmark::State& state)
+{
+    Triangulation& tr = fixture(state.range(0));
+    AllocCounter   allocs(state);
+    size_t         i = 0;
+    for (auto _ : state)
+    {
+        cell_t& c = tr.dense_cells[i];
+        benchmark::DoNotOptimize(PtInCell(c.probe, c.normals, c.face_verts, 0.0001f));
+        if (++i == tr.dense_cells.size())
+            i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_CellInteriorGridPts(benchmark::State& state)
+{
+    Triangulation& tr = fixture(state.range(0));
+    std::vector<grid_pt_t> grid_pts(tr.max_cell_grid_pts);
+    std::vector<int>       border(2 * tr.max_cell_grid_pts);
+    float                  grid_step[3] = { MICRO_GRID_STEP, MICRO_GRID_STEP, MICRO_GRID_STEP };
+    AllocCounter           allocs(state);
+    size_t                 i = 0;
+    long long              grid_pts_found = 0;
+    for (auto _ : state)
+    {
+        cell_t& c = tr.dense_cells[i];
+        grid_pts_found += CellInteriorGridPts(c.grid_pts, c.min_grid_idx, c.min_grid_pos,
+                                              &grid_pts[0], &border[0], c.normals, c.face_verts,
+                                              grid_step, 0.0001f, 1.0f);
+        if (++i == tr.dense_cells.size())
+            i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["grid_pts/op"] = benchmark::Counter(grid_pts_found,
+                                                       benchmark::Counter::kAvgIterations);
+}
+
+static void BM_DistributeScalarCIC(benchmark::State& state)
+{
+    Triangulation& tr = fixture(state.range(0));
+    float          grid_step[3] = { MICRO_GRID_STEP, MICRO_GRID_STEP, MICRO_GRID_STEP };
+    float          grid_mins[3] = { 0, 0, 0 };
+    AllocCounter   allocs(state);
+    int            p = 0;
+    std::vector<int>   grid_idxs;
+    std::vector<float> grid_scalars;
+    for (auto _ : state)
+    {
+        grid_idxs.clear();
+        grid_scalars.clear();
+        DistributeScalarCIC(&tr.b->particles[3 * p], 1.0f, grid_idxs, grid_scalars, grid_step,
+                            grid_mins, 0.0001f);
+        benchmark::DoNotOptimize(grid_scalars.data());
+        if (++p == tr.b->num_particles)
+            p = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// one op fills the whole block; items are tets
+static void BM_fill_vert_to_tet(benchmark::State& state)
+{
+    Triangulation& tr = fixture(state.range(0));
+    AllocCounter   allocs(state);
+    for (auto _ : state)
+    {
+        fill_vert_to_tet(static_cast<dblock_t*>(tr.b));
+        benchmark::DoNotOptimize(tr.b->vert_to_tet);
+    }
+    state.SetItemsProcessed(state.iterations() * tr.b->num_tets);
+}
+
+// one op triangulates the whole block with the serial backend; items are points
+static void BM_local_cells(benchmark::State& state)
+{
+    Triangulation  work(state.range(0));
+    AllocCounter   allocs(state);
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        reset_block(work.b);
+        clean_delaunay_data_structure(work.b);
+        init_delaunay_data_structure(work.b);
+        state.ResumeTiming();
+
+        local_cells(work.b);
+    }
+    state.SetItemsProcessed(state.iterations() * work.b->num_particles);
+}
+
+#ifdef TESS_USE_CGAL
+// one op converts the whole CGAL triangulation; items are tets
+static void BM_gen_tets(benchmark::State& state)
+{
+    Triangulation&     tr = fixture(state.range(0));
+    Delaunay3D&        dt = *static_cast<Delaunay3D*>(tr.b->Dt);
+    std::vector<tet_t> tets(tr.b->num_tets);
+    AllocCounter       allocs(state);
+    for (auto _ : state)
+    {
+        gen_tets(dt, &tets[0]);
+        benchmark::DoNotOptimize(tets.data());
+    }
+    state.SetItemsProcessed(state.iterations() * tr.b->num_tets);
+}
+BENCHMARK(BM_gen_tets)->Arg(1 << 12)->Arg(1 << 15);
+#endif
+
+BENCHMARK(BM_circumcenter)->Arg(1 << 12)->Arg(1 << 15);
+BENCHMARK(BM_side_of_plane)->Arg(1 << 12)->Arg(1 << 15);
+BENCHMARK(BM_neighbor_edges)->Arg(1 << 12)->Arg(1 << 15);
+BENCHMARK(BM_complete)->Arg(1 << 12)->Arg(1 << 15);
+BENCHMARK(BM_fill_edge_link)->Arg(1 << 12)->Arg(1 << 15);
+BENCHMARK(BM_volume)->Arg(1 << 12)->Arg(1 << 15);
+BENCHMARK(BM_PtInCell)->Arg(1 << 12)->Arg(1 << 15);
+BENCHMARK(BM_CellInteriorGridPts)->Arg(1 << 12)->Arg(1 << 15);
+BENCHMARK(BM_DistributeScalarCIC)->Arg(1 << 12)->Arg(1 << 15);
+BENCHMARK(BM_fill_vert_to_tet)->Arg(1 << 12)->Arg(1 << 15);
+BENCHMARK(BM_local_cells)->Arg(1 << 12)->Arg(1 << 15)->Unit(benchmark::kMillisecond);
+
+// ---------------------------------------------------------------------------
+// comparison with a baseline
+
+// console output, also keeping the CPU time per op of every benchmark (mean of the repetitions)
+struct CollectingReporter: public benchmark::ConsoleReporter
+{
+    CollectingReporter():
+        ConsoleReporter(isatty(fileno(stdout)) ? OO_Defaults : OO_Tabular)  {}
+
+    void ReportRuns(const std::vector<Run>& reports) override
+    {
+        for (size_t i = 0; i < reports.size(); i++)
+        {
+            const Run& r = reports[i];
+            if (r.run_type != Run::RT_Iteration || r.error_occurred)
+                continue;
+            std::pair<double, int>& t = times[r.benchmark_name()];
+            t.first  += r.GetAdjustedCPUTime() / benchmark::GetTimeUnitMultiplier(r.time_unit) * 1e9;
+            t.second += 1;
+        }
+        ConsoleReporter::ReportRuns(reports);
+    }
+
+    std::map<std::string, std::pair<double, int> >  times;      // name -> (sum of ns, runs)
+};
+
+// value of "key": in the JSON text s between pos and end, "" if there is none
+static std::string json_value(const std::string& s,
+                              const std::string& key,
+                              size_t pos,
+                              size_t end)
+{
+    end = std::min(end, s.size());
+    size_t k = s.find("\"" + key + "\":", pos);
+    if (k == std::string::npos || k >= end)
+        return "";
+    k = s.find_first_not_of(" \t", k + key.size() + 3);
+    if (k == std::string::npos || k >= end)
+        return "";
+    if (s[k] == '"')
+    {
+        size_t q = s.find('"', k + 1);
+        return q < end ? s.substr(k + 1, q - k - 1) : "";
+    }
+    return s.substr(k, std::min(s.find_first_of(",}\n", k), end) - k);
+}
+
+// CPU ns per op of the iteration runs in a --benchmark_out JSON file (mean of the repetitions)
+static bool read_baseline(const char* infile,
+                          std::map<std::string, double>& base)
+{
+    std::ifstream in(infile);
+    if (!in)
+        return false;
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string s = ss.str();
+
+    std::map<std::string, std::pair<double, int> > sums;
+    size_t pos = s.find("\"benchmarks\"");
+    while (pos != std::string::npos && (pos = s.find('{', pos)) != std::string::npos)
+    {
+        size_t end = s.find('}', pos);
+        if (json_value(s, "run_type", pos, end) == "iteration")
+        {
+            std::string unit  = json_value(s, "time_unit", pos, end);
+            double      scale = unit == "s" ? 1e9 : unit == "ms" ? 1e6 : unit == "us" ? 1e3 : 1;
+            std::pair<double, int>& t = sums[json_value(s, "name", pos, end)];
+            t.first  += atof(json_value(s, "cpu_time", pos, end).c_str()) * scale;
+            t.second += 1;
+        }
+        pos = end;
+    }
+    for (std::map<std::string, std::pair<double, int> >::iterator it = sums.begin();
+         it != sums.end(); it++)
+        base[it->first] = it->second.first / it->second.second;
+    return true;
+}
+
+// prints the change of every benchmark; returns the number slower by more than threshold
+static int compare(const CollectingReporter& reporter,
+                   const std::map<std::string, double>& base,
+                   double threshold)
+{
+    int regressions = 0;
+    fprintf(stdout, "\n%-36s %14s %14s %9s\n", "Comparison", "Base ns/op", "ns/op", "Change");
+    for (std::map<std::string, std::pair<double, int> >::const_iterator it = reporter.times.begin();
+         it != reporter.times.end(); it++)
+    {
+        double cur = it->second.first / it->second.second;
+        std::map<std::string, double>::const_iterator b = base.find(it->first);
+        if (b == base.end() || b->second <= 0)
+        {
+            fprintf(stdout, "%-36s %14s %14.1f %9s\n", it->first.c_str(), "-", cur, "new");
+            continue;
+        }
+        double change = cur / b->second - 1;
+        bool   slower = change > threshold;
+        regressions  += slower;
+        fprintf(stdout, "%-36s %14.1f %14.1f %+8.1f%%%s\n", it->first.c_str(), b->second, cur,
+                100 * change, slower ? "  SLOWER" : "");
+    }
+    return regressions;
+}
+
+int main(int argc, char** argv)
+{
+    // our options, removed before benchmark::Initialize()
+    const char* baseline  = NULL;
+    double      threshold = 0.05;
+    int         n = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strncmp(argv[i], "--baseline=", 11))
+            baseline = argv[i] + 11;
+        else if (!strncmp(argv[i], "--threshold=", 12))
+            threshold = atof(argv[i] + 12);
+        else
+            argv[n++] = argv[i];
+    }
+    argc = n;
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+
+    std::map<std::string, double> base;
+    if (baseline && !read_baseline(baseline, base))
+    {
+        fprintf(stderr, "Error: cannot read baseline %s\n", baseline);
+        return 1;
+    }
+
+    CollectingReporter reporter;
+    benchmark::RunSpecifiedBenchmarks(&reporter);
+    benchmark::Shutdown();
+
+    if (baseline && compare(reporter, base, threshold))
+        return 1;
+    return 0;
+}
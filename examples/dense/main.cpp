@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <math.h>
 #include <vector>
 #include "tess/tess.h"
 #include "tess/tess.hpp"
@@ -95,6 +96,57 @@ void ParseArgs(int argc,
     }
 }
 
+// whether the output file name asks for a compressed, chunked grid file (*.tgrid)
+bool CompressedOutput(const char *outfile)
+{
+    size_t len = strlen(outfile);
+    return len >= 6 && !strcmp(outfile + len - 6, ".tgrid");
+}
+
+// reads back the chunk of every local block from a compressed grid file and compares it
+// with the block grid
+//
+// returns: global number of grid points that differ by more than the error bound of the file
+long long VerifyGrid(const char *outfile,
+                     diy::Master& master)
+{
+    grid_file_header_t header;
+    vector<grid_chunk_t> chunks;
+    long long errors = 0;
+    if (!ReadGridIndex(outfile, header, chunks))
+        errors = 1;
+
+    for (size_t c = 0; c < chunks.size(); c++)
+    {
+        int lid = master.lid(chunks[c].gid);
+        if (lid < 0)
+            continue;
+        DBlock* b = master.block<DBlock>(lid);
+
+        int min_idx[3], max_idx[3];
+        for (int i = 0; i < 3; i++)
+        {
+            min_idx[i] = chunks[c].min_idx[i];
+            max_idx[i] = chunks[c].min_idx[i] + chunks[c].num_idx[i] - 1;
+        }
+        size_t npts = (size_t)chunks[c].num_idx[0] * chunks[c].num_idx[1] *
+            chunks[c].num_idx[2];
+        vector<float> region(npts);
+        if (!ReadGridRegion(outfile, min_idx, max_idx, &region[0]))
+        {
+            errors += npts;
+            continue;
+        }
+        for (size_t i = 0; i < npts; i++)
+            if (!(fabs(region[i] - b->density[i]) <= header.max_err))
+                errors++;
+    }
+
+    long long tot_errors;
+    MPI_Allreduce(&errors, &tot_errors, 1, MPI_LONG_LONG, MPI_SUM, master.communicator());
+    return tot_errors;
+}
+
 int main(int argc, char** argv)
 {
     int tot_blocks;                             // global number of blocks
@@ -155,10 +207,10 @@ int main(int argc, char** argv)
                                      &storage,
                                      &save_block,
                                      &load_block);
-    diy::RoundRobinAssigner   assigner(world.size(), -1);  // tot_blocks found by read_blocks
+    diy::RoundRobinAssigner   assigner(world.size(), -1);  // tot_blocks found by tess_load
 
     // read the tessellation
-    diy::io::read_blocks(argv[1], world, assigner, master, &load_block_light);
+    tess_load(master, assigner, argv[1]);
     tot_blocks = assigner.nblocks();
 
     // get global block quantities
@@ -177,11 +229,27 @@ int main(int argc, char** argv)
     // write file
     // NB: all blocks need to be in memory; WriteGrid is not diy2'ed yet
     times[OUTPUT_TIME] = MPI_Wtime();
-    WriteGrid(maxblocks, tot_blocks, argv[2], project, glo_num_idx, eps, data_mins, data_maxs,
-              num_given_bounds, given_mins, given_maxs, master, assigner);
+    bool compressed = CompressedOutput(argv[2]);
+    if (compressed)
+        WriteGridCompressed(tot_blocks, argv[2], project, glo_num_idx, eps, data_mins, data_maxs,
+                            num_given_bounds, given_mins, given_maxs, COMPRESS_DEFAULT, 0.0,
+                            master, assigner);
+    else
+        WriteGrid(maxblocks, tot_blocks, argv[2], project, glo_num_idx, eps, data_mins, data_maxs,
+                  num_given_bounds, given_mins, given_maxs, master, assigner);
     MPI_Barrier(comm);
     times[OUTPUT_TIME] = MPI_Wtime() - times[OUTPUT_TIME];
 
+    // check that the compressed file reads back to the grid
+    if (compressed)
+    {
+        long long errors = VerifyGrid(argv[2], master);
+        int rank;
+        MPI_Comm_rank(comm, &rank);
+        if (rank == 0)
+            fprintf(stderr, "Compressed grid read back with %lld differing grid points\n", errors);
+    }
+
 
     MPI_Barrier(comm);
     times[TOTAL_TIME] = MPI_Wtime() - times[TOTAL_TIME];
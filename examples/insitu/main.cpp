@@ -0,0 +1,121 @@
+//
+// in situ tessellation of a toy simulation
+//
+// every process moves its particles (a jittered lattice in its own slab of a periodic box) by
+// random velocities, and tessellates the whole box every few steps through the in situ
+// interface, without files; with --async, the tessellation of a snapshot overlaps the next steps
+//
+#include "mpi.h"
+#include <vector>
+#include <random>
+#include <iostream>
+#include <stdio.h>
+
+#include "tess/insitu.h"
+
+#include "../opts.h"
+
+// called on every process at the end of a run
+void analyze(const tess_insitu_result_t* result,
+             void* user)
+{
+  int rank = *(int*)user;
+
+  // e.g., the local blocks: result->blocks[i]->tets, ->density
+  long long tets = 0;
+  for (int i = 0; i < result->num_blocks; i++)
+    tets += result->blocks[i]->num_tets;
+
+  if (rank == 0)
+    fprintf(stderr, "step %d: %lld particles, %lld tets (%lld local) in %lu rounds, "
+            "%.3lf s tess + %.3lf s density\n", result->step, result->particles, result->tets,
+            tets, result->rounds, result->tess_time, result->dense_time);
+}
+
+int main(int argc, char *argv[])
+{
+  int provided;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+  MPI_Comm comm = MPI_COMM_WORLD;
+  int rank, size;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+
+  using opts::Option;
+  using opts::Present;
+  opts::Options ops(argc, argv);
+
+  int   side  = 16;                           // lattice points per side
+  int   steps = 10;                           // simulation steps
+  int   every = 5;                            // steps between tessellations
+  int   grid  = 0;                            // density grid points per side (0: none)
+  float speed = 0.05;                         // max displacement per step, in lattice spacings
+  ops >> Option('s', "side",  side,  "lattice points per side of the box")
+      >> Option('n', "steps", steps, "simulation steps")
+      >> Option('e', "every", every, "steps between tessellations")
+      >> Option('g', "grid",  grid,  "density grid points per side (0: no density)")
+      >> Option('v', "speed", speed, "max displacement per step, in lattice spacings");
+  bool async = ops >> Present('a', "async", "tessellate on a helper thread");
+  if (ops >> Present('h', "help", "show help"))
+  {
+    if (rank == 0)
+      std::cout << ops;
+    MPI_Finalize();
+    return 1;
+  }
+
+  // this process's slab of the lattice, jittered, with a mass attribute
+  std::mt19937 rng(rank);
+  std::uniform_real_distribution<float> unit(-0.5, 0.5);
+  std::vector<float> pos;
+  std::vector<float> mass;
+  for (int i = rank * side / size; i < (rank + 1) * side / size; i++)
+    for (int j = 0; j < side; j++)
+      for (int k = 0; k < side; k++)
+      {
+        pos.push_back(i + 0.5 + 0.5 * unit(rng));
+        pos.push_back(j + 0.5 + 0.5 * unit(rng));
+        pos.push_back(k + 0.5 + 0.5 * unit(rng));
+        mass.push_back(1.0 + unit(rng));
+      }
+  size_t n = mass.size();
+
+  tess_insitu_params_t params;
+  tess_insitu_default_params(&params);
+  for (int d = 0; d < 3; d++)
+  {
+    params.domain_min[d] = 0.0;
+    params.domain_max[d] = side;
+    params.grid[d]       = grid;
+  }
+  params.wrap      = 1;
+  params.async     = async;
+  params.mass_attr = 0;                       // the first attribute registered
+
+  tess_insitu_t* ts = tess_insitu_create(comm, &params);
+  tess_insitu_particles(ts, &pos[0], &pos[1], &pos[2], n, 3 * sizeof(float));
+  tess_insitu_attribute(ts, &mass[0], sizeof(float));
+  tess_insitu_callback(ts, &analyze, &rank);
+
+  for (int step = 1; step <= steps; step++)
+  {
+    // the simulation: random moves in the periodic box
+    for (size_t i = 0; i < pos.size(); i++)
+    {
+      pos[i] += speed * 2.0 * unit(rng);
+      if (pos[i] < 0.0)
+        pos[i] += side;
+      if (pos[i] >= side)
+        pos[i] -= side;
+    }
+
+    if (step % every == 0)
+      tess_insitu_run(ts, step);
+  }
+
+  tess_insitu_destroy(ts);                    // waits for the last run
+
+  MPI_Finalize();
+
+  return 0;
+}
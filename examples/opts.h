@@ -48,6 +48,12 @@ struct Traits<unsigned>
     static std::string  type_string()               { return "UNSIGNED INT"; }
 };
 
+template<>
+struct Traits<long long>
+{
+    static std::string  type_string()               { return "LONG LONG INT"; }
+};
+
 template<>
 struct Traits<short unsigned>
 {
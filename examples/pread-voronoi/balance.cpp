@@ -303,6 +303,33 @@ int main(int argc, char *argv[])
                       << times[EXCH_TIME]
                       << std::endl;
         }
+
+        // space-filling curves
+        const char* curves[2] = { "Morton", "Hilbert" };
+        for (int hilbert = 0; hilbert < 2; ++hilbert)
+        {
+            master.clear();
+            diy::decompose(3, rank, domain, assigner, fill_block);
+            tess_sfc_exchange(master, assigner, times, false, hilbert);
+
+            // figure out the maxs
+            master.foreach([](DBlock* b, const diy::Master::ProxyWithLink& cp)
+                           {
+                               cp.collectives()->clear();
+                               cp.all_reduce(b->num_particles, diy::mpi::maximum<int>());
+                           });
+            master.exchange();
+
+            if (rank == 0)
+            {
+                int all_max_sfc = master.proxy(0).get<int>();
+                std::cout << "SFC (" << curves[hilbert] << "): "
+                          << all_max_sfc << ' '
+                          << float(all_max_sfc)/average << ' '
+                          << times[EXCH_TIME]
+                          << std::endl;
+            }
+        }
     }
 
     return 0;
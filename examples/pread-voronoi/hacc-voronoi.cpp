@@ -134,16 +134,6 @@ int main(int argc, char *argv[])
     //             infile.c_str(), outfile.c_str(), minvol, maxvol, wrap_,
     //             sample_rate, num_threads, mem_blocks, kdtree, tot_blocks);
 
-    if (kdtree)
-    {
-        if (mem_blocks != -1)
-        {
-            if (rank == 0)
-                std::cout << "kdtree doesn't yet support the out-of-core mode\n";
-            return 1;
-        }
-    }
-
     if (outfile == "!")
         outfile = "";
 
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <cassert>
+#include <algorithm>
 
 #include <hdf5.h>
 
@@ -16,20 +17,72 @@ read_particles(MPI_Comm comm,
                const char *infile, int rank, int size,
                std::vector <float> &particles,
                const std::vector <std::string>& coordinates)
+{
+  std::vector<int>                  gids(1, rank);
+  std::vector< std::vector<float> > block_particles;
+  size_t count = read_particles(comm, infile, gids, size, block_particles, coordinates);
+  particles.swap(block_particles[0]);
+  return count;
+}
+
+// reads the particles of the local blocks, straight into one vector per block
+//
+// block gid gets the contiguous slice [count / nblocks * gid, count / nblocks * (gid + 1)) of the
+// particles, the last block the remainder; the memory selection has a stride of 3, so HDF5
+// scatters each coordinate directly into the interleaved particles without a temporary
+//
+// collective: the blocks are read in rounds, one collective read per coordinate for the k-th
+// local block of every process, and every process in comm must call this exactly once, even if
+// it has no blocks (processes may have different numbers of blocks); otherwise each call reads
+// independently, eg. one block at a time as blocks are created
+//
+// gids: gids of the local blocks
+// nblocks: total number of blocks
+// particles: particles of the local blocks, in the order of gids (output)
+// bandwidth: aggregate read bandwidth in MB/s, the same on all processes (output, optional,
+//   collective reads only)
+// collective: whether to read collectively
+// returns the total number of particles in the file
+size_t
+io::hdf5::
+read_particles(MPI_Comm comm,
+               const char *infile,
+               const std::vector<int>& gids,
+               int nblocks,
+               std::vector< std::vector<float> >& particles,
+               const std::vector<std::string>& coordinates,
+               double* bandwidth,
+               bool collective)
 {
   herr_t status;
 
+  double t0 = 0;
+  if (collective)
+  {
+    MPI_Barrier(comm);
+    t0 = MPI_Wtime();
+  }
+
+  hid_t     file_id;
+  hid_t     xfer_plist    = H5P_DEFAULT;
 #ifdef H5_HAVE_PARALLEL
-  MPI_Info  info        = MPI_INFO_NULL;
-  hid_t     acc_tpl1    = H5Pcreate (H5P_FILE_ACCESS);
-  assert(acc_tpl1 != -1);
-  herr_t    ret         = H5Pset_fapl_mpio(acc_tpl1, comm, info);       // set up parallel access with communicator
-  assert(ret != -1);
-
-  hid_t     file_id       = H5Fopen(infile, H5F_ACC_RDONLY, acc_tpl1);
-#else
-  hid_t     file_id       = H5Fopen(infile, H5F_ACC_RDONLY, H5P_DEFAULT);
+  hid_t     acc_tpl1      = -1;
+  if (collective)
+  {
+    MPI_Info  info        = MPI_INFO_NULL;
+    acc_tpl1              = H5Pcreate (H5P_FILE_ACCESS);
+    assert(acc_tpl1 != -1);
+    herr_t    ret         = H5Pset_fapl_mpio(acc_tpl1, comm, info);       // set up parallel access with communicator
+    assert(ret != -1);
+
+    file_id               = H5Fopen(infile, H5F_ACC_RDONLY, acc_tpl1);
+
+    xfer_plist            = H5Pcreate(H5P_DATASET_XFER);
+    ret = H5Pset_dxpl_mpio(xfer_plist, H5FD_MPIO_COLLECTIVE);
+    assert(ret != -1);
+  } else
 #endif
+    file_id               = H5Fopen(infile, H5F_ACC_RDONLY, H5P_DEFAULT);
   hid_t     dataset_id    = H5Dopen2(file_id, coordinates[0].c_str(), H5P_DEFAULT);
   hid_t     dataspace_id  = H5Dget_space(dataset_id);
 
@@ -41,36 +94,73 @@ read_particles(MPI_Comm comm,
   status = H5Sclose(dataspace_id);
   status = H5Dclose(dataset_id);
 
-  hsize_t  offset = count/size*rank;
-  hsize_t  local_count = (rank != size - 1 ? count/size : count - count/size*rank);
+  // rounds: the most local blocks of any process
+  int nlocal = gids.size(), rounds = nlocal;
+  if (collective)
+    MPI_Allreduce(&nlocal, &rounds, 1, MPI_INT, MPI_MAX, comm);
 
-  std::vector<float>  tmp(local_count);         // optimizes reading
-  particles.resize(3*local_count);
-
-  for (size_t i = 0; i < 3; ++i)
+  particles.resize(gids.size());
+  for (int k = 0; k < rounds; ++k)
   {
-    std::string   c             = coordinates[i];
-    hid_t         dataset_id    = H5Dopen2(file_id, c.c_str(), H5P_DEFAULT);
-    hid_t         dataspace_id  = H5Dget_space(dataset_id);
-
-    status = H5Sselect_hyperslab (dataspace_id, H5S_SELECT_SET, &offset, NULL, &local_count, NULL);
-
-    hid_t         memspace_id   = H5Screate_simple(1, &local_count, NULL);
-    status = H5Dread (dataset_id, H5T_NATIVE_FLOAT, memspace_id, dataspace_id, H5P_DEFAULT, &tmp[0]);
-
-    // stripe into particles
-    for (size_t j = 0; j < local_count; ++j)
-        particles[3*j + i] = tmp[j];                  // probably wildly cache inefficient
-
-    status = H5Sclose(memspace_id);
-    status = H5Sclose(dataspace_id);
-    status = H5Dclose(dataset_id);
+    // slice of the k-th local block, if any
+    hsize_t offset = 0, local_count = 0;
+    if (k < nlocal)
+    {
+      offset      = count/nblocks*gids[k];
+      local_count = (gids[k] != nblocks - 1 ? count/nblocks : count - count/nblocks*gids[k]);
+      particles[k].resize(3*local_count);
+    }
+    hsize_t mem_count = std::max<hsize_t>(3*local_count, 1);
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+      std::string   c             = coordinates[i];
+      hid_t         dataset_id    = H5Dopen2(file_id, c.c_str(), H5P_DEFAULT);
+      hid_t         dataspace_id  = H5Dget_space(dataset_id);
+      hid_t         memspace_id   = H5Screate_simple(1, &mem_count, NULL);
+
+      if (local_count)
+      {
+        status = H5Sselect_hyperslab(dataspace_id, H5S_SELECT_SET, &offset, NULL, &local_count, NULL);
+
+        // every third float, starting at coordinate i
+        hsize_t start = i, stride = 3;
+        status = H5Sselect_hyperslab(memspace_id, H5S_SELECT_SET, &start, &stride, &local_count, NULL);
+      } else
+      {
+        // a collective read needs every process, even one with nothing to read
+        status = H5Sselect_none(dataspace_id);
+        status = H5Sselect_none(memspace_id);
+      }
+
+      if (local_count || collective)
+      {
+        status = H5Dread(dataset_id, H5T_NATIVE_FLOAT, memspace_id, dataspace_id, xfer_plist,
+                         local_count ? &particles[k][0] : NULL);
+        assert(status >= 0);
+      }
+
+      status = H5Sclose(memspace_id);
+      status = H5Sclose(dataspace_id);
+      status = H5Dclose(dataset_id);
+    }
   }
 
   status = H5Fclose(file_id);
 #ifdef H5_HAVE_PARALLEL
-  status = H5Pclose(acc_tpl1);
+  if (collective)
+  {
+    status = H5Pclose(xfer_plist);
+    status = H5Pclose(acc_tpl1);
+  }
 #endif
 
+  if (collective && bandwidth)
+  {
+    double t = MPI_Wtime() - t0, max_t;
+    MPI_Allreduce(&t, &max_t, 1, MPI_DOUBLE, MPI_MAX, comm);
+    *bandwidth = max_t > 0 ? 3.0 * count * sizeof(float) / 1048576 / max_t : 0;
+  }
+
   return count;
 }
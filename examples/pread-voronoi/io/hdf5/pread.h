@@ -15,6 +15,15 @@ size_t read_particles(MPI_Comm comm,
                       std::vector <float> &particles,
                       const std::vector<std::string>& coordinates);
 
+size_t read_particles(MPI_Comm comm,
+                      const char *infile,
+                      const std::vector<int>& gids,
+                      int nblocks,
+                      std::vector< std::vector<float> >& particles,
+                      const std::vector<std::string>& coordinates,
+                      double* bandwidth = NULL,
+                      bool collective = true);
+
 }
 }
 
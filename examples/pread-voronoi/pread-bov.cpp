@@ -176,19 +176,6 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    if (kdtree)
-    {
-        if (mem_blocks != -1)
-        {
-            if (rank == 0)
-                fprintf(stderr, "kdtree doesn't yet support the out-of-core mode\n");
-            return 1;
-        }
-
-        if (wrap_ && tot_blocks < 64 && rank == 0)
-            fprintf(stderr, "Warning: using k-d tree with wrap on and fewer than 64 blocks is likely to fail\n");
-    }
-
     timing(times, -1, -1, world);
     timing(times, TOT_TIME, -1, world);
 
@@ -280,16 +280,6 @@ int main(int argc, char *argv[])
     //     fprintf(stderr, "infile %s outfile %s th %d mb %d opts %d tb %d\n",
     //             infile.c_str(), outfile.c_str(), num_threads, mem_blocks, kdtree, tot_blocks);
 
-    if (kdtree)
-    {
-        if (mem_blocks != -1)
-        {
-            if (rank == 0)
-                fprintf(stderr, "kdtree doesn't yet support the out-of-core mode\n");
-            return 1;
-        }
-    }
-
     timing(times, -1, -1, world);
     timing(times, TOT_TIME, -1, world);
 
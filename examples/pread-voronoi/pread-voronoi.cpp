@@ -33,11 +33,15 @@ struct AddAndRead: public AddBlock
     AddAndRead(diy::Master&                     m,
                int                              nblocks_,
                const char*                      infile_,
-               const std::vector<std::string>&  coordinates_):
+               const std::vector<std::string>&  coordinates_,
+               const std::vector<int>&          gids_,
+               std::vector< std::vector<float> >& hdf5_particles_):
         AddBlock(m),
         nblocks(nblocks_),
         infile(infile_),
-        coordinates(coordinates_)       {}
+        coordinates(coordinates_),
+        gids(gids_),
+        hdf5_particles(hdf5_particles_) {}
 
     void  operator()(int gid, const Bounds& core, const Bounds& bounds, const Bounds& domain,
                      const RCLink& link) const
@@ -60,12 +64,20 @@ struct AddAndRead: public AddBlock
                                            coordinates);
             } else      // assume HDF5
 #endif
-                io::hdf5::read_particles(master.communicator(),
-                                         infile,
-                                         gid,
-                                         nblocks,
-                                         particles,
-                                         coordinates);
+            if (!hdf5_particles.empty())
+            {
+                // already read collectively for all local blocks
+                size_t i = std::find(gids.begin(), gids.end(), gid) - gids.begin();
+                particles.swap(hdf5_particles[i]);
+            } else
+            {
+                // blocks out of core: read only this block, as it is created
+                std::vector<int>                  gid_(1, gid);
+                std::vector< std::vector<float> > block_particles;
+                io::hdf5::read_particles(master.communicator(), infile, gid_, nblocks,
+                                         block_particles, coordinates, NULL, false);
+                particles.swap(block_particles[0]);
+            }
 
             b->num_particles = particles.size()/3;
             b->num_orig_particles = b->num_particles;
@@ -83,6 +95,9 @@ struct AddAndRead: public AddBlock
     int                                 nblocks;
     const char*                         infile;
     const std::vector<std::string>&     coordinates;
+    const std::vector<int>&             gids;           // local gids
+    std::vector< std::vector<float> >&  hdf5_particles; // particles of the local gids, empty
+                                                        // if blocks read themselves
     Bounds*                             data_bounds; // global data bounds (for hacc only)
 };
 
@@ -116,7 +131,12 @@ int main(int argc, char *argv[])
     tot_blocks    = size;
     num_threads   = 4;
     mem_blocks    = -1;
+    const int default_swap_k = 2;
+    int swap_k    = default_swap_k;
+    kdtree_cost_t kdtree_cost;
     string prefix = "./DIY.XXXXXX";
+    string profile;
+    string trace;
     minvol        = 0;
     maxvol        = 0;
 
@@ -127,11 +147,20 @@ int main(int argc, char *argv[])
         >> Option('t', "threads",   num_threads,  "Number of threads to use")
         >> Option('m', "in-memory", mem_blocks,   "Number of blocks to keep in memory")
         >> Option('s', "storage",   prefix,       "Path for out-of-core storage")
+        >> Option('p', "profile",   profile,      "Write the round profile to <profile>.json and .csv")
+        >> Option(     "trace",     trace,        "Write a Chrome trace (needs -Dtrace=on)")
+        >> Option('k', "swap-k",    swap_k,       "Radix of the swap exchange (regular, out of core only)")
+        >> Option(     "bins",      kdtree_cost.bins,   "Histogram bins of the cost k-d tree")
+        >> Option(     "refine",    kdtree_cost.refine, "Histogram refinements of the cost k-d tree")
+        >> Option(     "ghost",     kdtree_cost.ghost,  "Relative cost of a ghost particle in the cost k-d tree")
         >> Option(     "minvol",    minvol,       "minvol cutoff")
         >> Option(     "maxvol",    maxvol,       "minvol cutoff")
         ;
     wrap_ = ops >> Present('w', "wrap", "Use periodic boundary conditions");
     bool kdtree = ops >> Present(     "kdtree", "use kdtree decomposition");
+    bool cost_kdtree = ops >> Present("cost-kdtree", "use kdtree decomposition balancing predicted cost");
+    bool sfc = ops >> Present(        "sfc", "use Hilbert curve decomposition (all blocks in memory)");
+    bool morton = ops >> Present(     "morton", "use Morton curve decomposition (all blocks in memory)");
 
     coordinates.resize(3);
     if (  ops >> Present('h', "help", "show help") ||
@@ -150,22 +179,27 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    if (kdtree)
+    if ((sfc || morton) && mem_blocks != -1)
     {
-        if (mem_blocks != -1)
-        {
-            if (rank == 0)
-                std::cout << "kdtree doesn't yet support the out-of-core mode\n";
-            return 1;
-        }
-
-        if (wrap_ && tot_blocks < 64 && rank == 0)
-            fprintf(stderr, "Warning: using k-d tree with wrap on and fewer than 64 blocks is likely to fail\n");
+        if (rank == 0)
+            fprintf(stderr, "The space-filling curve decomposition needs all blocks in memory\n");
+        return 1;
     }
 
+    // the swap exchange only runs with the regular decomposition and blocks out of core
+    if (swap_k != default_swap_k && (mem_blocks == -1 || kdtree || cost_kdtree || sfc || morton) &&
+        rank == 0)
+        fprintf(stderr, "Warning: --swap-k has no effect with all blocks in memory or a "
+                "k-d tree or curve decomposition\n");
+
     if (outfile == "!")
         outfile = "";
 
+    if (!profile.empty())
+        tess_profile_start();
+    if (!trace.empty())
+        tess_trace_start(world);
+
     timing(times, -1, -1, world);
     timing(times, TOT_TIME, -1, world);
 
@@ -182,14 +216,35 @@ int main(int argc, char *argv[])
     // NB: AddAndRead for hacc assumes contiguous; don't switch to round robin
     diy::ContiguousAssigner   assigner(world.size(), tot_blocks);
 
+    std::vector<int> my_gids;
+    assigner.local_gids(rank, my_gids);
+
+    // with all blocks in memory, read the particles of all local blocks with collective HDF5 I/O
+    // up front; a collective read cannot be issued as each block is created, because processes
+    // may have different numbers of blocks
+    // with blocks out of core, each block reads its own particles as it is created instead, so
+    // that only the blocks in memory hold particles
+    std::vector< std::vector<float> > hdf5_particles;
+#if defined TESS_GADGET_IO
+    if (infile.size() <= 7 || infile.substr(0,7) != "gadget:")
+#endif
+    if (mem_blocks == -1)
+    {
+        double bandwidth;
+        io::hdf5::read_particles(world, infile.c_str(), my_gids, tot_blocks, hdf5_particles,
+                                 coordinates, &bandwidth);
+        if (rank == 0)
+            fprintf(stderr, "input bandwidth               = %.1lf MB/s\n", bandwidth);
+    }
+
     AddAndRead                create_and_read(master,
                                               tot_blocks,
                                               infile.c_str(),
-                                              coordinates);
+                                              coordinates,
+                                              my_gids,
+                                              hdf5_particles);
 
     // decompose
-    std::vector<int> my_gids;
-    assigner.local_gids(rank, my_gids);
     diy::RegularDecomposer<Bounds>::BoolVector          wrap;
     diy::RegularDecomposer<Bounds>::BoolVector          share_face;
     diy::RegularDecomposer<Bounds>::CoordinateVector    ghosts;
@@ -198,10 +253,19 @@ int main(int argc, char *argv[])
     diy::decompose(3, rank, domain, assigner, create_and_read, share_face, wrap, ghosts);
 
     // sort and distribute particles to all blocks
-    if (kdtree)
+    // with all blocks in memory, particles go straight to their blocks in one exchange; the
+    // contiguous slices that were read have no relation to space, so swapping them through
+    // log_k(nblocks) rounds moves nearly every particle several times
+    if (cost_kdtree)
+        tess_cost_kdtree_exchange(master, assigner, times, wrap_, kdtree_cost);
+    else if (kdtree)
         tess_kdtree_exchange(master, assigner, times, wrap_);
+    else if (sfc || morton)
+        tess_sfc_exchange(master, assigner, times, wrap_, !morton);
+    else if (mem_blocks == -1)
+        tess_direct_exchange(master, assigner, times);
     else
-        tess_exchange(master, assigner, times);
+        tess_exchange(master, assigner, times, swap_k);
     if (rank == 0)
         printf("particles exchanged\n");
 
@@ -219,6 +283,16 @@ int main(int argc, char *argv[])
 
     timing(times, -1, TOT_TIME, world);
     tess_stats(master, quants, times);
+    if (!profile.empty())
+    {
+        tess_profile_stop();
+        tess_profile_write(world, (profile + ".json").c_str(), (profile + ".csv").c_str());
+    }
+    if (!trace.empty())
+    {
+        tess_trace_stop();
+        tess_trace_write(world, trace.c_str());
+    }
 
     // Storage + memory stats
     size_t max_storage = storage.max_size(),
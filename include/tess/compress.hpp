@@ -0,0 +1,87 @@
+// ---------------------------------------------------------------------------
+//
+//   compression of float arrays (density grids) and tets for block output
+//
+// --------------------------------------------------------------------------
+#ifndef _COMPRESS_HPP
+#define _COMPRESS_HPP
+
+#include <stddef.h>
+#include <vector>
+
+#include <diy/serialization.hpp>
+
+#include "tet.h"
+
+// codecs
+// the codec id is stored in the first byte of every compressed stream, so
+// a stream can always be decoded regardless of how it was written
+enum compress_t
+{
+    COMPRESS_NONE,              // raw floats
+    COMPRESS_ZERO_RUN,          // lossless zero-run elimination
+    COMPRESS_ZSTD,              // zero-run elimination followed by zstd (requires TESS_ZSTD)
+    COMPRESS_QUANT,             // lossy, error-bounded quantization with zero-run elimination
+    COMPRESS_NUM_CODECS,
+};
+
+// best lossless codec available in this build
+#ifdef TESS_ZSTD
+const compress_t COMPRESS_DEFAULT = COMPRESS_ZSTD;
+#else
+const compress_t COMPRESS_DEFAULT = COMPRESS_ZERO_RUN;
+#endif
+
+size_t compress_floats(const float* in,
+                       size_t n,
+                       compress_t codec,
+                       float max_err,
+                       std::vector<char>& out);
+bool decompress_floats(const char* in,
+                       size_t nbytes,
+                       float* out,
+                       size_t n);
+void save_compressed(diy::BinaryBuffer& bb,
+                     const float* x,
+                     size_t n,
+                     compress_t codec = COMPRESS_DEFAULT);
+void load_compressed(diy::BinaryBuffer& bb,
+                     float* x,
+                     size_t n);
+
+// tet codecs
+// the compact codecs store only the vertices: each tet is rotated (by an even permutation, so
+// its orientation is kept) to start at its lowest vertex, tets are sorted, and vertices are
+// delta coded in the Morton order of the particles, which the decoder recomputes from the
+// particles; adjacency (tet_t::tets) is rebuilt on load, and the order of the tets changes
+enum tet_codec_t
+{
+    TET_CODEC_RAW,              // tet_t array as is
+    TET_CODEC_VARINT,           // vertex deltas as varints
+    TET_CODEC_DELTA16,          // vertex deltas as 16-bit words, escaped to 32 bits when larger
+    TET_CODEC_NUM_CODECS,
+};
+
+#ifdef TESS_COMPACT_TETS
+const tet_codec_t TET_CODEC_DEFAULT = TET_CODEC_VARINT;
+#else
+const tet_codec_t TET_CODEC_DEFAULT = TET_CODEC_RAW;
+#endif
+
+size_t compress_tets(const tet_t* tets,
+                     int num_tets,
+                     const float* particles,
+                     int num_particles,
+                     tet_codec_t codec,
+                     std::vector<char>& out);
+bool decompress_tets(const char* in,
+                     size_t nbytes,
+                     const float* particles,
+                     int num_particles,
+                     tet_t* tets,
+                     int num_tets);
+void tet_adjacency(tet_t* tets,
+                   int num_tets,
+                   int num_verts);
+
+#endif
@@ -17,6 +17,7 @@
 
 #define MAX_HIST_BINS 256      /* maximum number of bins in cell volume histogram */
 #define MAX_NEIGHBORS 27       /* maximum number of neighbor blocks */
+#define MAX_ATTRS 8            /* maximum number of per-particle attributes */
 
 /* remote particle */
 struct point_t {
@@ -40,7 +41,9 @@ struct dblock_t {
     int gid;                   /* global block id */
     void* Dt;                  /* native delaunay data structure */
 
-    /* input particles */
+    /* input particles
+       counts are ints and coordinates single precision: a block holds at most INT_MAX
+       particles, and exchanges that would grow a block past that abort (check_num_particles) */
     int num_orig_particles;    /* number of original particles in this block
                                   before any neighbor exchange */
     int num_particles;         /* current number of particles in this block after any
@@ -48,6 +51,11 @@ struct dblock_t {
                                   followed by received particles */
     float* particles;          /* all particles, original plus those received from neighbors */
 
+    /* optional per-particle attributes (eg. mass, velocity, temperature) */
+    int num_attrs;             /* number of attributes per particle, same in all blocks */
+    float* attrs;              /* attributes, num_attrs per particle interleaved, in the same
+                                  order as particles, including those received from neighbors */
+
     /* tets */
     int num_tets;              /* number of delaunay tetrahedra */
     struct tet_t* tets;        /* delaunay tets */
@@ -58,6 +66,8 @@ struct dblock_t {
     /* estimated density field */
     float* density;            /* density field */
     int num_grid_pts;          /* total number of density grid points */
+    int num_fields;            /* number of mass-weighted attribute fields */
+    float* fields;             /* attribute fields, num_fields per grid point interleaved */
 
     int complete;
 };
@@ -13,13 +13,69 @@
 #ifndef _DELAUNAY_HPP
 #define _DELAUNAY_HPP
 
+#include <memory>
+#include <vector>
+
 #include <diy/types.hpp>
 
+// a particle that a block sent to a neighbor as a ghost (incomplete_cells()), recorded so that
+// the ghost can be refreshed when the particle moves (tess_update())
+struct tess_sent_t
+{
+    int particle;                                          // local index of the original particle
+    int gid;                                               // neighbor
+    int wrap;                                              // wrap to the neighbor, see tess_wrap_code()
+
+    bool operator<(const tess_sent_t& x) const
+        {
+            if (particle != x.particle) return particle < x.particle;
+            if (gid != x.gid)           return gid < x.gid;
+            return wrap < x.wrap;
+        }
+    bool operator==(const tess_sent_t& x) const
+        { return particle == x.particle && gid == x.gid && wrap == x.wrap; }
+};
+
+// wrap direction (-1, 0, 1 in every dimension) as a single number, and back
+inline int tess_wrap_code(const diy::Direction& wrap)
+{
+    return (wrap[0] + 1) + 3 * (wrap[1] + 1) + 9 * (wrap[2] + 1);
+}
+inline diy::Direction tess_wrap_dir(int code)
+{
+    diy::Direction wrap;
+    for (int i = 0; i < 3; ++i, code /= 3)
+        wrap[i] = code % 3 - 1;
+    return wrap;
+}
+
 struct DBlock : dblock_t
 {
     diy::ContinuousBounds bounds { 3 };                    // local block extents
     diy::ContinuousBounds data_bounds { 3 };               // global data extents
     diy::ContinuousBounds box { 3 };                       // box in current round of point redistribution
+
+    // measured cost of the last tessellation, for rebalancing the next one
+    double                local_time { 0 };                // time in local_cells()
+    double                incomplete_time { 0 };           // time in incomplete_cells()
+    int                   rounds { 0 };                    // rounds the block took part in
+
+    // time series (tess_update())
+    std::vector<tess_sent_t> sent;                         // ghosts sent to the neighbors
+    bool                  stale_tets { true };             // particles moved since the last tets
+    bool                  stale_ghosts { true };           // particles or neighbor bounds changed
+                                                           // since the ghosts were sent
+
+    // storage that the particle, tet, and grid arrays may alias instead of owning them
+    // (e.g., a memory-mapped tess file); aliased arrays are never freed or reallocated
+    std::shared_ptr<char> storage;
+    size_t                storage_size { 0 };
+
+    bool aliased(const void* p) const
+        {
+            const char* c = static_cast<const char*>(p);
+            return storage && c >= storage.get() && c < storage.get() + storage_size;
+        }
 };
 
 #endif
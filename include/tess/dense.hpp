@@ -19,6 +19,7 @@
 #include <assert.h>
 #include <math.h>
 #include <string.h>
+#include <stdint.h>
 #include <vector>
 #include "delaunay.h"
 #include "mpi.h"
@@ -26,6 +27,7 @@
 #include "tess/tet-neighbors.h"
 #include "tess/tess.h"
 #include "tess/tess.hpp"
+#include "tess/compress.hpp"
 
 using namespace std;
 
@@ -58,6 +60,46 @@ struct args_t
     float eps;
     int   glo_num_idx[3];
     float div;
+    int   mass_attr;                // particle attribute holding mass, -1: use mass for all
+    int   num_fields;               // number of mass-weighted attribute fields
+    int   field_attrs[MAX_ATTRS];   // particle attribute deposited into each field
+};
+
+// compressed, chunked grid file
+// a header, followed by a chunk index with one entry per written block sorted by gid,
+// followed by the compressed chunks; each chunk is the block grid in row-major
+// order (x fastest), with num_vals values per grid point, so readers can fetch a subregion by decoding only the
+// chunks that intersect it
+#define GRID_FILE_MAGIC   "TESSGRID"
+#define GRID_FILE_VERSION 1
+
+struct grid_file_header_t
+{
+    char     magic[8];       // GRID_FILE_MAGIC, not null terminated
+    int      version;        // GRID_FILE_VERSION
+    int      glo_num_idx[3]; // global grid size (i,j,k), k = 1 for projected grids
+    int      num_chunks;     // number of entries in the chunk index
+    int      codec;          // compress_t codec requested by the writer
+    float    max_err;        // error bound for lossy codecs
+    int      num_vals;       // values per grid point, interleaved (0 in older files: 1)
+};
+
+struct grid_chunk_t
+{
+    int      gid;            // block global id
+    int      min_idx[3];     // global grid index of chunk minimum grid point (i,j,k)
+    int      num_idx[3];     // number of grid points in chunk (i,j,k)
+    int      pad;
+    uint64_t offset;         // byte offset of compressed chunk from start of file
+    uint64_t nbytes;         // size of compressed chunk
+};
+
+// one row of grid points to be written: file offset, memory address, number of floats
+struct grid_row_t
+{
+    MPI_Offset file_ofst;
+    MPI_Aint   mem_addr;
+    int        count;
 };
 
 // timing
@@ -86,7 +128,10 @@ void dense(alg alg_type,
 	   float *grid_step_size,
            float eps,
            int *glo_num_idx,
-           diy::Master& master);
+           diy::Master& master,
+           int mass_attr = -1,
+           int num_fields = 0,
+           int *field_attrs = NULL);
 void init_dense(DBlock*                         b,
                 const diy::Master::ProxyWithLink& cp,
                 args_t*                           a);
@@ -96,6 +141,26 @@ void est_dense(DBlock*                         b,
 void recvd_pts(DBlock*                         b,
                const diy::Master::ProxyWithLink& cp,
                args_t*                           a);
+void norm_fields(DBlock*                         b,
+                 const diy::Master::ProxyWithLink& cp,
+                 args_t*                           a);
+float CellMass(DBlock *dblock,
+               int cell,
+               float mass,
+               int mass_attr);
+void DepositFields(DBlock *dblock,
+                   int idx,
+                   int cell,
+                   float weight,
+                   int num_fields,
+                   int *field_attrs);
+void EnqueueGridPt(const diy::Master::ProxyWithLink& cp,
+                   const diy::BlockID& dest,
+                   grid_pt_t &grid_pt,
+                   DBlock *dblock,
+                   int cell,
+                   int num_fields,
+                   int *field_attrs);
 void BlockGridParams(DBlock *dblock,
                      int *block_min_idx,
                      int *block_max_idx,
@@ -117,6 +182,9 @@ void IterateCells(DBlock *dblock,
                   float *data_maxs,
                   float eps,
                   float mass,
+                  int mass_attr,
+                  int num_fields,
+                  int *field_attrs,
                   const diy::Master::ProxyWithLink& cp);
 #ifndef TESS_NO_OPENMP
 void IterateCellsOMP(DBlock *dblock,
@@ -130,6 +198,9 @@ void IterateCellsOMP(DBlock *dblock,
                      float *data_maxs,
                      float eps,
                      float mass,
+                     int mass_attr,
+                     int num_fields,
+                     int *field_attrs,
                      const diy::Master::ProxyWithLink& cp);
 #endif
 void IterateCellsCic(DBlock *dblock,
@@ -142,6 +213,9 @@ void IterateCellsCic(DBlock *dblock,
 		     float *data_maxs,
                      float eps,
                      float mass,
+                     int mass_attr,
+                     int num_fields,
+                     int *field_attrs,
                      const diy::Master::ProxyWithLink& cp);
 void CellBounds(DBlock *dblock,
                 int cell,
@@ -204,7 +278,36 @@ void WriteGrid(int mblocks,
                float *given_mins,
                float *given_maxs,
                diy::Master& master,
-               diy::Assigner& assigner);
+               diy::Assigner& assigner,
+               int aggregators = 0,
+               int stripe_size = 0);
+MPI_Info GridIOInfo(int aggregators,
+                    int stripe_size);
+void WriteGridRows(const char *outfile,
+                   vector<grid_row_t> &rows,
+                   MPI_Info info,
+                   MPI_Comm comm);
+void WriteGridCompressed(int tblocks,
+                         char *outfile,
+                         bool project,
+                         int *glo_num_idx,
+                         float eps,
+                         float *data_mins,
+                         float *data_maxs,
+                         int num_given_bounds,
+                         float *given_mins,
+                         float *given_maxs,
+                         compress_t codec,
+                         float max_err,
+                         diy::Master& master,
+                         diy::Assigner& assigner);
+bool ReadGridIndex(const char *infile,
+                   grid_file_header_t &header,
+                   vector<grid_chunk_t> &chunks);
+bool ReadGridRegion(const char *infile,
+                    int *min_idx,
+                    int *max_idx,
+                    float *region);
 void ProjectGrid(int gnblocks,
                  int *glo_num_idx,
                  float eps,
@@ -0,0 +1,121 @@
+/*---------------------------------------------------------------------------
+ *
+ * in situ interface: tessellation (and density) of the particles of a running simulation
+ *
+ * the simulation registers its particle arrays once, by pointer, and calls tess_insitu_run()
+ * every few steps; the arrays are read only when a run starts, directly into the blocks, so
+ * there is no file or intermediate copy in between
+ *
+ *   struct tess_insitu_params_t params;
+ *   tess_insitu_default_params(&params);
+ *   ... set params.domain_min, params.domain_max, params.async, params.grid ...
+ *   struct tess_insitu_t* ts = tess_insitu_create(comm, &params);
+ *   tess_insitu_particles(ts, &pos[0], &pos[1], &pos[2], n, 3 * sizeof(float));
+ *   tess_insitu_attribute(ts, mass, sizeof(float));
+ *   tess_insitu_callback(ts, analyze, user);
+ *   for (step ...)
+ *   {
+ *     ... advance the simulation; when pos, mass, or n change, register them again
+ *         (tess_insitu_clear_attributes() first) ...
+ *     if (step % every == 0)
+ *       tess_insitu_run(ts, step);
+ *   }
+ *   tess_insitu_destroy(ts);
+ *
+ * tess and density run on a duplicate of the communicator given to tess_insitu_create(),
+ * which may be a subcommunicator of the simulation; all its processes call every function
+ * collectively
+ *
+ * with params.async, tess_insitu_run() returns as soon as it has read the particles, and a
+ * helper thread of every process computes and calls the callback while the simulation
+ * continues (requires MPI_THREAD_MULTIPLE; otherwise runs are synchronous)
+ *
+ --------------------------------------------------------------------------*/
+#ifndef _TESS_INSITU_H
+#define _TESS_INSITU_H
+
+#include "mpi.h"
+#include <stddef.h>
+#include "delaunay.h"
+
+/* decomposition of the particles into blocks */
+enum
+{
+  TESS_INSITU_REGULAR,          /* regular grid of blocks (tess_exchange) */
+  TESS_INSITU_KDTREE,           /* k-d tree of equal counts (tess_kdtree_exchange) */
+  TESS_INSITU_SFC,              /* space-filling curve (tess_sfc_exchange) */
+};
+
+struct tess_insitu_params_t
+{
+  float domain_min[3];          /* global domain; all particles lie inside */
+  float domain_max[3];
+  int   wrap;                   /* periodic domain */
+  int   blocks_per_proc;        /* blocks of every process */
+  int   decomposition;          /* TESS_INSITU_REGULAR, _KDTREE, or _SFC */
+  int   threads;                /* diy threads */
+  int   async;                  /* compute on a helper thread */
+
+  /* density, on a grid over the domain; grid[0] == 0: no density */
+  int   grid[3];                /* global number of grid points */
+  int   cic;                    /* cloud-in-cell instead of tessellation density */
+  float mass;                   /* mass of a particle */
+  int   mass_attr;              /* attribute holding the mass of a particle (-1: use mass) */
+  int   num_fields;             /* mass-weighted attribute fields */
+  int   field_attrs[MAX_ATTRS]; /* attribute deposited into each field */
+};
+
+/* results of one run, passed to the callback */
+struct tess_insitu_result_t
+{
+  int                step;           /* step given to tess_insitu_run() */
+  int                num_blocks;     /* local blocks */
+  struct dblock_t**  blocks;         /* local blocks, until the next run (the array: during
+                                        the callback) */
+  size_t             rounds;         /* rounds of ghost exchange */
+  long long          particles;      /* global number of particles */
+  long long          tets;           /* global number of tets */
+  double             tess_time;      /* seconds of redistribution and tessellation */
+  double             dense_time;     /* seconds of density estimation */
+  float              grid_min[3];    /* physical position of the first grid point */
+  float              grid_step[3];   /* physical size of a grid space */
+};
+
+/* called on every process at the end of a run; from the helper thread when async */
+typedef void (*tess_insitu_callback_t)(const struct tess_insitu_result_t* result,
+                                       void* user);
+
+struct tess_insitu_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+void tess_insitu_default_params(struct tess_insitu_params_t* params);
+struct tess_insitu_t* tess_insitu_create(MPI_Comm comm,
+                                         const struct tess_insitu_params_t* params);
+void tess_insitu_destroy(struct tess_insitu_t* ts);
+void tess_insitu_particles(struct tess_insitu_t* ts,
+                           const float* x,
+                           const float* y,
+                           const float* z,
+                           size_t n,
+                           size_t stride);
+int tess_insitu_attribute(struct tess_insitu_t* ts,
+                          const float* attr,
+                          size_t stride);
+void tess_insitu_clear_attributes(struct tess_insitu_t* ts);
+void tess_insitu_callback(struct tess_insitu_t* ts,
+                          tess_insitu_callback_t callback,
+                          void* user);
+void tess_insitu_run(struct tess_insitu_t* ts,
+                     int step);
+void tess_insitu_wait(struct tess_insitu_t* ts);
+int tess_insitu_busy(struct tess_insitu_t* ts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
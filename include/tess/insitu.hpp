@@ -0,0 +1,87 @@
+// ---------------------------------------------------------------------------
+//
+//   in situ interface, C++ version (see insitu.h)
+//
+//   TessInSitu owns the diy master of the latest run; the callback gets the master, to run
+//   further diy analyses over the blocks, along with the summary of the run
+//
+// --------------------------------------------------------------------------
+#ifndef _TESS_INSITU_HPP
+#define _TESS_INSITU_HPP
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+#include "tess.hpp"
+#include "insitu.h"
+
+class TessInSitu
+{
+    public:
+    typedef std::function<void(diy::Master&, const tess_insitu_result_t&)>   Callback;
+
+                TessInSitu(MPI_Comm comm,
+                           const tess_insitu_params_t& params);
+                ~TessInSitu();
+
+    // registers the particles: particle i is at x[i * stride], y[i * stride], z[i * stride]
+    // (stride in bytes), e.g. x = &pos[0], y = &pos[1], z = &pos[2], stride = 3 * sizeof(float)
+    // for interleaved positions, or stride = sizeof(float) for separate arrays
+    void        particles(const float* x,
+                          const float* y,
+                          const float* z,
+                          size_t n,
+                          size_t stride);
+
+    // registers an attribute array, with the same number of entries as the particles; returns
+    // its index in the block attributes, or -1 past MAX_ATTRS
+    int         attribute(const float* attr,
+                          size_t stride);
+    void        clear_attributes()                                  { attrs_.clear(); }
+
+    // not while busy()
+    void        callback(const Callback& cb)                        { callback_ = cb; }
+
+    // reads the registered arrays and redistributes, tessellates, computes the density, and
+    // calls the callback; with async, returns after reading, the rest runs on the helper thread
+    void        run(int step);
+
+    // waits for the current run
+    void        wait();
+    bool        busy() const                                        { return busy_; }
+
+    diy::Master*            master()                                { return master_; }
+    const tess_insitu_params_t& params() const                      { return params_; }
+
+    private:
+                TessInSitu(const TessInSitu&);
+    void        operator=(const TessInSitu&);
+
+    void        compute(int step);
+
+    struct Array
+    {
+        const float* x;
+        size_t       stride;
+
+        float   operator[](size_t i) const
+        { return *reinterpret_cast<const float*>(reinterpret_cast<const char*>(x) + i * stride); }
+    };
+
+    tess_insitu_params_t        params_;
+    MPI_Comm                    comm_;              // duplicate of the given communicator
+    bool                        async_;
+    size_t                      n_;
+    Array                       coords_[3];
+    std::vector<Array>          attrs_;
+    Callback                    callback_;
+
+    diy::Master*                master_;
+    diy::RoundRobinAssigner*    assigner_;
+    std::thread                 thread_;
+    std::atomic<bool>           busy_;
+};
+
+#endif
@@ -0,0 +1,76 @@
+// ---------------------------------------------------------------------------
+//
+//   per-block, per-round profile of the tessellation rounds
+//
+//   between tess_profile_start() and tess_profile_stop(), tess() adds one record per block
+//   and round with the time spent in each phase and the particles, bytes, and tets it
+//   handled, and one record per process and round with the exchange time; nothing
+//   synchronizes while recording, and nothing is kept otherwise
+//
+//   tess_profile_write() reduces the records over all processes to min/avg/max and
+//   histograms, for the whole run and for every round, and writes them as JSON and CSV
+//
+// --------------------------------------------------------------------------
+#ifndef _TESS_PROFILE_HPP
+#define _TESS_PROFILE_HPP
+
+#include "mpi.h"
+
+// timed phases
+enum tess_phase_t
+{
+    PHASE_LOCAL_CELLS,              // local tessellation (local_cells())
+    PHASE_INCOMPLETE_CELLS,         // finding the particles neighbors need (incomplete_cells())
+    PHASE_ENQUEUE,                  // enqueueing them
+    PHASE_NEIGHBOR_PARTICLES,       // parsing the received particles (neighbor_particles())
+    PHASE_EXCHANGE,                 // diy exchange; per process, not per block
+    TESS_NUM_PHASES,
+};
+
+// counters
+enum tess_counter_t
+{
+    COUNT_SENT_PARTICLES,
+    COUNT_RECV_PARTICLES,
+    COUNT_SENT_BYTES,
+    COUNT_RECV_BYTES,
+    COUNT_TETS,
+    TESS_NUM_COUNTERS,
+};
+
+// profile of one block (or, for PHASE_EXCHANGE, one process) in one round
+struct tess_profile_record_t
+{
+    int    round;                               // 1-based
+    int    gid;                                 // -1 for the per-process record
+    double times[TESS_NUM_PHASES];              // seconds
+    double counts[TESS_NUM_COUNTERS];
+
+    tess_profile_record_t(int round_ = 0, int gid_ = -1): round(round_), gid(gid_)
+    {
+        for (int i = 0; i < TESS_NUM_PHASES; i++)
+            times[i] = 0.0;
+        for (int i = 0; i < TESS_NUM_COUNTERS; i++)
+            counts[i] = 0.0;
+    }
+};
+
+// adds the wall time of its scope to a phase
+struct TessTimer
+{
+            TessTimer(double& t): t_(t), start_(MPI_Wtime())    {}
+            ~TessTimer()                                        { t_ += MPI_Wtime() - start_; }
+
+    double& t_;
+    double  start_;
+};
+
+void tess_profile_start();
+void tess_profile_stop();
+void tess_profile_add(const tess_profile_record_t& rec);
+void tess_profile_clear();
+void tess_profile_write(MPI_Comm comm,
+                        const char* json,
+                        const char* csv = NULL);
+
+#endif
@@ -0,0 +1,62 @@
+// ---------------------------------------------------------------------------
+//
+//   per-thread scratch memory for the temporaries of a round
+//
+//   ScratchScope marks the scratch arena of the thread (tess_scratch_alloc()) and rewinds it
+//   when it goes out of scope; ScratchAllocator lets standard containers allocate from the
+//   arena, e.g.
+//
+//       ScratchScope scope;
+//       std::vector<int, ScratchAllocator<int> > v;
+//
+//   deallocation does nothing: the memory is reclaimed by the enclosing scope, so containers
+//   must not outlive it (nor move to another thread)
+//
+// --------------------------------------------------------------------------
+#ifndef _TESS_SCRATCH_HPP
+#define _TESS_SCRATCH_HPP
+
+#include <stddef.h>
+#include <new>
+
+#include "tess.h"
+
+struct ScratchScope
+{
+            ScratchScope():
+                mark(tess_scratch_mark())                               {}
+            ~ScratchScope()                                             { tess_scratch_release(mark); }
+
+    tess_scratch_mark_t mark;
+
+    private:
+            ScratchScope(const ScratchScope&);
+    void    operator=(const ScratchScope&);
+};
+
+template<class T>
+struct ScratchAllocator
+{
+    typedef T value_type;
+    template<class U> struct rebind { typedef ScratchAllocator<U> other; };
+
+            ScratchAllocator()                                          {}
+    template<class U>
+            ScratchAllocator(const ScratchAllocator<U>&)                {}
+
+    T*      allocate(size_t n)
+    {
+        void* p = tess_scratch_alloc(n * sizeof(T));
+        if (!p && n)
+            throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+    void    deallocate(T*, size_t)                                      {}
+
+    template<class U>
+    bool    operator==(const ScratchAllocator<U>&) const                { return true; }
+    template<class U>
+    bool    operator!=(const ScratchAllocator<U>&) const                { return false; }
+};
+
+#endif
@@ -38,46 +38,120 @@ void construct_delaunay(Delaunay3D &Dt, int num_particles, float *particles);
 void gen_tets(Delaunay3D& Dt, tet_t* tets);
 
 
+#include <CGAL/Unique_hash_map.h>
 #include <diy/serialization.hpp>
 
 namespace diy
 {
+  // binary triangulation, written directly into the buffer
+  //
+  // int dimension, size_t number of finite vertices, finite vertices (cgal_vertex_t)
+  // for dimension 3 only: size_t number of cells, per cell 4 vertex indices (0 is the infinite
+  // vertex, finite vertices start at 1) followed by 4 neighbor cell indices
+  //
+  // triangulations of lower dimension (a handful of points) are rebuilt by reinserting the vertices
   template<>
   struct Serialization<Delaunay3D>
   {
+    struct cgal_vertex_t
+    {
+      double   x, y, z;
+      unsigned info;                  // particle index
+      unsigned pad;
+    };
+
     static void	    save(BinaryBuffer& bb, const Delaunay3D& Dt)
     {
-      std::ostringstream out;
-      CGAL::set_mode(out, CGAL::IO::BINARY);
-      out << Dt;
+      int    dim = Dt.dimension();
+      size_t nv  = Dt.number_of_vertices();
+      diy::save(bb, dim);
+      diy::save(bb, nv);
+
+      CGAL::Unique_hash_map<Vertex_handle, unsigned> V;
+      V[Dt.infinite_vertex()] = 0;
+      std::vector<cgal_vertex_t> verts; verts.reserve(nv);
+      unsigned idx = 1;
+      for (Vertex_iterator vit = Dt.finite_vertices_begin(); vit != Dt.finite_vertices_end(); ++vit)
+      {
+        cgal_vertex_t v = { vit->point().x(), vit->point().y(), vit->point().z(), vit->info(), 0 };
+        verts.push_back(v);
+        V[vit] = idx++;
+      }
+      if (nv)
+        diy::save(bb, &verts[0], nv);
+
+      if (dim < 3)
+        return;
+
+      const Tds& tds = Dt.tds();
+      size_t nc = tds.number_of_cells();
+      diy::save(bb, nc);
 
-      size_t s = out.str().size();
-      diy::save(bb, s);
-      bb.save_binary(out.str().c_str(), out.str().size());
+      CGAL::Unique_hash_map<Cell_handle, unsigned> C;
+      std::vector<unsigned> cells; cells.reserve(8 * nc);
+      idx = 0;
+      for (All_cell_iterator cit = Dt.all_cells_begin(); cit != Dt.all_cells_end(); ++cit)
+      {
+        C[cit] = idx++;
+        for (int i = 0; i < 4; ++i)
+          cells.push_back(V[cit->vertex(i)]);
+      }
+      for (All_cell_iterator cit = Dt.all_cells_begin(); cit != Dt.all_cells_end(); ++cit)
+        for (int i = 0; i < 4; ++i)
+          cells.push_back(C[cit->neighbor(i)]);
+      diy::save(bb, &cells[0], cells.size());
     }
 
     static void	    load(BinaryBuffer& bb, Delaunay3D& Dt)
     {
-      size_t s;
-      diy::load(bb, s);
-
-      // This is not pretty, but portable.
-      // Double copying is annoying. Perhaps, it's worth implementing an
-      // iostream wrapper around BinaryBuffer.
-      std::vector<char> in_vec(s);
-      bb.load_binary(&in_vec[0], s);
-
-      std::string in_str(in_vec.begin(), in_vec.end());
-      std::istringstream in(in_str);
-      CGAL::set_mode(in, CGAL::IO::BINARY);
-      in >> Dt;
-
-      // NB: this shouldn't be necessary, but CGAL doesn't save vertex info,
-      //     so we reset it here. This works because we don't need vertex ids to
-      //     be consistent across iterations.
-      unsigned idx = 0;
-      for(Vertex_iterator vit = Dt.finite_vertices_begin(); vit != Dt.finite_vertices_end(); ++vit)
-	vit->info() = idx++;
+      int    dim;
+      size_t nv;
+      diy::load(bb, dim);
+      diy::load(bb, nv);
+      std::vector<cgal_vertex_t> verts(nv);
+      if (nv)
+        diy::load(bb, &verts[0], nv);
+
+      Dt.clear();
+      if (dim < 3)
+      {
+        for (size_t i = 0; i < nv; ++i)
+          Dt.insert(Point(verts[i].x, verts[i].y, verts[i].z))->info() = verts[i].info;
+        return;
+      }
+
+      size_t nc;
+      diy::load(bb, nc);
+      std::vector<unsigned> cells(8 * nc);
+      diy::load(bb, &cells[0], cells.size());
+
+      // clear() leaves the infinite vertex and one cell of dimension -1 (as init_tds() does);
+      // delete the cell, so that the infinite vertex is all that is left
+      Tds& tds = Dt.tds();
+      tds.delete_cell(Dt.infinite_vertex()->cell());
+      std::vector<Vertex_handle> V(nv + 1);
+      V[0] = Dt.infinite_vertex();
+      for (size_t i = 0; i < nv; ++i)
+      {
+        V[i + 1] = tds.create_vertex();
+        V[i + 1]->set_point(Point(verts[i].x, verts[i].y, verts[i].z));
+        V[i + 1]->info() = verts[i].info;
+      }
+
+      std::vector<Cell_handle> C(nc);
+      for (size_t j = 0; j < nc; ++j)
+      {
+        const unsigned* v = &cells[4 * j];
+        C[j] = tds.create_cell(V[v[0]], V[v[1]], V[v[2]], V[v[3]]);
+        for (int i = 0; i < 4; ++i)
+          V[v[i]]->set_cell(C[j]);
+      }
+      for (size_t j = 0; j < nc; ++j)
+        for (int i = 0; i < 4; ++i)
+          C[j]->set_neighbor(i, C[cells[4 * nc + 4 * j + i]]);
+      tds.set_dimension(dim);
+
+      CGAL_assertion(Dt.is_valid());
     }
   };
 }
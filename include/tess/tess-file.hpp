@@ -0,0 +1,145 @@
+// ---------------------------------------------------------------------------
+//
+//   versioned, memory-mappable tessellation file
+//
+//   layout (all offsets in bytes from the start of the file):
+//
+//   tess_file_header_t                              at 0
+//   tess_file_block_t[num_blocks], sorted by gid    at table_offset
+//   extra user data (e.g., times)                   at extra_offset
+//   block sections, each aligned to TESS_FILE_ALIGN at the offsets in the block table
+//
+//   sections are stored in native byte order exactly as the arrays are laid out in
+//   a DBlock, so that a loader can map the file and use them in place; the exception are
+//   compressed tets, which are decoded on load
+//
+// --------------------------------------------------------------------------
+#ifndef _TESS_FILE_HPP
+#define _TESS_FILE_HPP
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+
+#include <diy/master.hpp>
+#include <diy/assigner.hpp>
+#include <diy/serialization.hpp>
+
+#include "tess.h"
+#include "delaunay.hpp"
+#include "compress.hpp"
+
+#define TESS_FILE_MAGIC   "TESSFILE"
+#define TESS_FILE_VERSION 1
+#define TESS_FILE_ALIGN   64          // byte alignment of every section
+
+// per-block array sections
+enum tess_section_t
+{
+    TESS_SEC_PARTICLES,             // float[3 * num_particles]
+    TESS_SEC_ATTRS,                 // float[num_attrs * num_particles]
+    TESS_SEC_REM_GIDS,              // int[num_particles - num_orig_particles]
+    TESS_SEC_REM_LIDS,              // int[num_particles - num_orig_particles]
+    TESS_SEC_TETS,                  // tet_t[num_tets], or a compressed tet stream
+    TESS_SEC_VERT_TO_TET,           // int[num_particles], empty for compressed tets
+    TESS_SEC_DENSITY,               // float[num_grid_pts]
+    TESS_SEC_FIELDS,                // float[num_fields * num_grid_pts]
+    TESS_SEC_LINK,                  // serialized diy link
+    TESS_NUM_SECTIONS,
+};
+
+// bit mask selecting all sections
+#define TESS_ALL_SECTIONS ((1u << TESS_NUM_SECTIONS) - 1)
+
+// file header, 64 bytes
+struct tess_file_header_t
+{
+    char     magic[8];              // TESS_FILE_MAGIC, not null-terminated
+    uint32_t version;               // TESS_FILE_VERSION
+    uint32_t num_blocks;            // total number of blocks
+    uint64_t table_offset;          // offset of the block table
+    uint64_t extra_offset;          // offset of the extra user data
+    uint64_t extra_size;            // size of the extra user data
+    uint64_t file_size;             // total file size
+    uint64_t pad[2];
+};
+
+// block table entry
+struct tess_file_block_t
+{
+    int      gid;
+    int      complete;
+    float    bounds[6];             // local block extents (min x, y, z, max x, y, z)
+    float    box[6];                // box in last round of point redistribution
+    float    data_bounds[6];        // global data extents
+    int      num_orig_particles;
+    int      num_particles;
+    int      num_attrs;
+    int      num_tets;
+    int      num_grid_pts;
+    int      num_fields;
+    int      tet_codec;             // tet_codec_t of the tets section
+    int      pad;
+    uint64_t offset[TESS_NUM_SECTIONS]; // section offsets
+    uint64_t size[TESS_NUM_SECTIONS];   // section sizes; 0 if the section is empty
+};
+
+// an open, mapped tess file
+struct TessFile
+{
+    std::shared_ptr<char>       data;       // file mapping, unmapped when the last user drops it
+    size_t                      size;       // mapped size
+    const tess_file_header_t*   header;
+    const tess_file_block_t*    blocks;     // block table, sorted by gid
+};
+
+// a tess file being written in the background (tess_file_write_async())
+struct TessFileWrite
+{
+    std::string         outfile;
+    MPI_Comm            comm;
+    std::vector<char>   head;       // header, block table, and extra data (rank 0)
+    std::vector<char>   data;       // snapshot of the local sections, padded as in the file
+    uint64_t            offset;     // file offset of data
+    std::thread         thread;     // I/O thread
+    int                 error;      // errno of a failed write, 0 if none
+    bool                pending;    // written, not waited for yet
+
+    TessFileWrite(): comm(MPI_COMM_NULL), offset(0), error(0), pending(false)  {}
+    ~TessFileWrite()                                        { if (thread.joinable()) thread.join(); }
+};
+
+void tess_file_write(diy::Master& master,
+                     const char* outfile,
+                     const diy::MemoryBuffer& extra = diy::MemoryBuffer(),
+                     tet_codec_t tet_codec = TET_CODEC_DEFAULT);
+void tess_file_write_async(diy::Master& master,
+                           const char* outfile,
+                           TessFileWrite& w,
+                           const diy::MemoryBuffer& extra = diy::MemoryBuffer(),
+                           tet_codec_t tet_codec = TET_CODEC_DEFAULT);
+void tess_file_wait(TessFileWrite& w);
+bool tess_file_is_tess(const char* infile);
+bool tess_file_open(const char* infile,
+                    TessFile& file);
+int tess_file_find(const TessFile& file,
+                   int gid);
+void tess_file_query(const TessFile& file,
+                     const diy::ContinuousBounds& box,
+                     std::vector<int>& gids);
+DBlock* tess_file_block(const TessFile& file,
+                        int i,
+                        unsigned sections = TESS_ALL_SECTIONS);
+void tess_file_load(diy::Master& master,
+                    diy::StaticAssigner& assigner,
+                    const char* infile);
+void tess_file_load(diy::Master& master,
+                    diy::StaticAssigner& assigner,
+                    const char* infile,
+                    diy::MemoryBuffer& extra,
+                    const std::vector<int>* select = NULL,
+                    unsigned sections = TESS_ALL_SECTIONS);
+
+#endif
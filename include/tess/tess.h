@@ -27,6 +27,26 @@ enum
   TESS_MAX_TIMES
 };
 
+/* memory categories (tess_malloc) */
+enum
+{
+  MEM_PARTICLES,          /* particles, attributes, remote gids and lids */
+  MEM_TETS,
+  MEM_VERT_TO_TET,
+  MEM_DENSITY,            /* density and field grids, grid point scratch */
+  MEM_EXCHANGE,           /* particle exchange buffers and diy queues */
+  MEM_BACKEND,            /* QHull / CGAL triangulation */
+  MEM_SCRATCH,            /* per-thread scratch arenas (tess_scratch_alloc) */
+  TESS_NUM_MEM
+};
+
+/* position in the scratch arena of the calling thread (tess_scratch_mark) */
+struct tess_scratch_mark_t
+{
+  int    chunk;           /* current chunk */
+  size_t offset;          /* bytes used in it */
+};
+
 enum
 {
   NUM_ORIG_PTS,
@@ -64,12 +84,58 @@ void clean_delaunay_data_structure(struct dblock_t* b);
 extern "C"
 #endif
 void fill_vert_to_tet(struct dblock_t *dblock);
+#ifdef __cplusplus
+extern "C"
+#endif
+void move_vertices(struct dblock_t *b, const int *moved, int num_moved, int *in_place,
+                   int *reinserted);
 
 #ifdef __cplusplus
 extern "C"
 #endif
 void get_mem(int breakpoint, MPI_Comm comm);
 
+#ifdef __cplusplus
+extern "C"
+#endif
+void* tess_malloc(size_t size, int category);
+#ifdef __cplusplus
+extern "C"
+#endif
+void* tess_realloc(void* p, size_t size, int category);
+#ifdef __cplusplus
+extern "C"
+#endif
+void tess_free(void* p);
+#ifdef __cplusplus
+extern "C"
+#endif
+void* tess_reserve(void* p, size_t size, int category);
+#ifdef __cplusplus
+extern "C"
+#endif
+void* tess_scratch_alloc(size_t size);
+#ifdef __cplusplus
+extern "C"
+#endif
+struct tess_scratch_mark_t tess_scratch_mark(void);
+#ifdef __cplusplus
+extern "C"
+#endif
+void tess_scratch_release(struct tess_scratch_mark_t mark);
+#ifdef __cplusplus
+extern "C"
+#endif
+void tess_mem_track(void* p, size_t size, int category);
+#ifdef __cplusplus
+extern "C"
+#endif
+void tess_mem_untrack(void* p);
+#ifdef __cplusplus
+extern "C"
+#endif
+void tess_mem_report(int breakpoint, MPI_Comm comm);
+
 void print_block(struct dblock_t *dblock, int gid);
 void print_particles(float *particles, int num_particles, int gid);
 void write_particles(int nblocks, float **particles, int *num_particles, char *outfile);
@@ -18,6 +18,8 @@
 #include <string>
 #endif
 
+#include <stdint.h>
+#include <stdlib.h>
 #include <vector>
 #include <set>
 #include <limits>
@@ -36,6 +38,10 @@
 
 #include "tess.h"
 #include "delaunay.hpp"
+#include "compress.hpp"
+#include "tess-file.hpp"
+#include "profile.hpp"
+#include "trace.hpp"
 
 using namespace std;
 
@@ -47,6 +53,46 @@ struct quants_t
     int sum_quants[MAX_QUANTS];       // sum of quantities
 };
 
+// measured tessellation cost of a decomposition, used to weigh the points of the next one
+struct tess_cost_map_t
+{
+    std::vector<diy::ContinuousBounds> boxes;        // block boxes, by gid
+    std::vector<float>                 weights;      // measured cost per original particle, by gid
+};
+
+// cost model of the cost-driven k-d tree decomposition (tess_cost_kdtree_exchange)
+struct kdtree_cost_t
+{
+    int   bins;                       // histogram bins per split search
+    int   refine;                     // finer histograms around the best split so far
+    float ghost;                      // cost of a ghost particle relative to an original one
+    float ghost_layers;               // depth of the ghost region in interparticle spacings
+    const tess_cost_map_t* map;       // measured cost of a previous tessellation; NULL: a point
+                                      // costs 1
+
+    kdtree_cost_t(): bins(1024), refine(2), ghost(1.0f), ghost_layers(2.0f), map(NULL)   {}
+};
+
+// work of an incremental update of a time series (tess_update()), summed over all blocks
+struct tess_update_stats_t
+{
+    long long moved;                  // original particles whose positions changed
+    long long refreshed;              // ghost copies of moved particles updated at the neighbors
+    long long moved_in_place;         // triangulation vertices moved without changing their cells
+    long long reinserted;             // triangulation vertices removed and reinserted
+    long long new_ghosts;             // particles sent to neighbors as new ghosts
+    long long blocks;                 // blocks
+    long long kept_tets;              // blocks that kept their tets: none of their particles moved
+    long long kept_ghosts;            // blocks that skipped the search for new ghosts: neither their
+                                      // particles nor the bounds of their neighbors changed
+    long long no_refresh;             // blocks none of whose ghosts at the neighbors moved
+    size_t    rounds;                 // rounds of ghost exchange
+
+    tess_update_stats_t():
+        moved(0), refreshed(0), moved_in_place(0), reinserted(0), new_ghosts(0), blocks(0),
+        kept_tets(0), kept_ghosts(0), no_refresh(0), rounds(0)                              {}
+};
+
 typedef diy::RegularContinuousLink  RCLink;
 typedef vector<RCLink>              LinkVector;
 typedef vector<size_t>              LastNeighbors;
@@ -54,12 +100,48 @@ typedef vector<size_t>              LastNeighbors;
 size_t tess(diy::Master& master);
 size_t tess(diy::Master& master,
             quants_t& quants,
-            double* times);
+            double* times,
+            bool record_ghosts = false);
+size_t tess_rounds(diy::Master& master,
+                   quants_t& quants,
+                   bool update,
+                   bool record_ghosts);
+size_t tess_update(diy::Master& master,
+                   const diy::Assigner& assigner,
+                   const std::vector<float*>& positions,
+                   bool wrap,
+                   tess_update_stats_t& stats,
+                   double* times);
 void tess_exchange(diy::Master& master,
                    const diy::Assigner& assigner);
 void tess_exchange(diy::Master& master,
                    const diy::Assigner& assigner,
-                   double* times);
+                   double* times,
+                   int k = 2);
+void send_particles(diy::Master& master,
+                    const diy::Assigner& assigner,
+                    std::vector< std::vector<int> >& dests);
+void tess_direct_exchange(diy::Master& master,
+                          const diy::Assigner& assigner,
+                          double* times);
+void tess_cost_kdtree_exchange(diy::Master& master,
+                               const diy::Assigner& assigner,
+                               double* times,
+                               bool wrap,
+                               const kdtree_cost_t& cost = kdtree_cost_t());
+void tess_cost_map(diy::Master& master,
+                   const diy::Assigner& assigner,
+                   tess_cost_map_t& map);
+void tess_sfc_exchange(diy::Master& master,
+                       const diy::Assigner& assigner,
+                       double* times,
+                       bool wrap,
+                       bool hilbert = true);
+RCLink* touching_link(int gid,
+                      const std::vector<diy::ContinuousBounds>& boxes,
+                      const diy::ContinuousBounds& domain,
+                      const diy::Assigner& assigner,
+                      bool wrap);
 void tess_kdtree_exchange(diy::Master& master,
                           const diy::Assigner& assigner,
                           bool wrap,
@@ -76,6 +158,13 @@ void tess_save(diy::Master& master,
                const char* outfile,
                double* times,
                const diy::MemoryBuffer& extra = diy::MemoryBuffer());
+void tess_save_async(diy::Master& master,
+                     const char* outfile,
+                     TessFileWrite& pending,
+                     double* times,
+                     const diy::MemoryBuffer& extra = diy::MemoryBuffer());
+void tess_save_wait(TessFileWrite& pending,
+                    double* times = NULL);
 void tess_load(diy::Master& master,
                diy::StaticAssigner& assigner,
                const char* infile);
@@ -83,6 +172,16 @@ void tess_load(diy::Master& master,
                diy::StaticAssigner& assigner,
                const char* infile,
                diy::MemoryBuffer& extra);
+void tess_load(diy::Master& master,
+               diy::StaticAssigner& assigner,
+               const char* infile,
+               const diy::ContinuousBounds& box,
+               unsigned sections = TESS_ALL_SECTIONS);
+void tess_load(diy::Master& master,
+               diy::StaticAssigner& assigner,
+               const char* infile,
+               const std::vector<int>& gids,
+               unsigned sections = TESS_ALL_SECTIONS);
 void tess_stats(diy::Master& master,
                 quants_t& quants,
                 double* times);
@@ -96,6 +195,22 @@ void save_block_light(const void* b,
                       diy::BinaryBuffer& bb);
 void load_block_light(void* b,
                       diy::BinaryBuffer& bb);
+void save_tets(diy::BinaryBuffer& bb,
+               const DBlock& d,
+               tet_codec_t codec = TET_CODEC_DEFAULT);
+void load_tets(diy::BinaryBuffer& bb,
+               DBlock& d);
+void load_finish(diy::BinaryBuffer& bb,
+                 DBlock& d);
+void save_block_header(diy::BinaryBuffer& bb,
+                       const DBlock& d);
+int load_block_header(diy::BinaryBuffer& bb,
+                      DBlock& d);
+void make_writable(DBlock* b);
+void check_num_particles(const DBlock* b,
+                         long long incoming);
+void drop_sections(DBlock* b,
+                   unsigned sections);
 void create(int gid,
             const diy::ContinuousBounds& core,
             const diy::ContinuousBounds& bounds,
@@ -106,15 +221,21 @@ void delaunay(DBlock*                           b,
               const diy::Master::ProxyWithLink& cp,
               const LinkVector&                 links,
               LastNeighbors&                    neighbors,
-              bool                              first);
+              bool                              first,
+              bool                              update = false,
+              bool                              record_ghosts = false);
 void finalize(DBlock*                           b,
               const diy::Master::ProxyWithLink& cp,
               quants_t&                         quants);
 void neighbor_particles(DBlock* b,
-                        const diy::Master::ProxyWithLink& cp);
+                        const diy::Master::ProxyWithLink& cp,
+                        tess_profile_record_t* rec = NULL);
 size_t incomplete_cells(struct DBlock *dblock,
                         const diy::Master::ProxyWithLink& cp,
-                        size_t last_neighbor);
+                        size_t last_neighbor,
+                        tess_profile_record_t* rec = NULL,
+                        bool update = false,
+                        bool record_ghosts = false);
 void reset_block(struct DBlock* &dblock);
 void fill_vert_to_tet(DBlock* dblock);
 void fill_vert_to_tet(dblock_t* dblock);
@@ -128,6 +249,59 @@ void wrap_pt(point_t& rp,
 int compare(const void *a,
             const void *b);
 
+#define TESS_ARRAY_ALIGN 16     // alignment of block arrays in serialization buffers
+
+// a serialized block (Serialization<DBlock>, save_block_light()) starts with TESS_BLOCK_MAGIC
+// and TESS_BLOCK_VERSION; blocks of the original layout (version 1) start with their gid
+#define TESS_BLOCK_MAGIC   0x4b424554   // "TEBK" on little-endian machines
+#define TESS_BLOCK_VERSION 2
+
+// serializes a block array, padded so that it is aligned in a memory buffer and can be used in
+// place when loaded from the same buffer
+template<class T>
+void save_array(diy::BinaryBuffer& bb,
+                const T*           x,
+                size_t             n)
+{
+    static const char zeros[TESS_ARRAY_ALIGN] = {};
+    diy::MemoryBuffer* mb = dynamic_cast<diy::MemoryBuffer*>(&bb);
+    unsigned char pad = 0;
+    if (mb)
+        pad = (TESS_ARRAY_ALIGN - (mb->position + 1) % TESS_ARRAY_ALIGN) % TESS_ARRAY_ALIGN;
+    diy::save(bb, pad);
+    bb.save_binary(zeros, pad);
+    diy::save(bb, x, n);
+}
+
+// deserializes a block array
+// from a memory buffer, the array aliases the buffer, and load_finish() must be called once the
+// whole block is loaded; otherwise the array is allocated with malloc, or new[] if use_new
+template<class T>
+void load_array(diy::BinaryBuffer& bb,
+                T*&                x,
+                size_t             n,
+                bool               use_new = false)
+{
+    char pad[TESS_ARRAY_ALIGN];
+    unsigned char npad;
+    diy::load(bb, npad);
+    bb.load_binary(pad, npad);
+
+    x = NULL;
+    if (!n)
+        return;
+    diy::MemoryBuffer* mb = dynamic_cast<diy::MemoryBuffer*>(&bb);
+    if (mb && mb->position + n * sizeof(T) <= mb->buffer.size() &&
+        reinterpret_cast<uintptr_t>(&mb->buffer[mb->position]) % sizeof(float) == 0)
+    {
+        x = reinterpret_cast<T*>(&mb->buffer[mb->position]);
+        mb->position += n * sizeof(T);
+        return;
+    }
+    x = use_new ? new T[n] : (T*)malloc(n * sizeof(T));
+    diy::load(bb, x, n);
+}
+
 // add block to a master
 // user should not instantiate AddBlock; use AddAndGenerafet or AddEmpty (see below)
 struct AddBlock
@@ -154,6 +328,8 @@ struct AddBlock
             b->num_orig_particles = 0;
             b->num_particles = 0;
             b->particles = NULL;
+            b->num_attrs = 0;
+            b->attrs = NULL;
             b->num_tets = 0;
             b->tets = NULL;
             b->rem_gids = NULL;
@@ -161,6 +337,8 @@ struct AddBlock
             b->vert_to_tet = NULL;
             b->num_grid_pts = 0;
             b->density = NULL;
+            b->num_fields = 0;
+            b->fields = NULL;
 
             return b;
         }
@@ -218,46 +396,59 @@ namespace diy
             {
                 // debug
                 //       fprintf(stderr, "Saving block gid %d\n", d.gid);
-                diy::save(bb, d.gid);
+                save_block_header(bb, d);
                 diy::save(bb, d.bounds);
                 diy::save(bb, d.box);
                 diy::save(bb, d.data_bounds);
                 diy::save(bb, d.num_orig_particles);
                 diy::save(bb, d.num_particles);
-                diy::save(bb, d.particles, 3 * d.num_particles);
-                diy::save(bb, d.rem_gids, d.num_particles - d.num_orig_particles);
-                diy::save(bb, d.rem_lids, d.num_particles - d.num_orig_particles);
+                save_array(bb, d.particles, 3 * d.num_particles);
+                diy::save(bb, d.num_attrs);
+                save_array(bb, d.attrs, d.num_attrs * d.num_particles);
+                save_array(bb, d.rem_gids, d.num_particles - d.num_orig_particles);
+                save_array(bb, d.rem_lids, d.num_particles - d.num_orig_particles);
                 diy::save(bb, d.num_grid_pts);
-                diy::save(bb, d.density, d.num_grid_pts);
+                save_array(bb, d.density, d.num_grid_pts);
+                diy::save(bb, d.num_fields);
+                save_array(bb, d.fields, d.num_fields * d.num_grid_pts);
                 // NB tets and vert_to_tet get recreated in each phase; not saved and reloaded
 
+                diy::save(bb, d.local_time);
+                diy::save(bb, d.incomplete_time);
+                diy::save(bb, d.rounds);
                 diy::save(bb, d.complete);
+                diy::save(bb, d.sent);
 
 #ifdef TESS_USE_CGAL
+                // keep the triangulation of incomplete blocks, for incremental insertion later
                 if (!d.complete)
                 {
-#if 0
                     const Delaunay3D* Dt = static_cast<Delaunay3D*>(d.Dt);
                     diy::save(bb, *Dt);
-#endif
+                    //fprintf(stderr, "Delaunay saved with %lu vertices\n", Dt->number_of_vertices());
                 }
-                //fprintf(stderr, "Delaunay saved with %lu vertices\n", Dt->number_of_vertices());
 #endif
 
                 if (d.complete)
                 {
                     diy::save(bb, d.num_tets);
-                    diy::save(bb, d.tets, d.num_tets);
-                    diy::save(bb, d.vert_to_tet, d.num_particles);
+                    save_array(bb, d.tets, d.num_tets);
+                    save_array(bb, d.vert_to_tet, d.num_particles);
                 }
 
                 // debug
                 //       fprintf(stderr, "Done saving block gid %d\n", d.gid);
             }
 
+        // arrays alias the buffer when possible (see load_array)
         static void load(BinaryBuffer& bb, DBlock& d)
             {
-                diy::load(bb, d.gid);
+                // only blocks of this version: these streams never outlive a run
+                if (load_block_header(bb, d) != TESS_BLOCK_VERSION)
+                {
+                    fprintf(stderr, "Error: block %d was serialized in an older layout\n", d.gid);
+                    MPI_Abort(MPI_COMM_WORLD, 1);
+                }
                 // debug
                 //       fprintf(stderr, "Loading block gid %d\n", d.gid);
                 diy::load(bb, d.bounds);
@@ -265,55 +456,44 @@ namespace diy
                 diy::load(bb, d.data_bounds);
                 diy::load(bb, d.num_orig_particles);
                 diy::load(bb, d.num_particles);
-                d.particles = NULL;
-                if (d.num_particles)
-                    d.particles = (float*)malloc(d.num_particles * 3 * sizeof(float));
-                diy::load(bb, d.particles, 3 * d.num_particles);
-                d.rem_gids = NULL;
-                d.rem_lids = NULL;
-                if (d.num_particles - d.num_orig_particles)
-                {
-                    d.rem_gids =
-                        (int*)malloc((d.num_particles - d.num_orig_particles) * sizeof(int));
-                    d.rem_lids =
-                        (int*)malloc((d.num_particles - d.num_orig_particles) * sizeof(int));
-                }
-                diy::load(bb, d.rem_gids, d.num_particles - d.num_orig_particles);
-                diy::load(bb, d.rem_lids, d.num_particles - d.num_orig_particles);
+                load_array(bb, d.particles, 3 * d.num_particles);
+                diy::load(bb, d.num_attrs);
+                load_array(bb, d.attrs, d.num_attrs * d.num_particles);
+                load_array(bb, d.rem_gids, d.num_particles - d.num_orig_particles);
+                load_array(bb, d.rem_lids, d.num_particles - d.num_orig_particles);
                 diy::load(bb, d.num_grid_pts);
-                d.density = (float*)malloc(d.num_grid_pts * sizeof(float));
-                diy::load(bb, d.density, d.num_grid_pts);
+                load_array(bb, d.density, d.num_grid_pts, true);
+                diy::load(bb, d.num_fields);
+                load_array(bb, d.fields, d.num_fields * d.num_grid_pts, true);
                 // NB tets and vert_to_tet get recreated in each phase; not saved and reloaded
                 d.num_tets = 0;
                 d.tets = NULL;
                 d.vert_to_tet = NULL;
-                if (d.num_particles)
-                    d.vert_to_tet = (int*)malloc(d.num_particles * sizeof(int));
 
+                diy::load(bb, d.local_time);
+                diy::load(bb, d.incomplete_time);
+                diy::load(bb, d.rounds);
                 diy::load(bb, d.complete);
+                diy::load(bb, d.sent);
 
 #ifdef TESS_USE_CGAL
                 if (!d.complete)
                 {
-#if 0
                     Delaunay3D* Dt = static_cast<Delaunay3D*>(d.Dt);
                     diy::load(bb, *Dt);
                     //fprintf(stderr, "Delaunay loaded with %lu vertices\n", Dt->number_of_vertices());
-#endif
                 }
 #endif
 
                 if (d.complete)
                 {
                     diy::load(bb, d.num_tets);
-                    d.tets = (tet_t*)malloc(d.num_tets * sizeof(tet_t));
-                    diy::load(bb, d.tets, d.num_tets);
-                    d.vert_to_tet = NULL;
-                    if (d.num_particles)
-                        d.vert_to_tet = (int*)malloc(d.num_particles * sizeof(int));
-                    diy::load(bb, d.vert_to_tet, d.num_particles);
+                    load_array(bb, d.tets, d.num_tets);
+                    load_array(bb, d.vert_to_tet, d.num_particles);
                 }
 
+                load_finish(bb, d);
+
                 // debug
                 //       fprintf(stderr, "Done loading block gid %d\n", d.gid);
             }
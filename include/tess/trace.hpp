@@ -0,0 +1,49 @@
+// ---------------------------------------------------------------------------
+//
+//   timeline of the tessellation pipeline in the Chrome trace event format
+//
+//   TESS_TRACE_SCOPE records the begin and end of its scope, with the rank, thread, block
+//   gid, and round, into a ring buffer owned by the calling thread, so recording takes no
+//   locks; once a buffer is full, the oldest events are overwritten
+//
+//   tess_trace_write() merges the buffers of all threads and ranks into one JSON file, to be
+//   opened in chrome://tracing or ui.perfetto.dev
+//
+//   the scopes are compiled in only with TESS_TRACE (cmake -Dtrace=on), and then record only
+//   between tess_trace_start() and tess_trace_stop()
+//
+// --------------------------------------------------------------------------
+#ifndef _TESS_TRACE_HPP
+#define _TESS_TRACE_HPP
+
+#include <stddef.h>
+#include "mpi.h"
+
+void tess_trace_start(MPI_Comm comm,
+                      size_t capacity = 1 << 16);
+void tess_trace_stop();
+void tess_trace_write(MPI_Comm comm,
+                      const char* outfile);
+
+// records its lifetime as one event; name must be a string literal
+struct TessTraceScope
+{
+            TessTraceScope(const char* name, int gid = -1, int round = -1);
+            ~TessTraceScope();
+
+    const char* name_;
+    int         gid_;
+    int         round_;
+    double      start_;                 // < 0: tracing was off when the scope began
+};
+
+#ifdef TESS_TRACE
+#define TESS_TRACE_CONCAT_(a, b)            a ## b
+#define TESS_TRACE_CONCAT(a, b)             TESS_TRACE_CONCAT_(a, b)
+#define TESS_TRACE_SCOPE(name, gid, round)  \
+    TessTraceScope TESS_TRACE_CONCAT(tess_trace_scope_, __LINE__)(name, gid, round)
+#else
+#define TESS_TRACE_SCOPE(name, gid, round)
+#endif
+
+#endif
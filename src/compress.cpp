@@ -0,0 +1,726 @@
+// ---------------------------------------------------------------------------
+//
+//   compression of float arrays (density grids) and tets for block output
+//
+//   float stream layout: 1 byte codec id followed by the codec payload
+//
+//   COMPRESS_NONE:     n raw floats
+//   COMPRESS_ZERO_RUN: repeated (varint zero run, varint literal count, literal floats)
+//   COMPRESS_ZSTD:     uint64 size of zero-run payload, zstd frame of that payload
+//   COMPRESS_QUANT:    float max_err, then repeated
+//                      (varint zero run, varint literal count, zigzag varint quanta)
+//                      where a quantum of 0 (never otherwise a literal) escapes a raw float
+//
+//   tet stream layout: 1 byte codec id followed by the codec payload
+//
+//   TET_CODEC_RAW:     num_tets tet_t
+//   TET_CODEC_VARINT:  per canonical tet with vertex ranks r0 < r1 < {r2, r3}:
+//                      varints r0 - previous r0, r1 - r0 - 1, r2 - r1 - 1, r3 - r1 - 1
+//   TET_CODEC_DELTA16: the same four deltas as uint16, 0xffff followed by a uint32 if larger
+//
+// --------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <algorithm>
+
+#include "tess/compress.hpp"
+
+#ifdef TESS_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+
+// ---- varint helpers ----
+
+static void put_varint(vector<char>& out,
+                       uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back((char)((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+// returns false if the stream ends before the varint does
+static bool get_varint(const char*& p,
+                       const char* end,
+                       uint64_t& v)
+{
+    v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7)
+    {
+        uint8_t c = (uint8_t)*p++;
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static inline uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+// bitwise zero test, so that -0.0 survives the lossless codecs
+static inline bool is_zero(const float& x)
+{
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    return bits == 0;
+}
+
+// ---- zero-run elimination ----
+
+static void zero_run_encode(const float* in,
+                            size_t n,
+                            vector<char>& out)
+{
+    size_t i = 0;
+    while (i < n)
+    {
+        size_t zeros = 0;
+        while (i + zeros < n && is_zero(in[i + zeros]))
+            zeros++;
+        i += zeros;
+
+        size_t lits = 0;
+        while (i + lits < n && !is_zero(in[i + lits]))
+            lits++;
+
+        put_varint(out, zeros);
+        put_varint(out, lits);
+        size_t o = out.size();
+        out.resize(o + lits * sizeof(float));
+        if (lits)
+            memcpy(&out[o], &in[i], lits * sizeof(float));
+        i += lits;
+    }
+}
+
+static bool zero_run_decode(const char* p,
+                            const char* end,
+                            float* out,
+                            size_t n)
+{
+    size_t i = 0;
+    while (i < n)
+    {
+        uint64_t zeros, lits;
+        if (!get_varint(p, end, zeros) || !get_varint(p, end, lits))
+            return false;
+        if (i + zeros + lits > n || p + lits * sizeof(float) > end)
+            return false;
+        memset(&out[i], 0, zeros * sizeof(float));
+        i += zeros;
+        memcpy(&out[i], p, lits * sizeof(float));
+        p += lits * sizeof(float);
+        i += lits;
+    }
+    return true;
+}
+
+// ---- error-bounded quantization ----
+
+// each value is replaced by the nearest multiple of 2 * max_err, so the
+// reconstruction error is at most max_err; values that quantize to zero
+// fall into the zero runs; values that do not reconstruct within max_err (their
+// quantum does not fit in 32 bits, or float rounding of large values exceeds
+// max_err, or they are NaN or infinite) are kept exactly, escaped as raw floats
+static void quant_encode(const float* in,
+                         size_t n,
+                         float max_err,
+                         vector<char>& out)
+{
+    size_t o = out.size();
+    out.resize(o + sizeof(float));
+    memcpy(&out[o], &max_err, sizeof(float));
+
+    float step = 2.0f * max_err;
+    vector<int32_t> q(n);
+    vector<char>    raw(n, 0);              // escaped as a raw float
+    for (size_t i = 0; i < n; i++)
+    {
+        double r = rint((double)in[i] / step);
+        if (r >= INT32_MIN && r <= INT32_MAX &&        // false for NaN
+            fabs((float)(r * step) - in[i]) <= max_err)
+            q[i] = (int32_t)r;
+        else
+        {
+            q[i]   = 1;                     // any nonzero quantum, to stay a literal
+            raw[i] = 1;
+        }
+    }
+
+    size_t i = 0;
+    while (i < n)
+    {
+        size_t zeros = 0;
+        while (i + zeros < n && q[i + zeros] == 0)
+            zeros++;
+        i += zeros;
+
+        size_t lits = 0;
+        while (i + lits < n && q[i + lits] != 0)
+            lits++;
+
+        put_varint(out, zeros);
+        put_varint(out, lits);
+        for (size_t j = 0; j < lits; j++)
+        {
+            if (!raw[i + j])
+            {
+                put_varint(out, zigzag(q[i + j]));
+                continue;
+            }
+            put_varint(out, 0);
+            size_t l = out.size();
+            out.resize(l + sizeof(float));
+            memcpy(&out[l], &in[i + j], sizeof(float));
+        }
+        i += lits;
+    }
+}
+
+static bool quant_decode(const char* p,
+                         const char* end,
+                         float* out,
+                         size_t n)
+{
+    float max_err;
+    if (p + sizeof(float) > end)
+        return false;
+    memcpy(&max_err, p, sizeof(float));
+    p += sizeof(float);
+    float step = 2.0f * max_err;
+
+    size_t i = 0;
+    while (i < n)
+    {
+        uint64_t zeros, lits;
+        if (!get_varint(p, end, zeros) || !get_varint(p, end, lits))
+            return false;
+        if (i + zeros + lits > n)
+            return false;
+        memset(&out[i], 0, zeros * sizeof(float));
+        i += zeros;
+        for (uint64_t j = 0; j < lits; j++)
+        {
+            uint64_t v;
+            if (!get_varint(p, end, v))
+                return false;
+            if (!v)
+            {
+                if (p + sizeof(float) > end)
+                    return false;
+                memcpy(&out[i++], p, sizeof(float));
+                p += sizeof(float);
+                continue;
+            }
+            out[i++] = (float)((double)unzigzag((uint32_t)v) * step);
+        }
+    }
+    return true;
+}
+
+// compresses an array of floats
+//
+// in: input values
+// n: number of input values
+// codec: compression codec; COMPRESS_ZSTD falls back to COMPRESS_ZERO_RUN when tess
+//   is built without zstd, COMPRESS_QUANT falls back to COMPRESS_ZERO_RUN when max_err <= 0
+// max_err: maximum absolute error per value for COMPRESS_QUANT
+// out: compressed stream, appended to (output)
+//
+// returns: number of bytes appended to out
+size_t compress_floats(const float* in,
+                       size_t n,
+                       compress_t codec,
+                       float max_err,
+                       vector<char>& out)
+{
+#ifndef TESS_ZSTD
+    if (codec == COMPRESS_ZSTD)
+        codec = COMPRESS_ZERO_RUN;
+#endif
+    if (codec == COMPRESS_QUANT && max_err <= 0.0f)
+        codec = COMPRESS_ZERO_RUN;
+
+    size_t start = out.size();
+    out.push_back((char)codec);
+
+    switch (codec)
+    {
+    case COMPRESS_NONE:
+        out.resize(start + 1 + n * sizeof(float));
+        if (n)
+            memcpy(&out[start + 1], in, n * sizeof(float));
+        break;
+    case COMPRESS_ZERO_RUN:
+        zero_run_encode(in, n, out);
+        break;
+#ifdef TESS_ZSTD
+    case COMPRESS_ZSTD:
+    {
+        vector<char> runs;
+        zero_run_encode(in, n, runs);
+        uint64_t raw_size = runs.size();
+        size_t bound = ZSTD_compressBound(runs.size());
+        out.resize(start + 1 + sizeof(uint64_t) + bound);
+        memcpy(&out[start + 1], &raw_size, sizeof(uint64_t));
+        size_t csize = ZSTD_compress(&out[start + 1 + sizeof(uint64_t)], bound,
+                                     runs.size() ? &runs[0] : NULL, runs.size(), 1);
+        if (ZSTD_isError(csize))
+        {
+            // fall back to the uncompressed zero-run stream
+            out.resize(start);
+            out.push_back((char)COMPRESS_ZERO_RUN);
+            out.insert(out.end(), runs.begin(), runs.end());
+        }
+        else
+            out.resize(start + 1 + sizeof(uint64_t) + csize);
+        break;
+    }
+#endif
+    case COMPRESS_QUANT:
+        quant_encode(in, n, max_err, out);
+        break;
+    default:
+        fprintf(stderr, "Error: unknown compression codec %d\n", codec);
+        assert(false);
+        break;
+    }
+
+    return out.size() - start;
+}
+
+// decompresses an array of floats
+//
+// in: compressed stream
+// nbytes: size of the compressed stream
+// out: decompressed values, allocated by caller (output)
+// n: number of values
+//
+// returns: whether the stream was valid
+bool decompress_floats(const char* in,
+                       size_t nbytes,
+                       float* out,
+                       size_t n)
+{
+    if (!nbytes)
+        return n == 0;
+
+    const char* p   = in + 1;
+    const char* end = in + nbytes;
+
+    switch ((compress_t)in[0])
+    {
+    case COMPRESS_NONE:
+        if (p + n * sizeof(float) > end)
+            return false;
+        memcpy(out, p, n * sizeof(float));
+        return true;
+    case COMPRESS_ZERO_RUN:
+        return zero_run_decode(p, end, out, n);
+    case COMPRESS_ZSTD:
+    {
+#ifdef TESS_ZSTD
+        uint64_t raw_size;
+        if (p + sizeof(uint64_t) > end)
+            return false;
+        memcpy(&raw_size, p, sizeof(uint64_t));
+        p += sizeof(uint64_t);
+        vector<char> runs(raw_size);
+        size_t dsize = ZSTD_decompress(raw_size ? &runs[0] : NULL, raw_size, p, end - p);
+        if (ZSTD_isError(dsize) || dsize != raw_size)
+            return false;
+        return zero_run_decode(raw_size ? &runs[0] : NULL,
+                               raw_size ? &runs[0] + raw_size : NULL, out, n);
+#else
+        fprintf(stderr, "Error: stream is zstd compressed but tess was built without zstd\n");
+        return false;
+#endif
+    }
+    case COMPRESS_QUANT:
+        return quant_decode(p, end, out, n);
+    default:
+        return false;
+    }
+}
+
+// serializes a compressed float array
+void save_compressed(diy::BinaryBuffer& bb,
+                     const float* x,
+                     size_t n,
+                     compress_t codec)
+{
+    vector<char> out;
+    compress_floats(x, n, codec, 0.0f, out);
+    size_t nbytes = out.size();
+    diy::save(bb, nbytes);
+    diy::save(bb, &out[0], nbytes);
+}
+
+// deserializes a compressed float array
+// x: allocated by caller to hold n values
+void load_compressed(diy::BinaryBuffer& bb,
+                     float* x,
+                     size_t n)
+{
+    size_t nbytes;
+    diy::load(bb, nbytes);
+    vector<char> in(nbytes);
+    if (nbytes)
+        diy::load(bb, &in[0], nbytes);
+    if (!decompress_floats(nbytes ? &in[0] : NULL, nbytes, x, n))
+    {
+        fprintf(stderr, "Error: corrupt compressed array\n");
+        assert(false);
+    }
+}
+
+// ---- tets ----
+
+// spreads the low 10 bits of x to every third bit
+static inline uint32_t spread_bits(uint32_t x)
+{
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8))  & 0x0300f00f;
+    x = (x | (x << 4))  & 0x030c30c3;
+    x = (x | (x << 2))  & 0x09249249;
+    return x;
+}
+
+// Morton order of the particles within their bounding box, ties broken by particle index
+// the encoder and decoder both compute it from the particles, so it is never stored
+//
+// rank: position of each particle in the order (output)
+// order: particle at each position (output)
+static void morton_order(const float* particles,
+                         int num_particles,
+                         vector<int>& rank,
+                         vector<int>& order)
+{
+    float mins[3], scale[3];
+    for (int j = 0; j < 3; j++)
+    {
+        float maxs = mins[j] = num_particles ? particles[j] : 0.0f;
+        for (int i = 1; i < num_particles; i++)
+        {
+            mins[j] = min(mins[j], particles[3 * i + j]);
+            maxs    = max(maxs,    particles[3 * i + j]);
+        }
+        scale[j] = maxs > mins[j] ? 1023.0f / (maxs - mins[j]) : 0.0f;
+    }
+
+    vector<uint64_t> keys(num_particles);
+    for (int i = 0; i < num_particles; i++)
+    {
+        uint32_t code = 0;
+        for (int j = 0; j < 3; j++)
+        {
+            uint32_t q = (uint32_t)((particles[3 * i + j] - mins[j]) * scale[j]);
+            code |= spread_bits(min(q, 1023u)) << j;
+        }
+        keys[i] = ((uint64_t)code << 32) | (uint32_t)i;
+    }
+    sort(keys.begin(), keys.end());
+
+    rank.resize(num_particles);
+    order.resize(num_particles);
+    for (int r = 0; r < num_particles; r++)
+    {
+        order[r] = (int)(keys[r] & 0xffffffff);
+        rank[order[r]] = r;
+    }
+}
+
+static void put_u16(vector<char>& out,
+                    uint16_t v)
+{
+    out.push_back((char)(v & 0xff));
+    out.push_back((char)(v >> 8));
+}
+
+static void put_delta16(vector<char>& out,
+                        uint32_t v)
+{
+    if (v < 0xffff)
+        put_u16(out, v);
+    else
+    {
+        put_u16(out, 0xffff);
+        put_u16(out, v & 0xffff);
+        put_u16(out, v >> 16);
+    }
+}
+
+static bool get_delta16(const char*& p,
+                        const char* end,
+                        uint32_t& v)
+{
+    if (p + 2 > end)
+        return false;
+    v = (uint8_t)p[0] | ((uint32_t)(uint8_t)p[1] << 8);
+    p += 2;
+    if (v < 0xffff)
+        return true;
+    if (p + 4 > end)
+        return false;
+    v = (uint8_t)p[0] | ((uint32_t)(uint8_t)p[1] << 8) |
+        ((uint32_t)(uint8_t)p[2] << 16) | ((uint32_t)(uint8_t)p[3] << 24);
+    p += 4;
+    return true;
+}
+
+// compresses tets
+//
+// tets: input tets
+// num_tets: number of input tets
+// particles: particles that the tet vertices index
+// num_particles: number of particles
+// codec: tet codec
+// out: compressed stream, appended to (output)
+//
+// returns: number of bytes appended to out
+size_t compress_tets(const tet_t* tets,
+                     int num_tets,
+                     const float* particles,
+                     int num_particles,
+                     tet_codec_t codec,
+                     vector<char>& out)
+{
+    size_t start = out.size();
+    out.push_back((char)codec);
+
+    if (codec == TET_CODEC_RAW)
+    {
+        out.resize(start + 1 + num_tets * sizeof(tet_t));
+        if (num_tets)
+            memcpy(&out[start + 1], tets, num_tets * sizeof(tet_t));
+        return out.size() - start;
+    }
+    if (codec != TET_CODEC_VARINT && codec != TET_CODEC_DELTA16)
+    {
+        fprintf(stderr, "Error: unknown tet codec %d\n", codec);
+        assert(false);
+    }
+
+    vector<int> rank, order;
+    morton_order(particles, num_particles, rank, order);
+
+    // canonical tets: even permutation that moves the lowest rank first, then rotation of the
+    // other three that moves their lowest rank second
+    static const int even_perms[4][4] = { {0, 1, 2, 3}, {1, 0, 3, 2}, {2, 0, 1, 3}, {3, 0, 2, 1} };
+    vector<uint32_t> canon(4 * (size_t)num_tets);
+    for (int t = 0; t < num_tets; t++)
+    {
+        uint32_t r[4];
+        int k = 0;
+        for (int j = 0; j < 4; j++)
+        {
+            r[j] = rank[tets[t].verts[j]];
+            if (r[j] < r[k])
+                k = j;
+        }
+        uint32_t* c = &canon[4 * (size_t)t];
+        for (int j = 0; j < 4; j++)
+            c[j] = r[even_perms[k][j]];
+        while (c[1] > c[2] || c[1] > c[3])
+        {
+            uint32_t c1 = c[1];
+            c[1] = c[2];
+            c[2] = c[3];
+            c[3] = c1;
+        }
+    }
+
+    // sort tets by their vertices
+    vector<int> sorted(num_tets);
+    for (int t = 0; t < num_tets; t++)
+        sorted[t] = t;
+    sort(sorted.begin(), sorted.end(), [&canon](int a, int b)
+         { return lexicographical_compare(&canon[4 * (size_t)a], &canon[4 * (size_t)a + 4],
+                                          &canon[4 * (size_t)b], &canon[4 * (size_t)b + 4]); });
+
+    uint32_t prev = 0;
+    for (int t = 0; t < num_tets; t++)
+    {
+        const uint32_t* c = &canon[4 * (size_t)sorted[t]];
+        uint32_t deltas[4] = { c[0] - prev, c[1] - c[0] - 1, c[2] - c[1] - 1, c[3] - c[1] - 1 };
+        prev = c[0];
+        for (int j = 0; j < 4; j++)
+        {
+            if (codec == TET_CODEC_VARINT)
+                put_varint(out, deltas[j]);
+            else
+                put_delta16(out, deltas[j]);
+        }
+    }
+
+    return out.size() - start;
+}
+
+// decompresses tets
+//
+// in: compressed stream
+// nbytes: size of the compressed stream
+// particles: particles that the tet vertices index, the same as when compressed
+// num_particles: number of particles
+// tets: decompressed tets, allocated by caller (output)
+// num_tets: number of tets
+//
+// returns: whether the stream was valid
+bool decompress_tets(const char* in,
+                     size_t nbytes,
+                     const float* particles,
+                     int num_particles,
+                     tet_t* tets,
+                     int num_tets)
+{
+    if (!nbytes)
+        return num_tets == 0;
+
+    const char* p   = in + 1;
+    const char* end = in + nbytes;
+    tet_codec_t codec = (tet_codec_t)in[0];
+
+    if (codec == TET_CODEC_RAW)
+    {
+        if (p + num_tets * sizeof(tet_t) > end)
+            return false;
+        memcpy(tets, p, num_tets * sizeof(tet_t));
+        return true;
+    }
+    if (codec != TET_CODEC_VARINT && codec != TET_CODEC_DELTA16)
+        return false;
+
+    vector<int> rank, order;
+    morton_order(particles, num_particles, rank, order);
+
+    uint32_t prev = 0;
+    for (int t = 0; t < num_tets; t++)
+    {
+        uint32_t d[4];
+        for (int j = 0; j < 4; j++)
+        {
+            if (codec == TET_CODEC_VARINT)
+            {
+                uint64_t v;
+                if (!get_varint(p, end, v))
+                    return false;
+                d[j] = (uint32_t)v;
+            }
+            else if (!get_delta16(p, end, d[j]))
+                return false;
+        }
+        uint32_t c[4];
+        c[0] = prev + d[0];
+        c[1] = c[0] + d[1] + 1;
+        c[2] = c[1] + d[2] + 1;
+        c[3] = c[1] + d[3] + 1;
+        prev = c[0];
+        if (c[2] >= (uint32_t)num_particles || c[3] >= (uint32_t)num_particles)
+            return false;
+        for (int j = 0; j < 4; j++)
+            tets[t].verts[j] = c[j];
+    }
+
+    // adjacency does not depend on vertex numbering; in rank order, the tets are sorted by
+    // their lowest vertex and the face lookups are local
+    tet_adjacency(tets, num_tets, num_particles);
+
+    for (int t = 0; t < num_tets; t++)
+        for (int j = 0; j < 4; j++)
+            tets[t].verts[j] = order[tets[t].verts[j]];
+
+    return true;
+}
+
+// rebuilds the neighbors of tets (tet_t::tets) from their vertices
+// faces are bucketed by their lowest vertex, and matched within each bucket; buckets are small
+// (about a dozen faces) and contiguous, so the pass is linear and cache friendly
+// faces without a matching tet get neighbor -1
+//
+// tets: tets, neighbors are overwritten
+// num_tets: number of tets
+// num_verts: number of vertices (maximum vertex index + 1)
+void tet_adjacency(tet_t* tets,
+                   int num_tets,
+                   int num_verts)
+{
+    struct face_t
+    {
+        int b, c;                          // other two vertices, sorted; b = -1 once matched
+        int id;                            // 4 * tet + opposite vertex
+    };
+
+    // bucket offsets
+    vector<int> start(num_verts + 1, 0);
+    vector<face_t> faces(4 * (size_t)num_tets);
+    for (int t = 0; t < num_tets; t++)
+    {
+        const int* v = tets[t].verts;
+        for (int i = 0; i < 4; i++)
+            start[min(min(v[(i + 1) % 4], v[(i + 2) % 4]), v[(i + 3) % 4]) + 1]++;
+    }
+    for (int v = 0; v < num_verts; v++)
+        start[v + 1] += start[v];
+
+    // fill buckets
+    vector<int> next(start.begin(), start.end() - 1);
+    for (int t = 0; t < num_tets; t++)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            tets[t].tets[i] = -1;
+
+            int a = tets[t].verts[(i + 1) % 4];
+            int b = tets[t].verts[(i + 2) % 4];
+            int c = tets[t].verts[(i + 3) % 4];
+            if (a > b) swap(a, b);
+            if (b > c) swap(b, c);
+            if (a > b) swap(a, b);
+
+            face_t& f = faces[next[a]++];
+            f.b  = b;
+            f.c  = c;
+            f.id = 4 * t + i;
+        }
+    }
+
+    // match faces within buckets
+    for (int v = 0; v < num_verts; v++)
+    {
+        for (int i = start[v]; i < start[v + 1]; i++)
+        {
+            if (faces[i].b < 0)
+                continue;
+            for (int j = i + 1; j < start[v + 1]; j++)
+            {
+                if (faces[j].b == faces[i].b && faces[j].c == faces[i].c)
+                {
+                    int f = faces[i].id;
+                    int g = faces[j].id;
+                    tets[f / 4].tets[f % 4] = g / 4;
+                    tets[g / 4].tets[g % 4] = f / 4;
+                    faces[j].b = -1;
+                    break;
+                }
+            }
+        }
+    }
+}
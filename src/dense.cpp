@@ -15,6 +15,7 @@
 
 #include "tess/dense.hpp"
 #include <diy/point.hpp>
+#include <algorithm>
 #ifndef TESS_NO_OPENMP
 #include <omp.h>
 #endif
@@ -25,6 +26,10 @@ using namespace std;
 static float max_dense = 0.0;
 static double tot_mass = 0.0; // total output mass
 static float check_mass = 0.0; // ground truth total mass
+static double grid_raw_bytes = 0.0; // uncompressed size of local grid chunks
+static double grid_file_bytes = 0.0; // compressed size of local grid chunks
+static double grid_write_bytes = 0.0; // bytes of grid output written by this process
+static double grid_write_time = 0.0; // time this process spent writing grid output
 
 // density estimator
 void dense(alg alg_type,              // algorithm DENSE_TESS, DENSE_CIC
@@ -41,8 +46,13 @@ void dense(alg alg_type,              // algorithm DENSE_TESS, DENSE_CIC
 	   float *grid_step_size,     // physical size of grid space (x,y,z) (output)
            float eps,                 // floating point error threshold
            int *glo_num_idx,          // global number of grid points (i,j,k)
-           diy::Master& master)       // diy master object
+           diy::Master& master,       // diy master object
+           int mass_attr,             // particle attribute holding mass (-1: use mass for all)
+           int num_fields,            // number of mass-weighted attribute fields
+           int *field_attrs)          // particle attribute deposited into each field
 {
+  TESS_TRACE_SCOPE("dense", -1, -1);
+
   // local block grid parameters
   int block_min_idx[3];               // global grid index of block minimum grid point
   int block_max_idx[3];               // global grid index of block maximum grid point
@@ -80,6 +90,16 @@ void dense(alg alg_type,              // algorithm DENSE_TESS, DENSE_CIC
   args.glo_num_idx[0]    = glo_num_idx[0];
   args.glo_num_idx[1]    = glo_num_idx[1];
   args.glo_num_idx[2]    = glo_num_idx[2];
+  args.mass_attr         = mass_attr;
+  args.num_fields        = num_fields;
+
+  if (num_fields > MAX_ATTRS)
+  {
+    fprintf(stderr, "Error: %d fields exceeds MAX_ATTRS = %d\n", num_fields, MAX_ATTRS);
+    MPI_Abort(master.communicator(), 1);
+  }
+  for (int i = 0; i < num_fields; i++)
+    args.field_attrs[i]  = field_attrs[i];
 
   // allocate and initialize density field
   master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
@@ -92,14 +112,28 @@ void dense(alg alg_type,              // algorithm DENSE_TESS, DENSE_CIC
 
   // estimate density
   master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
-                 { est_dense(b, cp, &args); });
+                 {
+                   TESS_TRACE_SCOPE("est_dense", cp.gid(), -1);
+                   est_dense(b, cp, &args);
+                 });
 
   // exchange grid points
-  master.exchange();
+  {
+    TESS_TRACE_SCOPE("dense_exchange", -1, -1);
+    master.exchange();
+  }
 
   // process received points
   master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
-                 { recvd_pts(b, cp, &args); });
+                 {
+                   TESS_TRACE_SCOPE("recvd_pts", cp.gid(), -1);
+                   recvd_pts(b, cp, &args);
+                 });
+
+  // convert accumulated attribute fields to mass-weighted averages
+  if (num_fields)
+    master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+                   { norm_fields(b, cp, &args); });
 }
 
 // foreach block function to initialize density
@@ -121,9 +155,36 @@ void init_dense(DBlock*                         b,
     npts = block_num_idx[0] * block_num_idx[1] * block_num_idx[2];
   b->density = new float[npts];
   b->num_grid_pts = npts;
+  tess_mem_track(b->density, npts * sizeof(float), MEM_DENSITY);
 
   // init density
   memset(b->density, 0 , npts * sizeof(float));
+
+  // check that the requested attributes exist
+  if (a->mass_attr >= b->num_attrs)
+  {
+    fprintf(stderr, "Error: mass attribute %d but block %d has only %d attributes\n",
+            a->mass_attr, b->gid, b->num_attrs);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  for (int i = 0; i < a->num_fields; i++)
+  {
+    if (a->field_attrs[i] < 0 || a->field_attrs[i] >= b->num_attrs)
+    {
+      fprintf(stderr, "Error: field attribute %d but block %d has only %d attributes\n",
+              a->field_attrs[i], b->gid, b->num_attrs);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+  }
+
+  // init attribute fields, interleaved per grid point
+  b->num_fields = a->num_fields;
+  if (b->num_fields)
+  {
+    b->fields = new float[(size_t)npts * b->num_fields];
+    tess_mem_track(b->fields, (size_t)npts * b->num_fields * sizeof(float), MEM_DENSITY);
+    memset(b->fields, 0 , (size_t)npts * b->num_fields * sizeof(float));
+  }
 }
 
 // foreach block function to estimate density
@@ -145,17 +206,20 @@ void est_dense(DBlock*                         b,
 #if 0
     // tess-based multithread estimator
     IterateCellsOMP(b, block_min_idx, block_num_idx, a->project, a->proj_plane, a->grid_phys_mins,
-                    a->grid_step_size, a->data_mins, a->data_maxs, a->eps, a->mass, cp);
+                    a->grid_step_size, a->data_mins, a->data_maxs, a->eps, a->mass,
+                    a->mass_attr, a->num_fields, a->field_attrs, cp);
 #else
     // tess-based single-thread estimator
     IterateCells(b, block_min_idx, block_num_idx, a->project, a->proj_plane, a->grid_phys_mins,
-                 a->grid_step_size, a->data_mins, a->data_maxs, a->eps, a->mass, cp);
+                 a->grid_step_size, a->data_mins, a->data_maxs, a->eps, a->mass,
+                 a->mass_attr, a->num_fields, a->field_attrs, cp);
 #endif
     break;
   case DENSE_CIC:
     // CIC-based estimator (only single threaded for now)
     IterateCellsCic(b, block_min_idx, block_num_idx, a->project, a->proj_plane, a->grid_phys_mins,
-                    a->grid_step_size, a->data_maxs, a->eps, a->mass, cp);
+                    a->grid_step_size, a->data_maxs, a->eps, a->mass,
+                    a->mass_attr, a->num_fields, a->field_attrs, cp);
     break;
   default:
     break;
@@ -179,21 +243,30 @@ void recvd_pts(DBlock*                         b,
   BlockGridParams(b, block_min_idx, block_max_idx, block_num_idx, a->grid_phys_mins,
                   a->grid_step_size, a->eps, a->data_mins, a->data_maxs, a->glo_num_idx);
 
+  // each grid point is followed by its num_fields mass-weighted attribute values
+  size_t pt_size = sizeof(grid_pt_t) + a->num_fields * sizeof(float);
+  float vals[MAX_ATTRS];
+
   for (size_t i = 0; i < in.size(); i++)   // links
   {
-    int numpts = cp.incoming(in[i]).buffer.size() / sizeof(grid_pt_t);
-    vector<grid_pt_t> grid_pts(numpts);
-    cp.dequeue(in[i], &grid_pts[0], numpts);
+    int numpts = cp.incoming(in[i]).buffer.size() / pt_size;
     for (size_t j = 0; j < numpts; j++)    // items in the link
     {
+      grid_pt_t grid_pt;
+      cp.dequeue(in[i], grid_pt);
+      if (a->num_fields)
+        cp.dequeue(in[i], vals, a->num_fields);
+
       // assign the density in the local block array
       int block_grid_idx[3]; // indices in local block array
-      Global2LocalIdx(grid_pts[j].idx, block_grid_idx, block_min_idx);
+      Global2LocalIdx(grid_pt.idx, block_grid_idx, block_min_idx);
       int idx = index(block_grid_idx, block_num_idx, a->project, a->proj_plane);
-      b->density[idx] += (grid_pts[j].mass / a->div);
+      b->density[idx] += (grid_pt.mass / a->div);
+      for (int k = 0; k < a->num_fields; k++)
+        b->fields[idx * a->num_fields + k] += (vals[k] / a->div);
 
       // debug
-      tot_mass += grid_pts[j].mass;
+      tot_mass += grid_pt.mass;
       if (b->density[idx] > max_dense)
         max_dense = b->density[idx];
 
@@ -201,6 +274,96 @@ void recvd_pts(DBlock*                         b,
   }
 }
 
+// foreach block function to normalize attribute fields
+// fields accumulate sum(mass * attr) / div and density accumulates sum(mass) / div,
+// so their ratio is the mass-weighted average of the attribute at the grid point
+void norm_fields(DBlock*                         b,
+                 const diy::Master::ProxyWithLink& cp,
+                 args_t*                           a)
+{
+  for (int i = 0; i < b->num_grid_pts; i++)
+  {
+    for (int k = 0; k < b->num_fields; k++)
+    {
+      if (b->density[i] > 0.0)
+        b->fields[i * b->num_fields + k] /= b->density[i];
+      else
+        b->fields[i * b->num_fields + k] = 0.0;
+    }
+  }
+}
+
+// mass of the particle at the site of a cell
+//
+// dblock: local block
+// cell: cell (original particle) index
+// mass: mass of 1 particle when masses are not given per particle
+// mass_attr: particle attribute holding mass, -1 to use mass for all
+//
+// returns: mass of the particle
+float CellMass(DBlock *dblock,
+               int cell,
+               float mass,
+               int mass_attr)
+{
+  if (mass_attr < 0)
+    return mass;
+  return dblock->attrs[cell * dblock->num_attrs + mass_attr];
+}
+
+// deposit mass-weighted particle attributes of one cell onto a local grid point
+//
+// dblock: local block
+// idx: local block index of grid point
+// cell: cell (original particle) index
+// weight: fraction of the cell mass deposited at the grid point divided by
+//   grid cell volume (or area)
+// num_fields: number of attribute fields
+// field_attrs: particle attribute deposited into each field
+void DepositFields(DBlock *dblock,
+                   int idx,
+                   int cell,
+                   float weight,
+                   int num_fields,
+                   int *field_attrs)
+{
+  if (!num_fields)
+    return;
+
+  float *attrs = &(dblock->attrs[cell * dblock->num_attrs]);
+  for (int k = 0; k < num_fields; k++)
+    dblock->fields[idx * num_fields + k] += weight * attrs[field_attrs[k]];
+}
+
+// send a grid point to a neighboring block, followed by its num_fields
+// mass-weighted attribute values
+//
+// cp: communication proxy
+// dest: destination block
+// grid_pt: grid point, including the fraction of the cell mass deposited there
+// dblock: local block
+// cell: cell (original particle) index
+// num_fields: number of attribute fields
+// field_attrs: particle attribute deposited into each field
+void EnqueueGridPt(const diy::Master::ProxyWithLink& cp,
+                   const diy::BlockID& dest,
+                   grid_pt_t &grid_pt,
+                   DBlock *dblock,
+                   int cell,
+                   int num_fields,
+                   int *field_attrs)
+{
+  cp.enqueue(dest, grid_pt);
+  if (!num_fields)
+    return;
+
+  float vals[MAX_ATTRS];
+  float *attrs = &(dblock->attrs[cell * dblock->num_attrs]);
+  for (int k = 0; k < num_fields; k++)
+    vals[k] = grid_pt.mass * attrs[field_attrs[k]];
+  cp.enqueue(dest, vals, num_fields);
+}
+
 // iterate over cells and assign single density to grid point
 // single thread version
 //
@@ -213,10 +376,13 @@ void recvd_pts(DBlock*                         b,
 // grid_step_size: physical size of one grid space (x,y,z)
 // data_mins, data_maxs: global data physical extent (x,y,z)
 // eps: floating point error tolerance
-// mass: mass of 1 particle
+// mass: mass of 1 particle, unless given per particle by mass_attr
+// mass_attr: particle attribute holding mass, -1 to use mass for all particles
+// num_fields: number of mass-weighted attribute fields deposited in the same pass
+// field_attrs: particle attribute deposited into each field
 // cp: communication proxy
 //
-// side effects: writes density or sends to neighbors
+// side effects: writes density and fields or sends to neighbors
 void IterateCells(DBlock* block,
                   int *block_min_idx,
                   int *block_num_idx,
@@ -228,6 +394,9 @@ void IterateCells(DBlock* block,
                   float *data_maxs,
                   float eps,
                   float mass,
+                  int mass_attr,
+                  int num_fields,
+                  int *field_attrs,
                   const diy::Master::ProxyWithLink& cp)
 {
   int alloc_grid_pts = 0;                       // number of grid points allocated
@@ -259,16 +428,17 @@ void IterateCells(DBlock* block,
     CellBounds(block, cell, cell_min, cell_max, normals, face_verts);
 
     // grid points covered by this cell
+    float cell_mass = CellMass(block, cell, mass, mass_attr);
     num_grid_pts = CellGridPts(cell_min, cell_max, grid_pts, border,
 			       alloc_grid_pts, normals, face_verts, data_mins,
 			       data_maxs, grid_phys_mins, grid_step_size,
-			       mass, eps, &(block->particles[3 * cell]));
+			       cell_mass, eps, &(block->particles[3 * cell]));
 
     if (!num_grid_pts) // cell outside of global data bounds
       continue;
 
     // debug: check consistency
-    check_mass++;
+    check_mass += cell_mass;
 
     // grid points covered by cell
     for (int i = 0; i < num_grid_pts; i++)
@@ -288,6 +458,7 @@ void IterateCells(DBlock* block,
 	Global2LocalIdx(grid_pts[i].idx, block_grid_idx, block_min_idx);
 	int idx = index(block_grid_idx, block_num_idx, project, proj_plane);
 	block->density[idx] += (grid_pts[i].mass / div);
+	DepositFields(block, idx, cell, grid_pts[i].mass / div, num_fields, field_attrs);
 
 	// consistency checks and stats
 	tot_mass += grid_pts[i].mass;
@@ -301,15 +472,15 @@ void IterateCells(DBlock* block,
         set<int> dests; // destination neighbor edges for this point
         in(*l, diy::Point<float,3> { grid_pos }, std::inserter(dests, dests.end()), block->data_bounds);
         for (set<int>::iterator it = dests.begin(); it != dests.end(); it++)
-          cp.enqueue(l->target(*it), grid_pts[i]);
+          EnqueueGridPt(cp, l->target(*it), grid_pts[i], block, cell, num_fields, field_attrs);
       }
     } // grid points covered by cell
   } // cells
 
   if (grid_pts)
-    free(grid_pts);
+    tess_free(grid_pts);
   if (border)
-    free(border);
+    tess_free(border);
 }
 
 #ifndef TESS_NO_OPENMP
@@ -326,10 +497,13 @@ void IterateCells(DBlock* block,
 // grid_step_size: physical size of one grid space (x,y,z)
 // data_mins, data_maxs: global data physical extent (x,y,z)
 // eps: floating point error tolerance
-// mass: mass of 1 particle
+// mass: mass of 1 particle, unless given per particle by mass_attr
+// mass_attr: particle attribute holding mass, -1 to use mass for all particles
+// num_fields: number of mass-weighted attribute fields deposited in the same pass
+// field_attrs: particle attribute deposited into each field
 // cp: communication proxy
 //
-// side effects: writes density or sends to neighbors
+// side effects: writes density and fields or sends to neighbors
 void IterateCellsOMP(DBlock* block,
                      int *block_min_idx,
                      int *block_num_idx,
@@ -341,11 +515,15 @@ void IterateCellsOMP(DBlock* block,
                      float *data_maxs,
                      float eps,
                      float mass,
+                     int mass_attr,
+                     int num_fields,
+                     int *field_attrs,
                      const diy::Master::ProxyWithLink& cp)
 {
   int nthreads;                                 // number of threads currently being used
   int mthreads = omp_get_max_threads();         // max threads that could be used
   vector<grid_pt_t> enq_grid_pts[mthreads];     // enqueued grid pts for each thread
+  vector<int> enq_cells[mthreads];              // cell of each enqueued grid pt
   RCLink* l = dynamic_cast<RCLink*>(cp.link()); // link to block neighbors
 
   // divisor for volume (3d density) or area (2d density)
@@ -388,17 +566,18 @@ void IterateCellsOMP(DBlock* block,
       CellBounds(block, cell, cell_min, cell_max, normals, face_verts);
 
       // grid points covered by this cell
+      float cell_mass = CellMass(block, cell, mass, mass_attr);
       num_grid_pts = CellGridPts(cell_min, cell_max, grid_pts, border,
 				 alloc_grid_pts, normals, face_verts, data_mins,
 				 data_maxs, grid_phys_mins, grid_step_size,
-				 mass, eps, &(block->particles[3 * cell]));
+				 cell_mass, eps, &(block->particles[3 * cell]));
 
       if (!num_grid_pts) // cell outside of global data bounds
 	continue;
 
       // debug: consistency check
 #pragma omp atomic
-      check_mass++;
+      check_mass += cell_mass;
 
       // iterate over grid points covered by cell
       for (int i = 0; i < num_grid_pts; i++)
@@ -419,6 +598,12 @@ void IterateCellsOMP(DBlock* block,
 	  int idx = index(block_grid_idx, block_num_idx, project, proj_plane);
 #pragma omp atomic
 	  block->density[idx] += (grid_pts[i].mass / div);
+	  for (int k = 0; k < num_fields; k++)
+	  {
+	    float attr = block->attrs[cell * block->num_attrs + field_attrs[k]];
+#pragma omp atomic
+	    block->fields[idx * num_fields + k] += (grid_pts[i].mass / div) * attr;
+	  }
 
 	  // consistency check and output stats
 #pragma omp atomic // only the next statement is atomic
@@ -429,14 +614,17 @@ void IterateCellsOMP(DBlock* block,
 
 	// or send grid points to neighboring blocks
 	else
+	{
 	  enq_grid_pts[tid].push_back(grid_pts[i]);
+	  enq_cells[tid].push_back(cell);
+	}
       } // grid points covered by cell
     } // cells
 
     if (grid_pts)
-      free(grid_pts);
+      tess_free(grid_pts);
     if (border)
-      free(border);
+      tess_free(border);
 
   } // parallel block
 
@@ -451,14 +639,18 @@ void IterateCellsOMP(DBlock* block,
         set<int> dests; // destination neighbor edges for this point
         in(*l, grid_pos, std::inserter(dests, dests.end()), block->data_bounds);
         for (set<int>::iterator it = dests.begin(); it != dests.end(); it++)
-          cp.enqueue(l->target(*it), enq_grid_pts[i][j]);
+          EnqueueGridPt(cp, l->target(*it), enq_grid_pts[i][j], block, enq_cells[i][j],
+                        num_fields, field_attrs);
     }
   }
 
   // clean up grid enqueued grid points todo: are they freed automatically
   // when the array of vectors goes out of scope?
   for (int i = 0; i < nthreads; i++)
+  {
     enq_grid_pts[i].clear();
+    enq_cells[i].clear();
+  }
 }
 
 #endif
@@ -479,10 +671,13 @@ void IterateCellsOMP(DBlock* block,
 // grid_phys_mins: physical global min grid corner position (x,y,z)
 // grid_step_size: physical size of one grid space (x,y,z)
 // eps: floating point error tolerance
-// mass: mass of 1 particle
+// mass: mass of 1 particle, unless given per particle by mass_attr
+// mass_attr: particle attribute holding mass, -1 to use mass for all particles
+// num_fields: number of mass-weighted attribute fields deposited in the same pass
+// field_attrs: particle attribute deposited into each field
 // cp: communication proxy
 //
-// side effects: writes density or sends to neighbors
+// side effects: writes density and fields or sends to neighbors
 void IterateCellsCic(DBlock* block,
                      int *block_min_idx,
                      int *block_num_idx,
@@ -493,6 +688,9 @@ void IterateCellsCic(DBlock* block,
 		     float *data_maxs,
                      float eps,
                      float mass,
+                     int mass_attr,
+                     int num_fields,
+                     int *field_attrs,
                      const diy::Master::ProxyWithLink& cp)
 {
   float grid_pos[3];                            // physical position of grid point
@@ -506,8 +704,10 @@ void IterateCellsCic(DBlock* block,
   // cells
   for (int cell = 0; cell < block->num_orig_particles; cell++)
   {
+    float cell_mass = CellMass(block, cell, mass, mass_attr);
+
     // consitency check
-    check_mass++;
+    check_mass += cell_mass;
 
     // distribute mass at cell site to neighboring grid points
     vector<int> grid_idxs; // grid idxs that get a fraction of the mass
@@ -515,7 +715,8 @@ void IterateCellsCic(DBlock* block,
 
     float *pt = &(block->particles[3 * cell]); // x,y,z of particle
 
-    DistributeScalarCIC(pt, mass, grid_idxs, grid_masses, grid_step_size, grid_phys_mins, eps);
+    DistributeScalarCIC(pt, cell_mass, grid_idxs, grid_masses, grid_step_size, grid_phys_mins,
+                        eps);
 
     assert((int)grid_idxs.size() / 3 == 8); // sanity
 
@@ -537,6 +738,7 @@ void IterateCellsCic(DBlock* block,
 	Global2LocalIdx(&(grid_idxs[3 * i]), block_grid_idx, block_min_idx);
 	int idx = index(block_grid_idx, block_num_idx, project, proj_plane);
 	block->density[idx] += (grid_masses[i] / div);
+	DepositFields(block, idx, cell, grid_masses[i] / div, num_fields, field_attrs);
 
 	// consistency checks and output stats
 	tot_mass += grid_masses[i];
@@ -555,7 +757,7 @@ void IterateCellsCic(DBlock* block,
         set<int> dests; // destination neighbor edges for this point
         in(*l, diy::Point<float,3> { grid_pos }, std::inserter(dests, dests.end()), block->data_bounds);
         for (set<int>::iterator it = dests.begin(); it != dests.end(); it++)
-          cp.enqueue(l->target(*it), grid_pt);
+          EnqueueGridPt(cp, l->target(*it), grid_pt, block, cell, num_fields, field_attrs);
       }
     } // (8) grid points for this cell site
   } // cells
@@ -736,8 +938,15 @@ void CellBounds(DBlock *dblock,
 }
 
 // write density grid
+// mass-weighted attribute fields, if any, are written to a separate file named
+// <outfile>.fields, num_fields floats per grid point interleaved, in the same grid order
 //
-// mblocks: max number of blocks in any process
+// all local blocks of a process are written together: the rows of grid points of all
+// blocks are sorted by file offset into one derived file type, with a matching memory
+// type addressing the rows in place, so there is a single collective write per file
+// regardless of how unevenly blocks are distributed over processes
+//
+// mblocks: max number of blocks in any process (unused, kept for compatibility)
 // tblocks: total (global) number of blocks
 // outfile: output file name
 // project: whether to project to 2D
@@ -748,6 +957,9 @@ void CellBounds(DBlock *dblock,
 // given_mins, given_maxs: given global data extents (x,y,z)
 // master: diy master object
 // assigner: diy assigner object
+// aggregators: number of I/O aggregator processes (cb_nodes hint), 0 = MPI-IO default
+// stripe_size: file system stripe size in bytes; collective buffers and file domains
+//   are aligned to it (striping_unit and cb_buffer_size hints), 0 = MPI-IO default
 void WriteGrid(int mblocks,
                int tblocks,
                char *outfile,
@@ -760,15 +972,10 @@ void WriteGrid(int mblocks,
                float *given_mins,
                float *given_maxs,
                diy::Master& master,
-               diy::Assigner& assigner)
+               diy::Assigner& assigner,
+               int aggregators,
+               int stripe_size)
 {
-  MPI_Status status;
-  int pts_written;
-  MPI_File fd;
-  int sizes[3]; // sizes of global array
-  int subsizes[3]; // sizes of subarrays
-  int starts[3]; // starting offsets of subarrays
-  MPI_Datatype dtype; // subarray datatype
   MPI_Comm comm = master.communicator();
 
   // array of pointers to all my local blocks
@@ -777,13 +984,361 @@ void WriteGrid(int mblocks,
   for (int i = 0; i < nblocks; i++)
     dblocks[i] = master.block<DBlock>(i);
 
+  // I/O hints
+  MPI_Info info = GridIOInfo(aggregators, stripe_size);
+
+  // global grid parameters
+  float grid_phys_mins[3], grid_phys_maxs[3]; // global grid extents
+  float grid_step_size[3]; // physical grid space size
+  GridStepParams(num_given_bounds, given_mins, given_maxs, data_mins, data_maxs, grid_phys_mins,
+                 grid_phys_maxs, grid_step_size, glo_num_idx);
+
+  // project
+  if (project)
+    ProjectGrid(tblocks, glo_num_idx, eps, data_mins, data_maxs,
+                grid_phys_mins, grid_step_size, master, assigner);
+
+  // attribute fields
+  int num_fields = 0;                       // number of fields in any local block
+  int glo_num_fields;                       // number of fields in any block
+  for (int i = 0; i < nblocks; i++)
+    if (dblocks[i]->num_fields > num_fields)
+      num_fields = dblocks[i]->num_fields;
+  MPI_Allreduce(&num_fields, &glo_num_fields, 1, MPI_INT, MPI_MAX, comm);
+  if (glo_num_fields && project)
+  {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    if (rank == 0)
+      fprintf(stderr, "Warning: attribute fields are not projected to 2D and will not be written\n");
+    glo_num_fields = 0;
+  }
+
+  // rows of grid points (x fastest) of all local blocks
+  vector<grid_row_t> rows;                  // density rows
+  vector<grid_row_t> field_rows;            // attribute field rows
+  for (int block = 0; block < nblocks; block++)
+  {
+    // local block grid parameters
+    int block_min_idx[3]; // global grid index of block minimum grid point
+    int block_max_idx[3]; // global grid index of block maximum grid point
+    int block_num_idx[3]; // number of grid points in local block
+    BlockGridParams(dblocks[block], block_min_idx, block_max_idx, block_num_idx, grid_phys_mins,
+                    grid_step_size, eps, data_mins, data_maxs, glo_num_idx);
+
+    int nz = block_num_idx[2];
+    if (project)
+    {
+      if (block_min_idx[2]) // blocks not at z0 write 0 points
+        continue;
+      nz = 1;
+    }
+    if (glo_num_fields)
+      assert(dblocks[block]->num_fields == glo_num_fields);
+
+    for (int k = 0; k < nz; k++)
+      for (int j = 0; j < block_num_idx[1]; j++)
+      {
+        // global and local row-major index of the first grid point in the row
+        MPI_Offset glo_idx = ((MPI_Offset)(project ? 0 : block_min_idx[2] + k) * glo_num_idx[1] +
+                              block_min_idx[1] + j) * glo_num_idx[0] + block_min_idx[0];
+        size_t loc_idx = ((size_t)k * block_num_idx[1] + j) * block_num_idx[0];
+
+        grid_row_t row;
+        row.file_ofst = glo_idx * sizeof(float);
+        MPI_Get_address(&dblocks[block]->density[loc_idx], &row.mem_addr);
+        row.count = block_num_idx[0];
+        rows.push_back(row);
+
+        if (glo_num_fields)
+        {
+          row.file_ofst = glo_idx * glo_num_fields * sizeof(float);
+          MPI_Get_address(&dblocks[block]->fields[loc_idx * glo_num_fields], &row.mem_addr);
+          row.count = block_num_idx[0] * glo_num_fields;
+          field_rows.push_back(row);
+        }
+      }
+  }
+
+  // write
+  double t0 = MPI_Wtime();
+  WriteGridRows(outfile, rows, info, comm);
+  if (glo_num_fields)
+    WriteGridRows((string(outfile) + ".fields").c_str(), field_rows, info, comm);
+  grid_write_time += MPI_Wtime() - t0;
+  for (size_t i = 0; i < rows.size(); i++)
+    grid_write_bytes += rows[i].count * sizeof(float);
+  for (size_t i = 0; i < field_rows.size(); i++)
+    grid_write_bytes += field_rows[i].count * sizeof(float);
+
+  // cleanup
+  if (info != MPI_INFO_NULL)
+    MPI_Info_free(&info);
+  delete[] dblocks; // pointers to blocks, not the blocks themselves
+}
+
+// MPI-IO hints for collective grid output
+//
+// aggregators: number of I/O aggregator processes, 0 = MPI-IO default
+// stripe_size: file system stripe size in bytes, 0 = MPI-IO default
+//
+// returns: info object, or MPI_INFO_NULL if no hints were given; caller frees
+MPI_Info GridIOInfo(int aggregators,
+                    int stripe_size)
+{
+  if (!aggregators && !stripe_size)
+    return MPI_INFO_NULL;
+
+  MPI_Info info;
+  char val[32];
+  MPI_Info_create(&info);
+  MPI_Info_set(info, (char *)"romio_cb_write", (char *)"enable");
+  if (aggregators)
+  {
+    snprintf(val, sizeof(val), "%d", aggregators);
+    MPI_Info_set(info, (char *)"cb_nodes", val);
+  }
+  if (stripe_size)
+  {
+    // one stripe per aggregator buffer keeps each collective write stripe aligned
+    snprintf(val, sizeof(val), "%d", stripe_size);
+    MPI_Info_set(info, (char *)"striping_unit", val);
+    MPI_Info_set(info, (char *)"cb_buffer_size", val);
+    if (aggregators)
+    {
+      snprintf(val, sizeof(val), "%d", aggregators);
+      MPI_Info_set(info, (char *)"striping_factor", val);
+    }
+  }
+  return info;
+}
+
+// collectively write rows of floats at arbitrary file offsets with one call
+// adjacent rows that are contiguous both in the file and in memory are merged, up to 1 << 30
+// floats per run so that run lengths stay ints
+//
+// outfile: output file name
+// rows: rows to write, sorted in place by file offset
+// info: MPI-IO hints
+// comm: communicator
+void WriteGridRows(const char *outfile,
+                   vector<grid_row_t> &rows,
+                   MPI_Info info,
+                   MPI_Comm comm)
+{
+  MPI_File fd;
+  MPI_Status status;
+
+  std::sort(rows.begin(), rows.end(),
+            [](const grid_row_t& a, const grid_row_t& b) { return a.file_ofst < b.file_ofst; });
+
+  // merge contiguous runs
+  const int max_len = 1 << 30;
+  vector<int> lens;                         // run lengths in floats
+  vector<MPI_Aint> file_displs;             // file byte displacements
+  vector<MPI_Aint> mem_displs;              // absolute memory addresses
+  for (size_t i = 0; i < rows.size(); i++)
+  {
+    if (lens.size() &&
+        file_displs.back() + lens.back() * (MPI_Aint)sizeof(float) == rows[i].file_ofst &&
+        mem_displs.back() + lens.back() * (MPI_Aint)sizeof(float) == rows[i].mem_addr &&
+        lens.back() <= max_len - rows[i].count)
+      lens.back() += rows[i].count;
+    else
+    {
+      lens.push_back(rows[i].count);
+      file_displs.push_back(rows[i].file_ofst);
+      mem_displs.push_back(rows[i].mem_addr);
+    }
+  }
+
+  // open
+  int retval = MPI_File_open(comm, (char *)outfile, MPI_MODE_WRONLY | MPI_MODE_CREATE,
+                             info, &fd);
+  assert(retval == MPI_SUCCESS);
+  MPI_File_set_size(fd, 0); // start with an empty file every time
+
+  int errcode;
+  if (lens.size())
+  {
+    MPI_Datatype ftype, mtype;              // file and memory types
+    MPI_Type_create_hindexed(lens.size(), &lens[0], &file_displs[0], MPI_FLOAT, &ftype);
+    MPI_Type_commit(&ftype);
+    MPI_Type_create_hindexed(lens.size(), &lens[0], &mem_displs[0], MPI_FLOAT, &mtype);
+    MPI_Type_commit(&mtype);
+
+    MPI_File_set_view(fd, 0, MPI_FLOAT, ftype, (char *)"native", info);
+    errcode = MPI_File_write_all(fd, MPI_BOTTOM, 1, mtype, &status);
+
+    MPI_Type_free(&mtype);
+    MPI_Type_free(&ftype);
+  }
+  else // nothing to write, still participate in the collective
+  {
+    float unused;
+    MPI_File_set_view(fd, 0, MPI_FLOAT, MPI_FLOAT, (char *)"native", info);
+    errcode = MPI_File_write_all(fd, &unused, 0, MPI_FLOAT, &status);
+  }
+  if (errcode != MPI_SUCCESS)
+    handle_error(errcode, (char *)"MPI_File_write_all grid", comm);
+
+  MPI_File_close(&fd);
+}
+
+// write one chunked, compressed grid file (see grid_file_header_t)
+//
+// outfile: output file name
+// chunks: index entries of local chunks, with grid extents and gids filled in
+// vals: values of each local chunk, num_vals per grid point interleaved, row-major (x fastest)
+// num_vals: number of values per grid point
+// hdr_num_idx: global grid size (i,j,k) for the header
+// codec: compression codec
+// max_err: maximum absolute error per grid point for lossy codecs
+// comm: communicator
+static void WriteGridChunks(const char *outfile,
+                            vector<grid_chunk_t> chunks,
+                            const vector<const float*> &vals,
+                            int num_vals,
+                            int *hdr_num_idx,
+                            compress_t codec,
+                            float max_err,
+                            MPI_Comm comm)
+{
+  int rank, groupsize;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &groupsize);
+
+  // compress local chunks into one contiguous buffer
+  vector<char> data; // compressed chunks of all local blocks
+  for (size_t i = 0; i < chunks.size(); i++)
+  {
+    grid_chunk_t& chunk = chunks[i];
+    size_t nvals = (size_t)chunk.num_idx[0] * chunk.num_idx[1] * chunk.num_idx[2] * num_vals;
+
+    chunk.offset = data.size(); // relative to this rank's data until offsets are known
+    chunk.nbytes = compress_floats(vals[i], nvals, codec, max_err, data);
+
+    grid_raw_bytes += nvals * sizeof(float);
+    grid_file_bytes += chunk.nbytes;
+  }
+
+  // file offsets of this rank's data
+  unsigned long long nbytes = data.size(), ofst = 0;
+  MPI_Exscan(&nbytes, &ofst, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm);
+  if (rank == 0)
+    ofst = 0;
+  int nchunks = chunks.size(), tot_chunks;
+  MPI_Allreduce(&nchunks, &tot_chunks, 1, MPI_INT, MPI_SUM, comm);
+  uint64_t data_start = sizeof(grid_file_header_t) + tot_chunks * sizeof(grid_chunk_t);
+  for (size_t i = 0; i < chunks.size(); i++)
+    chunks[i].offset += data_start + ofst;
+
+  // gather the chunk index at rank 0
+  vector<int> counts(groupsize), displs(groupsize);
+  int chunk_bytes = nchunks * sizeof(grid_chunk_t);
+  MPI_Gather(&chunk_bytes, 1, MPI_INT, &counts[0], 1, MPI_INT, 0, comm);
+  vector<grid_chunk_t> all_chunks(rank == 0 ? tot_chunks : 0);
+  if (rank == 0)
+    for (int i = 1; i < groupsize; i++)
+      displs[i] = displs[i - 1] + counts[i - 1];
+  MPI_Gatherv(chunks.size() ? &chunks[0] : NULL, chunk_bytes, MPI_BYTE,
+              all_chunks.size() ? &all_chunks[0] : NULL, &counts[0], &displs[0], MPI_BYTE,
+              0, comm);
+
   // open
-  int retval = MPI_File_open(comm, (char *)outfile,
-			     MPI_MODE_WRONLY | MPI_MODE_CREATE,
-			     MPI_INFO_NULL, &fd);
+  MPI_File fd;
+  int retval = MPI_File_open(comm, (char *)outfile, MPI_MODE_WRONLY | MPI_MODE_CREATE,
+                             MPI_INFO_NULL, &fd);
   assert(retval == MPI_SUCCESS);
   MPI_File_set_size(fd, 0); // start with an empty file every time
 
+  // header and index
+  if (rank == 0)
+  {
+    std::sort(all_chunks.begin(), all_chunks.end(),
+              [](const grid_chunk_t& a, const grid_chunk_t& b) { return a.gid < b.gid; });
+
+    grid_file_header_t header;
+    memset(&header, 0, sizeof(grid_file_header_t));
+    memcpy(header.magic, GRID_FILE_MAGIC, sizeof(header.magic));
+    header.version = GRID_FILE_VERSION;
+    header.glo_num_idx[0] = hdr_num_idx[0];
+    header.glo_num_idx[1] = hdr_num_idx[1];
+    header.glo_num_idx[2] = hdr_num_idx[2];
+    header.num_chunks = tot_chunks;
+    header.codec = codec;
+    header.max_err = max_err;
+    header.num_vals = num_vals;
+
+    MPI_Status status;
+    int errcode = MPI_File_write_at(fd, 0, &header, sizeof(grid_file_header_t), MPI_BYTE,
+                                    &status);
+    if (errcode != MPI_SUCCESS)
+      handle_error(errcode, (char *)"MPI_File_write_at grid header", comm);
+    if (tot_chunks)
+      errcode = MPI_File_write_at(fd, sizeof(grid_file_header_t), &all_chunks[0],
+                                  tot_chunks * sizeof(grid_chunk_t), MPI_BYTE, &status);
+    if (errcode != MPI_SUCCESS)
+      handle_error(errcode, (char *)"MPI_File_write_at grid index", comm);
+  }
+
+  // chunks, collective writes for all local blocks
+  // MPI counts are ints: ranks with more than INT_MAX bytes write in pieces, and all ranks
+  // join as many collectives as the rank with the most pieces
+  unsigned long long max_write = std::numeric_limits<int>::max();
+  unsigned long long nwrites = (nbytes + max_write - 1) / max_write, max_nwrites;
+  MPI_Allreduce(&nwrites, &max_nwrites, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, comm);
+  MPI_Status status;
+  double t0 = MPI_Wtime();
+  for (unsigned long long w = 0; w < max_nwrites; w++)
+  {
+    unsigned long long lo = std::min(w * max_write, nbytes);
+    int count = std::min(max_write, nbytes - lo);
+    int errcode = MPI_File_write_at_all(fd, data_start + ofst + lo, count ? &data[lo] : NULL,
+                                        count, MPI_BYTE, &status);
+    if (errcode != MPI_SUCCESS)
+      handle_error(errcode, (char *)"MPI_File_write_at_all grid chunks", comm);
+  }
+  grid_write_time += MPI_Wtime() - t0;
+  grid_write_bytes += nbytes;
+
+  MPI_File_close(&fd);
+}
+
+// write density grid as a chunked, compressed file (see grid_file_header_t)
+// each block is one chunk; for projected grids, only blocks at z = 0 write chunks
+// attribute fields, if any, go to outfile.fields in the same format with num_fields values
+// per grid point, as in WriteGrid; they are not projected
+//
+// tblocks: total (global) number of blocks
+// outfile: output file name
+// project: whether to project to 2D
+// glo_num_idx: global number of grid points (i,j,k)
+// eps: floating point error tolerance
+// data_mins, data_maxs: data global physical extents (x,y,z)
+// num_fiven_bounds: number of given extents
+// given_mins, given_maxs: given global data extents (x,y,z)
+// codec: compression codec
+// max_err: maximum absolute error per grid point for lossy codecs
+// master: diy master object
+// assigner: diy assigner object
+void WriteGridCompressed(int tblocks,
+                         char *outfile,
+                         bool project,
+                         int *glo_num_idx,
+                         float eps,
+                         float *data_mins,
+                         float *data_maxs,
+                         int num_given_bounds,
+                         float *given_mins,
+                         float *given_maxs,
+                         compress_t codec,
+                         float max_err,
+                         diy::Master& master,
+                         diy::Assigner& assigner)
+{
+  MPI_Comm comm = master.communicator();
+
   // global grid parameters
   float grid_phys_mins[3], grid_phys_maxs[3]; // global grid extents
   float grid_step_size[3]; // physical grid space size
@@ -795,78 +1350,167 @@ void WriteGrid(int mblocks,
     ProjectGrid(tblocks, glo_num_idx, eps, data_mins, data_maxs,
                 grid_phys_mins, grid_step_size, master, assigner);
 
-  // write
-  for (int block = 0; block < mblocks; block++)
+  // attribute fields
+  int num_fields = 0;                       // number of fields in any local block
+  int glo_num_fields;                       // number of fields in any block
+  for (int i = 0; i < (int)master.size(); i++)
+    num_fields = std::max(num_fields, master.block<DBlock>(i)->num_fields);
+  MPI_Allreduce(&num_fields, &glo_num_fields, 1, MPI_INT, MPI_MAX, comm);
+  if (glo_num_fields && project)
   {
-    if (block < nblocks) // non-null block
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    if (rank == 0)
+      fprintf(stderr, "Warning: attribute fields are not projected to 2D and will not be written\n");
+    glo_num_fields = 0;
+  }
+
+  // one chunk per local block
+  // NB: all blocks need to be in memory
+  vector<grid_chunk_t> chunks; // index entries of local blocks
+  vector<const float*> density, fields;
+  for (int i = 0; i < (int)master.size(); i++)
+  {
+    DBlock* b = master.block<DBlock>(i);
+
+    grid_chunk_t chunk;
+    memset(&chunk, 0, sizeof(grid_chunk_t));
+    int block_max_idx[3];
+    BlockGridParams(b, chunk.min_idx, block_max_idx, chunk.num_idx, grid_phys_mins,
+                    grid_step_size, eps, data_mins, data_maxs, glo_num_idx);
+    if (project)
     {
-      int num_pts; // total number of points per block
+      if (chunk.min_idx[2]) // blocks not at z0 write nothing
+        continue;
+      chunk.num_idx[2] = 1;
+    }
+    if (glo_num_fields)
+      assert(b->num_fields == glo_num_fields);
 
-      // local block grid parameters
-      int block_min_idx[3]; // global grid index of block minimum grid point
-      int block_max_idx[3]; // global grid index of block maximum grid point
-      int block_num_idx[3]; // number of grid points in local block
-      BlockGridParams(dblocks[block], block_min_idx, block_max_idx, block_num_idx, grid_phys_mins,
-                      grid_step_size, eps, data_mins, data_maxs, glo_num_idx);
+    chunk.gid = b->gid;
+    chunks.push_back(chunk);
+    density.push_back(b->density);
+    fields.push_back(b->fields);
+  }
 
-      if (project)
-      {
-	// reversed order intentional
-	sizes[0] = glo_num_idx[1];
-	sizes[1] = glo_num_idx[0];
-	starts[0] = block_min_idx[1];
-	starts[1] = block_min_idx[0];
-	subsizes[0] = block_num_idx[1];
-	subsizes[1] = block_num_idx[0];
-
-	MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_FLOAT, &dtype);
-	MPI_Type_commit(&dtype);
-	MPI_File_set_view(fd, 0, MPI_FLOAT, dtype, (char *)"native", MPI_INFO_NULL);
-
-        // blocks not at z0 write 0 points
-	num_pts = block_min_idx[2] ? 0 : block_num_idx[0] * block_num_idx[1];
-      }
-      else
-      {
-	// reversed order intentional
-	sizes[0] = glo_num_idx[2];
-	sizes[1] = glo_num_idx[1];
-	sizes[2] = glo_num_idx[0];
-	starts[0] = block_min_idx[2];
-	starts[1] = block_min_idx[1];
-	starts[2] = block_min_idx[0];
-	subsizes[0] = block_num_idx[2];
-	subsizes[1] = block_num_idx[1];
-	subsizes[2] = block_num_idx[0];
-
-	MPI_Type_create_subarray(3, sizes, subsizes, starts, MPI_ORDER_C, MPI_FLOAT, &dtype);
-	MPI_Type_commit(&dtype);
-	MPI_File_set_view(fd, 0, MPI_FLOAT, dtype, (char *)"native", MPI_INFO_NULL);
-
-	num_pts = block_num_idx[0] * block_num_idx[1] * block_num_idx[2];
-      }
+  int hdr_num_idx[3] = { glo_num_idx[0], glo_num_idx[1], project ? 1 : glo_num_idx[2] };
+  WriteGridChunks(outfile, chunks, density, 1, hdr_num_idx, codec, max_err, comm);
+  if (glo_num_fields)
+    WriteGridChunks((string(outfile) + ".fields").c_str(), chunks, fields, glo_num_fields,
+                    hdr_num_idx, codec, max_err, comm);
+}
 
-      // write block
-      int errcode = MPI_File_write_all(fd, dblocks[block]->density, num_pts, MPI_FLOAT, &status);
-      if (errcode != MPI_SUCCESS)
-	handle_error(errcode, (char *)"MPI_File_write_all nonempty datatype", comm);
-      MPI_Get_count(&status, MPI_FLOAT, &pts_written);
-      assert(pts_written == num_pts);
+// read the header and chunk index of a compressed grid file
+// serial; intended for postprocessing tools
+//
+// infile: input file name
+// header: file header (output)
+// chunks: chunk index (output)
+//
+// returns: whether the file was read successfully
+bool ReadGridIndex(const char *infile,
+                   grid_file_header_t &header,
+                   vector<grid_chunk_t> &chunks)
+{
+  FILE *fd = fopen(infile, "rb");
+  if (!fd)
+  {
+    fprintf(stderr, "Error: unable to open grid file %s\n", infile);
+    return false;
+  }
+
+  bool ok = fread(&header, sizeof(grid_file_header_t), 1, fd) == 1 &&
+    !memcmp(header.magic, GRID_FILE_MAGIC, sizeof(header.magic)) &&
+    header.version == GRID_FILE_VERSION;
+  if (ok)
+  {
+    if (!header.num_vals)     // written before num_vals: density only
+      header.num_vals = 1;
+    chunks.resize(header.num_chunks);
+    ok = header.num_chunks == 0 ||
+      fread(&chunks[0], sizeof(grid_chunk_t), header.num_chunks, fd) == (size_t)header.num_chunks;
+  }
+  if (!ok)
+    fprintf(stderr, "Error: %s is not a valid grid file\n", infile);
+
+  fclose(fd);
+  return ok;
+}
+
+// read a subregion of a compressed grid file
+// only the chunks intersecting the region are read and decompressed
+// serial; intended for postprocessing tools
+//
+// infile: input file name
+// min_idx, max_idx: global grid index of region minimum and maximum grid points, inclusive
+// region: region values in row-major order (x fastest), header.num_vals per grid point
+//   interleaved, allocated by caller (output)
+//
+// returns: whether the region was read successfully
+bool ReadGridRegion(const char *infile,
+                    int *min_idx,
+                    int *max_idx,
+                    float *region)
+{
+  grid_file_header_t header;
+  vector<grid_chunk_t> chunks;
+  if (!ReadGridIndex(infile, header, chunks))
+    return false;
+
+  size_t nv = header.num_vals;   // values per grid point
+  int num_idx[3]; // size of region
+  for (int i = 0; i < 3; i++)
+    num_idx[i] = max_idx[i] - min_idx[i] + 1;
+  memset(region, 0, (size_t)num_idx[0] * num_idx[1] * num_idx[2] * nv * sizeof(float));
+
+  FILE *fd = fopen(infile, "rb");
+  if (!fd)
+    return false;
+
+  vector<char> in;                          // compressed chunk
+  vector<float> vals;                       // decompressed chunk
+  for (size_t c = 0; c < chunks.size(); c++)
+  {
+    grid_chunk_t& chunk = chunks[c];
 
-      MPI_Type_free(&dtype);
+    // intersection of chunk and region
+    int lo[3], hi[3];
+    bool overlap = true;
+    for (int i = 0; i < 3; i++)
+    {
+      lo[i] = std::max(min_idx[i], chunk.min_idx[i]);
+      hi[i] = std::min(max_idx[i], chunk.min_idx[i] + chunk.num_idx[i] - 1);
+      if (lo[i] > hi[i])
+        overlap = false;
     }
+    if (!overlap)
+      continue;
 
-    else // null block
+    in.resize(chunk.nbytes);
+    vals.resize((size_t)chunk.num_idx[0] * chunk.num_idx[1] * chunk.num_idx[2] * nv);
+    if (fseek(fd, chunk.offset, SEEK_SET) ||
+        (chunk.nbytes && fread(&in[0], 1, chunk.nbytes, fd) != chunk.nbytes) ||
+        !decompress_floats(chunk.nbytes ? &in[0] : NULL, chunk.nbytes, &vals[0], vals.size()))
     {
-      float unused;
-      MPI_File_set_view(fd, 0, MPI_FLOAT, MPI_FLOAT, (char *)"native", MPI_INFO_NULL);
-      MPI_File_write_all(fd, &unused, 0, MPI_FLOAT, &status);
+      fprintf(stderr, "Error: corrupt chunk for block %d in %s\n", chunk.gid, infile);
+      fclose(fd);
+      return false;
     }
+
+    // copy the intersecting rows
+    for (int k = lo[2]; k <= hi[2]; k++)
+      for (int j = lo[1]; j <= hi[1]; j++)
+      {
+        size_t src = ((size_t)(k - chunk.min_idx[2]) * chunk.num_idx[1] +
+                      (j - chunk.min_idx[1])) * chunk.num_idx[0] + (lo[0] - chunk.min_idx[0]);
+        size_t dst = ((size_t)(k - min_idx[2]) * num_idx[1] +
+                      (j - min_idx[1])) * num_idx[0] + (lo[0] - min_idx[0]);
+        memcpy(&region[dst * nv], &vals[src * nv], (hi[0] - lo[0] + 1) * nv * sizeof(float));
+      }
   }
 
-  // cleanup
-  MPI_File_close(&fd);
-  delete[] dblocks; // pointers to blocks, not the blocks themselves
+  fclose(fd);
+  return true;
 }
 
 // project density to 2d
@@ -1294,8 +1938,15 @@ void dense_stats(double *times,
   float glo_max_dense = 0; // global max density
   double glo_tot_mass = 0; // global total mass
   float glo_check_mass = 0; // global reference total mass
+  double glo_grid_bytes[2] = { 0.0, 0.0 }; // global raw and compressed grid size
 
   MPI_Reduce(&max_dense, &glo_max_dense, 1, MPI_FLOAT, MPI_MAX, 0, comm);
+  double grid_bytes[2] = { grid_raw_bytes, grid_file_bytes };
+  MPI_Reduce(grid_bytes, glo_grid_bytes, 2, MPI_DOUBLE, MPI_SUM, 0, comm);
+  double glo_write_bytes = 0.0; // global bytes of grid output
+  double max_write_time = 0.0; // slowest process grid write time
+  MPI_Reduce(&grid_write_bytes, &glo_write_bytes, 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+  MPI_Reduce(&grid_write_time, &max_write_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
   MPI_Reduce(&tot_mass, &glo_tot_mass, 1, MPI_DOUBLE, MPI_SUM, 0, comm);
   MPI_Reduce(&check_mass, &glo_check_mass, 1, MPI_FLOAT, MPI_SUM, 0, comm);
 
@@ -1328,6 +1979,14 @@ void dense_stats(double *times,
     fprintf(stderr, "%.3lf s input + %.3lf s density computation + "
 	    "%.3lf s output\n",
 	    times[INPUT_TIME], times[COMP_TIME], times[OUTPUT_TIME]);
+    if (max_write_time > 0.0)
+      fprintf(stderr, "Grid write = %.3lf MB in %.3lf s = %.3lf MB/s\n",
+              glo_write_bytes / 1048576.0, max_write_time,
+              glo_write_bytes / 1048576.0 / max_write_time);
+    if (glo_grid_bytes[1] > 0.0)
+      fprintf(stderr, "Compressed grid = %.3lf MB of %.3lf MB (ratio %.2lf)\n",
+              glo_grid_bytes[1] / 1048576.0, glo_grid_bytes[0] / 1048576.0,
+              glo_grid_bytes[0] / glo_grid_bytes[1]);
     fprintf(stderr, "-----------------------------------\n");
   }
 }
@@ -1416,14 +2075,14 @@ int CellGridPts(float *cell_mins,
 
   if (!alloc_grid_pts)
   {
-    grid_pts = (grid_pt_t *)malloc(npts * sizeof(grid_pt_t));
-    border = (int *)malloc(npts * 2 * sizeof(int)); // more than large enough
+    grid_pts = (grid_pt_t *)tess_malloc(npts * sizeof(grid_pt_t), MEM_DENSITY);
+    border = (int *)tess_malloc((size_t)npts * 2 * sizeof(int), MEM_DENSITY); // more than large enough
     alloc_grid_pts = npts;
   }
   else if (npts > alloc_grid_pts)
   {
-    grid_pts = (grid_pt_t *)realloc(grid_pts, npts * sizeof(grid_pt_t));
-    border = (int *)realloc(border, npts * sizeof(grid_pt_t));
+    grid_pts = (grid_pt_t *)tess_realloc(grid_pts, npts * sizeof(grid_pt_t), MEM_DENSITY);
+    border = (int *)tess_realloc(border, npts * sizeof(grid_pt_t), MEM_DENSITY);
     alloc_grid_pts = npts;
   }
   memset(grid_pts, 0 , npts * sizeof(grid_pt_t));
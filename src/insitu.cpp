@@ -0,0 +1,324 @@
+#include <algorithm>
+#include <limits.h>
+#include <assert.h>
+
+#include "tess/insitu.hpp"
+#include "tess/dense.hpp"
+
+// in situ interface
+//
+// a run reads the registered arrays (the only copy, straight into the block arrays, which the
+// redistribution and the serial Delaunay libraries need in the interleaved layout, and which the
+// simulation may overwrite as soon as tess_insitu_run() returns) into empty blocks of a regular
+// decomposition, and then redistributes them to their owners and tessellates as tess() does
+//
+// the master of a run, and so the blocks the callback sees, lives until the next run
+
+TessInSitu::TessInSitu(MPI_Comm comm,
+                       const tess_insitu_params_t& params):
+    params_(params),
+    async_(params.async),
+    n_(0),
+    master_(NULL),
+    assigner_(NULL),
+    busy_(false)
+{
+    // collectives of a helper thread must not match those of the simulation
+    MPI_Comm_dup(comm, &comm_);
+    int rank, size;
+    MPI_Comm_rank(comm_, &rank);
+    MPI_Comm_size(comm_, &size);
+
+    if (async_)
+    {
+        int provided;
+        MPI_Query_thread(&provided);
+        if (provided < MPI_THREAD_MULTIPLE)
+        {
+            if (rank == 0)
+                fprintf(stderr, "Warning: asynchronous in situ tessellation needs "
+                        "MPI_THREAD_MULTIPLE; running synchronously\n");
+            async_ = false;
+        }
+    }
+
+    for (int d = 0; d < 3; ++d)
+    {
+        coords_[d].x      = NULL;
+        coords_[d].stride = sizeof(float);
+    }
+    assigner_ = new diy::RoundRobinAssigner(size, size * std::max(1, params_.blocks_per_proc));
+}
+
+TessInSitu::~TessInSitu()
+{
+    wait();
+    delete master_;
+    delete assigner_;
+    MPI_Comm_free(&comm_);
+}
+
+void
+TessInSitu::particles(const float* x,
+                      const float* y,
+                      const float* z,
+                      size_t n,
+                      size_t stride)
+{
+    n_ = n;
+    coords_[0].x = x;
+    coords_[1].x = y;
+    coords_[2].x = z;
+    for (int d = 0; d < 3; ++d)
+        coords_[d].stride = stride;
+}
+
+int
+TessInSitu::attribute(const float* attr,
+                      size_t stride)
+{
+    if (attrs_.size() >= MAX_ATTRS)
+        return -1;
+    Array a;
+    a.x      = attr;
+    a.stride = stride;
+    attrs_.push_back(a);
+    return attrs_.size() - 1;
+}
+
+void
+TessInSitu::run(int step)
+{
+    wait();
+
+    // blocks of the previous run
+    delete master_;
+    master_ = new diy::Master(diy::mpi::communicator(comm_),
+                              params_.threads,
+                              -1,
+                              &create_block,
+                              &destroy_block);
+
+    int rank;
+    MPI_Comm_rank(comm_, &rank);
+
+    diy::ContinuousBounds domain(3);
+    for (int d = 0; d < 3; ++d)
+    {
+        domain.min[d] = params_.domain_min[d];
+        domain.max[d] = params_.domain_max[d];
+    }
+    AddEmpty create(*master_);
+    diy::RegularDecomposer<diy::ContinuousBounds>::BoolVector          wraps;
+    diy::RegularDecomposer<diy::ContinuousBounds>::BoolVector          share_face;
+    diy::RegularDecomposer<diy::ContinuousBounds>::CoordinateVector    ghosts;
+    if (params_.wrap)
+        wraps.assign(3, true);
+    diy::decompose(3, rank, domain, *assigner_, create, share_face, wraps, ghosts);
+
+    // the particles of the process, in equal shares over its blocks, wherever they are:
+    // the redistribution sends them to their owners
+    size_t nb = master_->size();
+    int    na = attrs_.size();
+    for (size_t i = 0; i < nb; ++i)
+    {
+        DBlock* b     = master_->block<DBlock>(i);
+        size_t  begin = n_ * i / nb;
+        size_t  end   = n_ * (i + 1) / nb;
+        assert(end - begin <= INT_MAX / 3);
+        int     np    = end - begin;
+
+        b->particles = np ? (float*)tess_malloc((size_t)3 * np * sizeof(float),
+                                                   MEM_PARTICLES) : NULL;
+        for (int d = 0; d < 3; ++d)
+            for (int p = 0; p < np; ++p)
+                b->particles[3 * p + d] = coords_[d][begin + p];
+
+        b->num_attrs = na;
+        b->attrs     = na && np ? (float*)tess_malloc((size_t)na * np * sizeof(float),
+                                                         MEM_PARTICLES) : NULL;
+        for (int k = 0; k < na; ++k)
+            for (int p = 0; p < np; ++p)
+                b->attrs[na * p + k] = attrs_[k][begin + p];
+
+        b->num_particles      = np;
+        b->num_orig_particles = np;
+    }
+
+    if (async_)
+    {
+        busy_   = true;
+        thread_ = std::thread(&TessInSitu::compute, this, step);
+    }
+    else
+        compute(step);
+}
+
+void
+TessInSitu::wait()
+{
+    if (thread_.joinable())
+        thread_.join();
+    busy_ = false;
+}
+
+void
+TessInSitu::compute(int step)
+{
+    diy::Master& master = *master_;
+    MPI_Comm     comm   = master.communicator();
+
+    tess_insitu_result_t result = tess_insitu_result_t();
+    result.step = step;
+
+    double times[TESS_MAX_TIMES];
+    timing(times, -1, -1, master.communicator());
+
+    // redistribute and tessellate
+    double start = MPI_Wtime();
+    if (params_.decomposition == TESS_INSITU_KDTREE)
+        tess_kdtree_exchange(master, *assigner_, times, params_.wrap);
+    else if (params_.decomposition == TESS_INSITU_SFC)
+        tess_sfc_exchange(master, *assigner_, times, params_.wrap);
+    else
+        tess_direct_exchange(master, *assigner_, times);     // all blocks are in memory
+    quants_t quants;
+    result.rounds    = tess(master, quants, times);
+    result.tess_time = MPI_Wtime() - start;
+
+    // density on a grid over the domain
+    if (params_.grid[0] > 0)
+    {
+        start = MPI_Wtime();
+        float given_mins[3], given_maxs[3];
+        float data_mins[3], data_maxs[3];
+        float grid_max[3];
+        float proj_plane[3] = { 0.0, 0.0, 1.0 };
+        int   grid[3];
+        int   field_attrs[MAX_ATTRS];
+        for (int d = 0; d < 3; ++d)
+        {
+            given_mins[d] = params_.domain_min[d];
+            given_maxs[d] = params_.domain_max[d];
+            grid[d]       = params_.grid[d];
+        }
+        for (int k = 0; k < params_.num_fields; ++k)
+            field_attrs[k] = params_.field_attrs[k];
+        dense(params_.cic ? DENSE_CIC : DENSE_TESS, 3, given_mins, given_maxs, false, proj_plane,
+              params_.mass, data_mins, data_maxs, result.grid_min, grid_max, result.grid_step,
+              0.0001, grid, master, params_.mass_attr, params_.num_fields, field_attrs);
+        result.dense_time = MPI_Wtime() - start;
+    }
+
+    long long counts[2] = { 0, 0 };
+    std::vector<dblock_t*> blocks(master.size());
+    for (size_t i = 0; i < master.size(); ++i)
+    {
+        blocks[i]  = master.block<DBlock>(i);
+        counts[0] += blocks[i]->num_orig_particles;
+        counts[1] += blocks[i]->num_tets;
+    }
+    MPI_Allreduce(MPI_IN_PLACE, counts, 2, MPI_LONG_LONG, MPI_SUM, comm);
+    result.particles  = counts[0];
+    result.tets       = counts[1];
+    result.num_blocks = blocks.size();
+    result.blocks     = blocks.empty() ? NULL : &blocks[0];
+
+    if (callback_)
+        callback_(master, result);
+    busy_ = false;
+}
+
+// C interface
+
+struct tess_insitu_t
+{
+    tess_insitu_t(MPI_Comm comm,
+                  const tess_insitu_params_t& params):
+        insitu(comm, params)                                            {}
+
+    TessInSitu insitu;
+};
+
+void tess_insitu_default_params(tess_insitu_params_t* params)
+{
+    for (int d = 0; d < 3; ++d)
+    {
+        params->domain_min[d] = 0.0;
+        params->domain_max[d] = 1.0;
+        params->grid[d]       = 0;
+    }
+    params->wrap            = 0;
+    params->blocks_per_proc = 1;
+    params->decomposition   = TESS_INSITU_REGULAR;
+    params->threads         = 1;
+    params->async           = 0;
+    params->cic             = 0;
+    params->mass            = 1.0;
+    params->mass_attr       = -1;
+    params->num_fields      = 0;
+    for (int k = 0; k < MAX_ATTRS; ++k)
+        params->field_attrs[k] = 0;
+}
+
+tess_insitu_t* tess_insitu_create(MPI_Comm comm,
+                                  const tess_insitu_params_t* params)
+{
+    return new tess_insitu_t(comm, *params);
+}
+
+void tess_insitu_destroy(tess_insitu_t* ts)
+{
+    delete ts;
+}
+
+void tess_insitu_particles(tess_insitu_t* ts,
+                           const float* x,
+                           const float* y,
+                           const float* z,
+                           size_t n,
+                           size_t stride)
+{
+    ts->insitu.particles(x, y, z, n, stride);
+}
+
+int tess_insitu_attribute(tess_insitu_t* ts,
+                          const float* attr,
+                          size_t stride)
+{
+    return ts->insitu.attribute(attr, stride);
+}
+
+void tess_insitu_clear_attributes(tess_insitu_t* ts)
+{
+    ts->insitu.clear_attributes();
+}
+
+void tess_insitu_callback(tess_insitu_t* ts,
+                          tess_insitu_callback_t callback,
+                          void* user)
+{
+    if (!callback)
+    {
+        ts->insitu.callback(TessInSitu::Callback());
+        return;
+    }
+    ts->insitu.callback([callback, user](diy::Master&, const tess_insitu_result_t& result)
+                        { callback(&result, user); });
+}
+
+void tess_insitu_run(tess_insitu_t* ts,
+                     int step)
+{
+    ts->insitu.run(step);
+}
+
+void tess_insitu_wait(tess_insitu_t* ts)
+{
+    ts->insitu.wait();
+}
+
+int tess_insitu_busy(tess_insitu_t* ts)
+{
+    return ts->insitu.busy();
+}
@@ -0,0 +1,360 @@
+// ---------------------------------------------------------------------------
+//
+//   memory accounting by category
+//
+//   the library allocates block arrays with tess_malloc() / tess_realloc() / tess_free()
+//   and registers memory it does not allocate itself (new[] grids, the CGAL triangulation,
+//   exchange buffers, diy queues) with tess_mem_track() / tess_mem_untrack()
+//
+//   with MEMORY, every tracked pointer is kept in a table with its size and category, and
+//   the current and peak bytes of each category are updated on every call; without
+//   MEMORY the functions fall through to malloc, realloc, and free
+//
+//   pointers the library did not allocate (e.g., particles from user code) are simply not
+//   in the table: freeing them does not change the counts, and reallocating them starts
+//   tracking them
+//
+//   the arrays the tessellation rebuilds every round (tets, vert_to_tet, ghost particles) are
+//   grown with tess_reserve(), which keeps an allocation that is large enough already and
+//   otherwise grows it geometrically, so that a block reuses its arrays from round to round;
+//   temporaries of a round come from the scratch arena of the thread (tess_scratch_alloc()),
+//   a bump allocator rewound to a mark at the end of the round, whose chunks are kept; a thread
+//   borrows its arena from a pool and returns it when it exits, so the short-lived worker
+//   threads of successive rounds reuse the same arenas
+//
+// --------------------------------------------------------------------------
+#include <stdlib.h>
+#include <stdio.h>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+#include <cstddef>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#define TESS_ALLOC_SIZE(p)  malloc_usable_size(p)
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#define TESS_ALLOC_SIZE(p)  malloc_size(p)
+#else
+#define TESS_ALLOC_SIZE(p)  ((size_t)0)     // unknown: tess_reserve() reallocates to the size
+#endif
+
+#include "tess/tess.h"
+
+#define TESS_SCRATCH_CHUNK  (1 << 20)       // bytes; smallest scratch chunk
+
+#ifdef MEMORY
+
+struct mem_entry_t
+{
+    size_t size;
+    int    category;
+};
+
+static std::mutex                               mem_mutex;
+static std::unordered_map<void*, mem_entry_t>   mem_table;
+static double                                   mem_current[TESS_NUM_MEM];
+static double                                   mem_peak[TESS_NUM_MEM];
+static double                                   mem_total_peak;
+
+static const char* mem_names[TESS_NUM_MEM] =
+    { "particles", "tets", "vert_to_tet", "density", "exchange", "backend", "scratch" };
+
+// updates the counts; caller holds mem_mutex
+static void mem_add(int category,
+                    double bytes)
+{
+    mem_current[category] += bytes;
+    mem_peak[category]     = std::max(mem_peak[category], mem_current[category]);
+
+    double total = 0;
+    for (int i = 0; i < TESS_NUM_MEM; i++)
+        total += mem_current[i];
+    mem_total_peak = std::max(mem_total_peak, total);
+}
+
+static void mem_insert(void* p,
+                       size_t size,
+                       int category)
+{
+    std::lock_guard<std::mutex> lock(mem_mutex);
+    std::unordered_map<void*, mem_entry_t>::iterator it = mem_table.find(p);
+    if (it != mem_table.end())
+    {
+        mem_add(it->second.category, -(double)it->second.size);
+        mem_table.erase(it);
+    }
+    if (!p)
+        return;
+    mem_entry_t e = { size, category };
+    mem_table[p]  = e;
+    mem_add(category, (double)size);
+}
+
+static void mem_erase(void* p)
+{
+    std::lock_guard<std::mutex> lock(mem_mutex);
+    std::unordered_map<void*, mem_entry_t>::iterator it = mem_table.find(p);
+    if (it == mem_table.end())
+        return;
+    mem_add(it->second.category, -(double)it->second.size);
+    mem_table.erase(it);
+}
+
+#endif // MEMORY
+
+// malloc, accounted to category
+void* tess_malloc(size_t size,
+                  int category)
+{
+    void* p = malloc(size);
+#ifdef MEMORY
+    mem_insert(p, size, category);
+#endif
+    return p;
+}
+
+// realloc, accounted to category
+void* tess_realloc(void* p,
+                   size_t size,
+                   int category)
+{
+#ifdef MEMORY
+    if (p)
+        mem_erase(p);
+    void* q = realloc(p, size);
+    if (q && size)
+        mem_insert(q, size, category);
+    return q;
+#else
+    return realloc(p, size);
+#endif
+}
+
+// free of any pointer, tracked or not
+void tess_free(void* p)
+{
+#ifdef MEMORY
+    if (p)
+        mem_erase(p);
+#endif
+    free(p);
+}
+
+// grows an allocation of malloc to hold at least size bytes; keeps the contents
+// returns p itself when its allocation is large enough already, otherwise reallocates it to at
+// least 1.5 times its current size, so that an array grown repeatedly is copied O(log n) times
+// p must not alias block storage (see make_writable())
+void* tess_reserve(void* p,
+                   size_t size,
+                   int category)
+{
+    size_t capacity = p ? TESS_ALLOC_SIZE(p) : 0;
+    if (p && size <= capacity)
+        return p;
+    return tess_realloc(p, std::max(size, capacity + capacity / 2), category);
+}
+
+// scratch arena: chunks of doubling size, used in order and kept for the next rounds
+struct scratch_arena_t
+{
+    scratch_arena_t():
+        chunk(-1), offset(0)                        {}
+    ~scratch_arena_t()
+    {
+        for (size_t i = 0; i < chunks.size(); i++)
+            tess_free(chunks[i]);
+    }
+
+    std::vector<char*>  chunks;
+    std::vector<size_t> sizes;
+    int                 chunk;              // current chunk, -1 before the first allocation
+    size_t              offset;             // bytes used in the current chunk
+};
+
+// arenas not lent to a thread; they outlive the threads, which diy creates anew for every
+// foreach, and are freed at exit
+struct scratch_pool_t
+{
+    ~scratch_pool_t()
+    {
+        for (size_t i = 0; i < arenas.size(); i++)
+            delete arenas[i];
+    }
+
+    std::mutex                      mutex;
+    std::vector<scratch_arena_t*>   arenas;
+};
+
+static scratch_pool_t scratch_pool;
+
+// the arena lent to a thread: taken from the pool (or made) on first use, and returned to the
+// pool, rewound, when the thread exits
+struct scratch_lease_t
+{
+    scratch_lease_t():
+        arena(NULL)                                 {}
+    ~scratch_lease_t()
+    {
+        if (!arena)
+            return;
+        arena->chunk  = -1;
+        arena->offset = 0;
+        std::lock_guard<std::mutex> lock(scratch_pool.mutex);
+        scratch_pool.arenas.push_back(arena);
+    }
+
+    scratch_arena_t& get()
+    {
+        if (!arena)
+        {
+            std::lock_guard<std::mutex> lock(scratch_pool.mutex);
+            if (scratch_pool.arenas.empty())
+                arena = new scratch_arena_t;
+            else
+            {
+                arena = scratch_pool.arenas.back();
+                scratch_pool.arenas.pop_back();
+            }
+        }
+        return *arena;
+    }
+
+    scratch_arena_t*    arena;
+};
+
+static thread_local scratch_lease_t scratch;
+
+// allocates size bytes, aligned for any type, from the scratch arena of the calling thread
+// the memory is valid until the arena is released to a mark taken before this call; it is
+// never freed individually
+void* tess_scratch_alloc(size_t size)
+{
+    const size_t align = alignof(std::max_align_t);
+    size = (size + align - 1) / align * align;
+
+    scratch_arena_t& a = scratch.get();
+    if (a.chunk < 0 || a.offset + size > a.sizes[a.chunk])
+    {
+        // chunks past the current one are unused; replace the next one if it is too small
+        size_t c    = a.chunk + 1;
+        size_t need = std::max(size, c ? 2 * a.sizes[c - 1] : (size_t)TESS_SCRATCH_CHUNK);
+        if (c == a.chunks.size())
+        {
+            a.chunks.push_back(NULL);
+            a.sizes.push_back(0);
+        }
+        if (a.sizes[c] < size)
+        {
+            tess_free(a.chunks[c]);
+            a.chunks[c] = (char*)tess_malloc(need, MEM_SCRATCH);
+            a.sizes[c]  = a.chunks[c] ? need : 0;
+            if (!a.chunks[c])
+                return NULL;
+        }
+        a.chunk  = c;
+        a.offset = 0;
+    }
+
+    void* p   = a.chunks[a.chunk] + a.offset;
+    a.offset += size;
+    return p;
+}
+
+// current position of the scratch arena of the calling thread
+struct tess_scratch_mark_t tess_scratch_mark(void)
+{
+    scratch_arena_t&           a    = scratch.get();
+    struct tess_scratch_mark_t mark = { a.chunk, a.offset };
+    return mark;
+}
+
+// frees everything allocated from the scratch arena of the calling thread since mark
+// once the arena is empty, several chunks are merged into one of their total size, so that a
+// thread settles on a single chunk large enough for its rounds
+void tess_scratch_release(struct tess_scratch_mark_t mark)
+{
+    scratch_arena_t& a = scratch.get();
+    a.chunk  = mark.chunk;
+    a.offset = mark.offset;
+
+    if (a.chunk < 0 && a.chunks.size() > 1)
+    {
+        size_t total = 0;
+        for (size_t i = 0; i < a.chunks.size(); i++)
+        {
+            total += a.sizes[i];
+            tess_free(a.chunks[i]);
+        }
+        a.chunks.assign(1, (char*)tess_malloc(total, MEM_SCRATCH));
+        a.sizes.assign(1, a.chunks[0] ? total : 0);
+    }
+}
+
+// accounts size bytes at p, allocated by other means, to category; replaces an earlier size of p
+void tess_mem_track(void* p,
+                    size_t size,
+                    int category)
+{
+#ifdef MEMORY
+    mem_insert(p, size, category);
+#endif
+}
+
+// stops accounting p
+void tess_mem_untrack(void* p)
+{
+#ifdef MEMORY
+    mem_erase(p);
+#endif
+}
+
+// reports the current and peak tracked memory of every category over all processes, and the rank
+// with the largest current footprint
+// collective over comm; prints only with MEMORY
+void tess_mem_report(int breakpoint,
+                     MPI_Comm comm)
+{
+#ifdef MEMORY
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    const double to_mb = 1048576.0;
+    double       cur[TESS_NUM_MEM + 1], peak[TESS_NUM_MEM + 1];
+    {
+        std::lock_guard<std::mutex> lock(mem_mutex);
+        cur[TESS_NUM_MEM] = 0;
+        for (int i = 0; i < TESS_NUM_MEM; i++)
+        {
+            cur[i]             = mem_current[i] / to_mb;
+            peak[i]            = mem_peak[i] / to_mb;
+            cur[TESS_NUM_MEM] += cur[i];
+        }
+        peak[TESS_NUM_MEM] = mem_total_peak / to_mb;
+    }
+
+    // (value, rank) pairs for the location of the maximum
+    struct { double value; int rank; } loc[TESS_NUM_MEM + 1], max_loc[TESS_NUM_MEM + 1];
+    for (int i = 0; i <= TESS_NUM_MEM; i++)
+    {
+        loc[i].value = cur[i];
+        loc[i].rank  = rank;
+    }
+    double sum_cur[TESS_NUM_MEM + 1], max_peak[TESS_NUM_MEM + 1];
+    MPI_Reduce(loc, max_loc, TESS_NUM_MEM + 1, MPI_DOUBLE_INT, MPI_MAXLOC, 0, comm);
+    MPI_Reduce(cur, sum_cur, TESS_NUM_MEM + 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+    MPI_Reduce(peak, max_peak, TESS_NUM_MEM + 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+
+    if (rank == 0)
+    {
+        fprintf(stderr, "%d: tracked memory [avg, max (rank)] current, max peak MB:\n", breakpoint);
+        for (int i = 0; i <= TESS_NUM_MEM; i++)
+            fprintf(stderr, "  %-12s = [%.1lf, %.1lf (%d)], %.1lf\n",
+                    i < TESS_NUM_MEM ? mem_names[i] : "total", sum_cur[i] / size,
+                    max_loc[i].value, max_loc[i].rank, max_peak[i]);
+    }
+#endif
+}
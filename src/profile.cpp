@@ -0,0 +1,243 @@
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <algorithm>
+#include <cstdio>
+
+#include "tess/profile.hpp"
+
+#define PROFILE_HIST_BINS 16        // histogram bins between the min and the max
+
+static std::vector<tess_profile_record_t>   records;
+static std::mutex                           records_mutex;
+static std::atomic<bool>                    enabled(false);
+
+static const char* metric_names[TESS_NUM_PHASES + TESS_NUM_COUNTERS] =
+{
+    "local_cells_time", "incomplete_cells_time", "enqueue_time", "neighbor_particles_time",
+    "exchange_time",
+    "sent_particles", "recv_particles", "sent_bytes", "recv_bytes", "tets"
+};
+
+const int num_metrics = TESS_NUM_PHASES + TESS_NUM_COUNTERS;
+
+// reduced distribution of one metric
+struct metric_stats_t
+{
+    double count;
+    double min;
+    double max;
+    double sum;
+    double hist[PROFILE_HIST_BINS];
+};
+
+// starts recording, dropping any earlier records
+void tess_profile_start()
+{
+    tess_profile_clear();
+    enabled.store(true);
+}
+
+// stops recording; the records are kept for tess_profile_write()
+void tess_profile_stop()
+{
+    enabled.store(false);
+}
+
+// adds a record when recording; safe to call from the threads of master.foreach()
+void tess_profile_add(const tess_profile_record_t& rec)
+{
+    if (!enabled.load(std::memory_order_relaxed))
+        return;
+    std::lock_guard<std::mutex> lock(records_mutex);
+    records.push_back(rec);
+}
+
+// drops all records
+void tess_profile_clear()
+{
+    std::lock_guard<std::mutex> lock(records_mutex);
+    records.clear();
+}
+
+// value of metric m in record r; the exchange is timed per process, everything else per block
+static bool metric_value(const tess_profile_record_t& r,
+                         int m,
+                         double& v)
+{
+    if ((m == PHASE_EXCHANGE) != (r.gid < 0))
+        return false;
+    v = m < TESS_NUM_PHASES ? r.times[m] : r.counts[m - TESS_NUM_PHASES];
+    return true;
+}
+
+// reduces the samples of all metrics over comm; stats are valid on rank 0
+static void reduce_samples(MPI_Comm comm,
+                           const std::vector<tess_profile_record_t>& samples,
+                           metric_stats_t* stats)
+{
+    double mins[num_metrics], maxs[num_metrics], sums[num_metrics][2];
+    for (int m = 0; m < num_metrics; m++)
+    {
+        mins[m]    =  std::numeric_limits<double>::max();
+        maxs[m]    = -std::numeric_limits<double>::max();
+        sums[m][0] = sums[m][1] = 0.0;
+        for (size_t i = 0; i < samples.size(); i++)
+        {
+            double v;
+            if (!metric_value(samples[i], m, v))
+                continue;
+            mins[m] = std::min(mins[m], v);
+            maxs[m] = std::max(maxs[m], v);
+            sums[m][0] += 1.0;
+            sums[m][1] += v;
+        }
+    }
+
+    // the range must be known everywhere to bin the histograms
+    double gmins[num_metrics], gmaxs[num_metrics], gsums[num_metrics][2];
+    MPI_Allreduce(mins, gmins, num_metrics, MPI_DOUBLE, MPI_MIN, comm);
+    MPI_Allreduce(maxs, gmaxs, num_metrics, MPI_DOUBLE, MPI_MAX, comm);
+    MPI_Reduce(sums, gsums, 2 * num_metrics, MPI_DOUBLE, MPI_SUM, 0, comm);
+
+    std::vector<double> hist(num_metrics * PROFILE_HIST_BINS, 0.0), ghist(hist.size());
+    for (int m = 0; m < num_metrics; m++)
+    {
+        double w = (gmaxs[m] - gmins[m]) / PROFILE_HIST_BINS;
+        for (size_t i = 0; i < samples.size(); i++)
+        {
+            double v;
+            if (!metric_value(samples[i], m, v))
+                continue;
+            int bin = w > 0 ? (int)((v - gmins[m]) / w) : 0;
+            hist[m * PROFILE_HIST_BINS + std::min(bin, PROFILE_HIST_BINS - 1)] += 1.0;
+        }
+    }
+    MPI_Reduce(&hist[0], &ghist[0], (int)hist.size(), MPI_DOUBLE, MPI_SUM, 0, comm);
+
+    for (int m = 0; m < num_metrics; m++)
+    {
+        stats[m].count = gsums[m][0];
+        stats[m].sum   = gsums[m][1];
+        stats[m].min   = stats[m].count ? gmins[m] : 0.0;
+        stats[m].max   = stats[m].count ? gmaxs[m] : 0.0;
+        std::copy(&ghist[m * PROFILE_HIST_BINS], &ghist[(m + 1) * PROFILE_HIST_BINS], stats[m].hist);
+    }
+}
+
+static void write_json_stats(FILE* fd,
+                             const metric_stats_t* stats,
+                             const char* indent)
+{
+    for (int m = 0; m < num_metrics; m++)
+    {
+        const metric_stats_t& s = stats[m];
+        fprintf(fd, "%s\"%s\": { \"count\": %.0lf, \"min\": %.9g, \"avg\": %.9g, \"max\": %.9g, "
+                "\"sum\": %.9g, \"histogram\": [", indent, metric_names[m], s.count, s.min,
+                s.count ? s.sum / s.count : 0.0, s.max, s.sum);
+        for (int b = 0; b < PROFILE_HIST_BINS; b++)
+            fprintf(fd, "%s%.0lf", b ? ", " : "", s.hist[b]);
+        fprintf(fd, "] }%s\n", m < num_metrics - 1 ? "," : "");
+    }
+}
+
+static void write_csv_stats(FILE* fd,
+                            const metric_stats_t* stats,
+                            const char* round)
+{
+    for (int m = 0; m < num_metrics; m++)
+    {
+        const metric_stats_t& s = stats[m];
+        fprintf(fd, "%s,%s,%.0lf,%.9g,%.9g,%.9g,%.9g\n", round, metric_names[m], s.count, s.min,
+                s.count ? s.sum / s.count : 0.0, s.max, s.sum);
+    }
+}
+
+// reduces the profile over all processes and writes it from rank 0
+// collective over comm; every process must have run the same number of rounds
+//
+// the "total" distributions are over the sums of all rounds of each block (each process for the
+// exchange), the per-round ones over the blocks in that round
+//
+// json: JSON output file name
+// csv: CSV output file name, one row per round and metric (optional)
+void tess_profile_write(MPI_Comm comm,
+                        const char* json,
+                        const char* csv)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    std::lock_guard<std::mutex> lock(records_mutex);
+
+    int rounds = 0, max_rounds;
+    for (size_t i = 0; i < records.size(); i++)
+        rounds = std::max(rounds, records[i].round);
+    MPI_Allreduce(&rounds, &max_rounds, 1, MPI_INT, MPI_MAX, comm);
+    rounds = max_rounds;
+
+    // sums over the rounds of every block and process
+    std::map<int, tess_profile_record_t> block_sums;
+    std::vector< std::vector<tess_profile_record_t> > round_samples(rounds + 1);
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        const tess_profile_record_t& r = records[i];
+        tess_profile_record_t& s = block_sums.insert(std::make_pair(r.gid,
+                                                     tess_profile_record_t(0, r.gid))).first->second;
+        for (int p = 0; p < TESS_NUM_PHASES; p++)
+            s.times[p] += r.times[p];
+        for (int c = 0; c < TESS_NUM_COUNTERS; c++)
+            s.counts[c] += r.counts[c];
+        round_samples[r.round].push_back(r);
+    }
+    round_samples[0].clear();
+    for (std::map<int, tess_profile_record_t>::iterator it = block_sums.begin();
+         it != block_sums.end(); it++)
+        round_samples[0].push_back(it->second);
+
+    std::vector<metric_stats_t> stats((rounds + 1) * num_metrics);
+    for (int r = 0; r <= rounds; r++)
+        reduce_samples(comm, round_samples[r], &stats[r * num_metrics]);
+
+    if (rank)
+        return;
+
+    FILE* fd = fopen(json, "w");
+    if (!fd)
+    {
+        fprintf(stderr, "Error: cannot open profile file %s\n", json);
+        return;
+    }
+    fprintf(fd, "{\n  \"processes\": %d,\n  \"rounds\": %d,\n  \"total\": {\n", size, rounds);
+    write_json_stats(fd, &stats[0], "    ");
+    fprintf(fd, "  },\n  \"per_round\": [\n");
+    for (int r = 1; r <= rounds; r++)
+    {
+        fprintf(fd, "    {\n      \"round\": %d,\n", r);
+        write_json_stats(fd, &stats[r * num_metrics], "      ");
+        fprintf(fd, "    }%s\n", r < rounds ? "," : "");
+    }
+    fprintf(fd, "  ]\n}\n");
+    fclose(fd);
+
+    if (!csv)
+        return;
+    fd = fopen(csv, "w");
+    if (!fd)
+    {
+        fprintf(stderr, "Error: cannot open profile file %s\n", csv);
+        return;
+    }
+    fprintf(fd, "round,metric,count,min,avg,max,sum\n");
+    write_csv_stats(fd, &stats[0], "all");
+    for (int r = 1; r <= rounds; r++)
+    {
+        char round[16];
+        snprintf(round, sizeof(round), "%d", r);
+        write_csv_stats(fd, &stats[r * num_metrics], round);
+    }
+    fclose(fd);
+}
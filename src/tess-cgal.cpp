@@ -1,6 +1,7 @@
 #include "tess/tess.h"
 #include "tess/tess-cgal.h"
 #include "tess/tet-neighbors.h"
+#include "tess/scratch.hpp"
 #include <vector>
 
 //----------------------------------------------------------------------------
@@ -15,6 +16,7 @@ void init_delaunay_data_structure(dblock_t* b)
 
 void clean_delaunay_data_structure(dblock_t* b)
 {
+  tess_mem_untrack(b->Dt);
   delete static_cast<Delaunay3D*>(b->Dt);
 }
 //----------------------------------------------------------------------------
@@ -27,14 +29,110 @@ void local_cells(struct dblock_t *b)
 {
   Delaunay3D* d = (Delaunay3D*)b->Dt;
   construct_delaunay(*d, b->num_particles, b->particles);
+  // CGAL allocates the triangulation itself; account for its vertices and cells
+  tess_mem_track(b->Dt, d->tds().number_of_vertices() * sizeof(Delaunay3D::Vertex) +
+                 d->tds().number_of_cells() * sizeof(Delaunay3D::Cell), MEM_BACKEND);
   int ntets =  d->number_of_finite_cells();
   b->num_tets = ntets;
-  b->tets = (struct tet_t*)malloc(ntets * sizeof(struct tet_t));
+  // reuses the tets of the previous round (see reset_block)
+  b->tets = (struct tet_t*)tess_reserve(b->tets, (size_t)ntets * sizeof(struct tet_t), MEM_TETS);
   gen_tets(*d, b->tets);
   fill_vert_to_tet(b);
 }
 //----------------------------------------------------------------------------
 //
+// moves vertex v to q if the triangulation stays Delaunay without changing its cells: every cell
+// around v keeps its orientation, and every facet of those cells stays locally Delaunay
+// (a vertex on the convex hull is never moved in place)
+// returns whether v moved; otherwise v is unchanged
+//
+static bool move_in_place(Delaunay3D& Dt, Vertex_handle v, const Point& q)
+{
+  if (Dt.dimension() < 3)
+    return false;
+
+  std::vector<Cell_handle> cells;
+  Dt.incident_cells(v, std::back_inserter(cells));
+  for (size_t i = 0; i < cells.size(); ++i)
+    if (Dt.is_infinite(cells[i]))
+      return false;
+
+  Point p = v->point();
+  v->set_point(q);
+
+  K::Orientation_3 orientation = Dt.geom_traits().orientation_3_object();
+  bool valid = true;
+  for (size_t i = 0; i < cells.size() && valid; ++i)
+  {
+    Cell_handle c = cells[i];
+    valid = orientation(c->vertex(0)->point(), c->vertex(1)->point(),
+                        c->vertex(2)->point(), c->vertex(3)->point()) == CGAL::POSITIVE;
+  }
+  for (size_t i = 0; i < cells.size() && valid; ++i)
+    for (int j = 0; j < 4 && valid; ++j)
+    {
+      Vertex_handle w = Dt.mirror_vertex(cells[i], j);
+      if (!Dt.is_infinite(w))
+        valid = Dt.side_of_sphere(cells[i], w->point()) != CGAL::ON_BOUNDED_SIDE;
+    }
+
+  if (!valid)
+    v->set_point(p);
+  return valid;
+}
+//----------------------------------------------------------------------------
+//
+// moves the vertices of the particles whose positions changed (tess_update) to their new
+// positions, in place where the triangulation stays valid, otherwise by removing and
+// reinserting them; particles not in the triangulation yet are left to local_cells()
+//
+// b: local block
+// moved, num_moved: indices of the particles that moved
+// in_place, reinserted: (output) number of vertices moved in place, removed and reinserted
+//
+void move_vertices(struct dblock_t *b, const int *moved, int num_moved, int *in_place,
+                   int *reinserted)
+{
+  Delaunay3D* d = (Delaunay3D*)b->Dt;
+  *in_place   = 0;
+  *reinserted = 0;
+  if (!num_moved || !d->number_of_vertices())
+    return;
+
+  // vertex of every particle
+  std::vector<Vertex_handle> vertices(b->num_particles);
+  for (Vertex_iterator vit = d->finite_vertices_begin(); vit != d->finite_vertices_end(); ++vit)
+    if (vit->info() < (unsigned)b->num_particles)
+      vertices[vit->info()] = vit;
+
+  for (int i = 0; i < num_moved; ++i)
+  {
+    int           p = moved[i];
+    Vertex_handle v = vertices[p];
+    if (v == Vertex_handle())
+      continue;
+    Point q(b->particles[3 * p], b->particles[3 * p + 1], b->particles[3 * p + 2]);
+    if (v->point() == q)
+      continue;
+
+    if (move_in_place(*d, v, q))
+    {
+      ++*in_place;
+      continue;
+    }
+
+    // a neighbor of v locates q for the insertion
+    Cell_handle   c = v->cell();
+    Vertex_handle u = c->vertex((c->index(v) + 1) % 4);
+    d->remove(v);
+    Vertex_handle w = d->is_infinite(u) ? d->insert(q) : d->insert(q, u->cell());
+    w->info()   = p;
+    vertices[p] = w;
+    ++*reinserted;
+  }
+}
+//----------------------------------------------------------------------------
+//
 // generates delaunay output
 //
 // facetlist: qhull list of convex hull facets
@@ -47,7 +145,7 @@ int gen_delaunay_output(Delaunay3D &Dt, int** tet_verts) {
   int numfacets = Dt.number_of_finite_cells();
   int v = 0; // index in tets
 
-  *tet_verts = (int *)malloc(numfacets * 4 * sizeof(int));
+  *tet_verts = (int *)malloc((size_t)numfacets * 4 * sizeof(int));
 
   // process the tets
   for(Cell_iterator cit = Dt.finite_cells_begin();
@@ -72,7 +170,10 @@ void construct_delaunay(Delaunay3D &Dt, int num_particles, float *particles)
   int n = Dt.number_of_vertices();
 
 #ifdef TESS_CGAL_ALLOW_SPATIAL_SORT
-  std::vector< std::pair<Point,unsigned> > points; points.reserve(num_particles);
+  typedef std::pair<Point,unsigned> IndexedPoint;
+  ScratchScope scratch;
+  std::vector< IndexedPoint, ScratchAllocator<IndexedPoint> > points;
+  points.reserve(num_particles - n);
   for (unsigned j = n; j < (unsigned)num_particles; j++)
   {
     Point p(particles[3*j],
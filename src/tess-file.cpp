@@ -0,0 +1,693 @@
+// ---------------------------------------------------------------------------
+//
+//   versioned, memory-mappable tessellation file (see tess-file.hpp)
+//
+// --------------------------------------------------------------------------
+
+#include "mpi.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "tess/tess.hpp"
+#include "tess/tess-file.hpp"
+
+using namespace std;
+
+// rounds x up to the section alignment
+static inline uint64_t align_up(uint64_t x)
+{
+    return (x + TESS_FILE_ALIGN - 1) / TESS_FILE_ALIGN * TESS_FILE_ALIGN;
+}
+
+// address of a section in a mapped file, NULL if the section is empty or not selected
+template<typename T>
+static T* section(const TessFile& file,
+                  const tess_file_block_t& e,
+                  int s,
+                  unsigned sections)
+{
+    if (!(sections & (1u << s)) || !e.size[s])
+        return NULL;
+    return reinterpret_cast<T*>(file.data.get() + e.offset[s]);
+}
+
+// layout of the local blocks in a tess file
+struct FileLayout
+{
+    vector<tess_file_block_t>   entries;        // block table entries of the local blocks
+    vector<diy::MemoryBuffer>   links;          // serialized links
+    vector< vector<char> >      tet_streams;    // compressed tets
+    vector<const void*>         addrs;          // section addresses, by block and section
+    vector<tess_file_block_t>   table;          // whole block table, sorted by gid (rank 0)
+    tess_file_header_t          header;
+    uint64_t                    local_size;     // bytes of the local sections, with padding
+    uint64_t                    data_offset;    // offset of the local sections in the file
+};
+
+// lays out the local blocks of a master in a tess file (collective)
+//
+// master: diy master object
+// extra: extra user data, written by rank 0 only
+// tet_codec: tet codec
+// layout: (output) the layout
+static void file_layout(diy::Master& master,
+                        const diy::MemoryBuffer& extra,
+                        tet_codec_t tet_codec,
+                        FileLayout& layout)
+{
+    MPI_Comm comm = master.communicator();
+    int rank, groupsize;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &groupsize);
+
+    // block table entries and section layout of local blocks, offsets relative to this rank
+    int nblocks = master.size();
+    vector<tess_file_block_t>& entries     = layout.entries;
+    vector<diy::MemoryBuffer>& links       = layout.links;
+    vector< vector<char> >&    tet_streams = layout.tet_streams;
+    vector<const void*>&       addrs       = layout.addrs;
+    entries.resize(nblocks);
+    links.resize(nblocks);
+    tet_streams.resize(nblocks);
+    addrs.resize(nblocks * TESS_NUM_SECTIONS);
+    uint64_t local_size = 0;
+    for (int i = 0; i < nblocks; i++)
+    {
+        DBlock* b = master.block<DBlock>(i);
+        tess_file_block_t& e = entries[i];
+        memset(&e, 0, sizeof(tess_file_block_t));
+
+        e.gid                = b->gid;
+        e.complete           = b->complete;
+        for (int j = 0; j < 3; j++)
+        {
+            e.bounds[j]          = b->bounds.min[j];
+            e.bounds[3 + j]      = b->bounds.max[j];
+            e.box[j]             = b->box.min[j];
+            e.box[3 + j]         = b->box.max[j];
+            e.data_bounds[j]     = b->data_bounds.min[j];
+            e.data_bounds[3 + j] = b->data_bounds.max[j];
+        }
+        e.num_orig_particles = b->num_orig_particles;
+        e.num_particles      = b->num_particles;
+        e.num_attrs          = b->attrs ? b->num_attrs : 0;
+        e.num_tets           = b->num_tets;
+        e.num_grid_pts       = b->num_grid_pts;
+        e.num_fields         = b->fields ? b->num_fields : 0;
+
+        diy::LinkFactory::save(links[i], master.link(i));
+
+        e.tet_codec = TET_CODEC_RAW;
+        if (tet_codec != TET_CODEC_RAW && b->tets)
+        {
+            e.tet_codec = tet_codec;
+            compress_tets(b->tets, b->num_tets, b->particles, b->num_particles, tet_codec,
+                          tet_streams[i]);
+        }
+        bool raw_tets = (e.tet_codec == TET_CODEC_RAW);
+
+        uint64_t np   = b->num_particles;
+        uint64_t nrem = b->num_particles - b->num_orig_particles;
+        uint64_t ng   = b->num_grid_pts;
+        uint64_t sizes[TESS_NUM_SECTIONS] =
+            {
+                3 * np * sizeof(float),
+                e.num_attrs * np * sizeof(float),
+                nrem * sizeof(int),
+                nrem * sizeof(int),
+                raw_tets ? b->num_tets * sizeof(tet_t) : tet_streams[i].size(),
+                np * sizeof(int),
+                ng * sizeof(float),
+                e.num_fields * ng * sizeof(float),
+                links[i].buffer.size(),
+            };
+        const void* ptrs[TESS_NUM_SECTIONS] =
+            {
+                b->particles,
+                b->attrs,
+                b->rem_gids,
+                b->rem_lids,
+                raw_tets ? (const void*)b->tets : &tet_streams[i][0],
+                raw_tets ? b->vert_to_tet : NULL,
+                b->density,
+                b->fields,
+                links[i].buffer.size() ? &links[i].buffer[0] : NULL,
+            };
+
+        for (int s = 0; s < TESS_NUM_SECTIONS; s++)
+        {
+            addrs[i * TESS_NUM_SECTIONS + s] = ptrs[s];
+            e.size[s]   = ptrs[s] ? sizes[s] : 0;
+            e.offset[s] = local_size;
+            local_size  = align_up(local_size + e.size[s]);
+        }
+    }
+
+    // global layout
+    uint64_t base = 0;                      // offset of this rank's sections in the data area
+    MPI_Exscan(&local_size, &base, 1, MPI_UINT64_T, MPI_SUM, comm);
+    if (rank == 0)
+        base = 0;                           // MPI_Exscan leaves rank 0 undefined
+    uint64_t data_size;
+    MPI_Allreduce(&local_size, &data_size, 1, MPI_UINT64_T, MPI_SUM, comm);
+    int tot_blocks;
+    MPI_Allreduce(&nblocks, &tot_blocks, 1, MPI_INT, MPI_SUM, comm);
+    uint64_t extra_size = extra.buffer.size();
+    MPI_Bcast(&extra_size, 1, MPI_UINT64_T, 0, comm);
+
+    tess_file_header_t& header = layout.header;
+    memset(&header, 0, sizeof(tess_file_header_t));
+    memcpy(header.magic, TESS_FILE_MAGIC, sizeof(header.magic));
+    header.version      = TESS_FILE_VERSION;
+    header.num_blocks   = tot_blocks;
+    header.table_offset = align_up(sizeof(tess_file_header_t));
+    header.extra_offset = align_up(header.table_offset + tot_blocks * sizeof(tess_file_block_t));
+    header.extra_size   = extra_size;
+    uint64_t data_offset = align_up(header.extra_offset + extra_size);
+    header.file_size    = data_offset + data_size;
+
+    for (int i = 0; i < nblocks; i++)
+        for (int s = 0; s < TESS_NUM_SECTIONS; s++)
+            entries[i].offset[s] += data_offset + base;
+
+    // gather the block table at the root
+    int nbytes = nblocks * sizeof(tess_file_block_t);
+    vector<int> counts(groupsize), displs(groupsize);
+    MPI_Gather(&nbytes, 1, MPI_INT, &counts[0], 1, MPI_INT, 0, comm);
+    vector<tess_file_block_t>& table = layout.table;
+    if (rank == 0)
+    {
+        table.resize(tot_blocks);
+        displs[0] = 0;
+        for (int i = 1; i < groupsize; i++)
+            displs[i] = displs[i - 1] + counts[i - 1];
+    }
+    MPI_Gatherv(nblocks ? &entries[0] : NULL, nbytes, MPI_BYTE,
+                tot_blocks ? &table[0] : NULL, &counts[0], &displs[0], MPI_BYTE, 0, comm);
+    if (rank == 0)
+        sort(table.begin(), table.end(),
+             [](const tess_file_block_t& a, const tess_file_block_t& b) { return a.gid < b.gid; });
+
+    layout.local_size  = local_size;
+    layout.data_offset = data_offset + base;
+}
+
+// opens a tess file for writing and sizes it (collective)
+static MPI_File file_create(MPI_Comm comm,
+                            const char* outfile,
+                            uint64_t size)
+{
+    MPI_File fd;
+    int retval = MPI_File_open(comm, (char *)outfile, MPI_MODE_WRONLY | MPI_MODE_CREATE,
+                               MPI_INFO_NULL, &fd);
+    if (retval != MPI_SUCCESS)
+    {
+        fprintf(stderr, "Error: unable to open tess file %s\n", outfile);
+        MPI_Abort(comm, 1);
+    }
+    MPI_File_set_size(fd, 0); // start with an empty file every time
+    if (size)
+        MPI_File_set_size(fd, size);
+    return fd;
+}
+
+// writes the local blocks of a master to a tess file
+// one collective write for all sections of all local blocks
+// NB: all blocks need to be in memory
+//
+// master: diy master object
+// outfile: output file name
+// extra: extra user data, written by rank 0 only
+// tet_codec: tet codec; compressed tets are not mappable and are decoded on load
+void tess_file_write(diy::Master& master,
+                     const char* outfile,
+                     const diy::MemoryBuffer& extra,
+                     tet_codec_t tet_codec)
+{
+    MPI_Comm comm = master.communicator();
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    FileLayout layout;
+    file_layout(master, extra, tet_codec, layout);
+    const tess_file_header_t&        header     = layout.header;
+    const vector<tess_file_block_t>& entries    = layout.entries;
+    const vector<tess_file_block_t>& table      = layout.table;
+    const vector<const void*>&       addrs      = layout.addrs;
+    int                              nblocks    = entries.size();
+    int                              tot_blocks = header.num_blocks;
+    uint64_t                         extra_size = header.extra_size;
+
+    MPI_File fd = file_create(comm, outfile, 0);
+    MPI_Status status;
+
+    // header, block table, and extra data
+    if (rank == 0)
+    {
+        MPI_File_write_at(fd, 0, &header, sizeof(tess_file_header_t), MPI_BYTE, &status);
+        if (tot_blocks)
+            MPI_File_write_at(fd, header.table_offset, &table[0],
+                              tot_blocks * sizeof(tess_file_block_t), MPI_BYTE, &status);
+        if (extra_size)
+            MPI_File_write_at(fd, header.extra_offset, (void*)&extra.buffer[0], extra_size,
+                              MPI_BYTE, &status);
+    }
+
+    // sections, in increasing file order; MPI block lengths are ints, so split large sections
+    const uint64_t max_len = 1 << 30;
+    vector<int> lens;
+    vector<MPI_Aint> file_displs, mem_displs;
+    for (int i = 0; i < nblocks; i++)
+        for (int s = 0; s < TESS_NUM_SECTIONS; s++)
+        {
+            const char* p = static_cast<const char*>(addrs[i * TESS_NUM_SECTIONS + s]);
+            for (uint64_t done = 0; done < entries[i].size[s]; done += max_len)
+            {
+                MPI_Aint addr;
+                MPI_Get_address((void*)(p + done), &addr);
+                lens.push_back(min(max_len, entries[i].size[s] - done));
+                file_displs.push_back(entries[i].offset[s] + done);
+                mem_displs.push_back(addr);
+            }
+        }
+
+    int errcode;
+    if (lens.size())
+    {
+        MPI_Datatype ftype, mtype;          // file and memory types
+        MPI_Type_create_hindexed(lens.size(), &lens[0], &file_displs[0], MPI_BYTE, &ftype);
+        MPI_Type_commit(&ftype);
+        MPI_Type_create_hindexed(lens.size(), &lens[0], &mem_displs[0], MPI_BYTE, &mtype);
+        MPI_Type_commit(&mtype);
+
+        MPI_File_set_view(fd, 0, MPI_BYTE, ftype, (char *)"native", MPI_INFO_NULL);
+        errcode = MPI_File_write_all(fd, MPI_BOTTOM, 1, mtype, &status);
+
+        MPI_Type_free(&mtype);
+        MPI_Type_free(&ftype);
+    }
+    else // nothing to write, still participate in the collective
+    {
+        char unused;
+        MPI_File_set_view(fd, 0, MPI_BYTE, MPI_BYTE, (char *)"native", MPI_INFO_NULL);
+        errcode = MPI_File_write_all(fd, &unused, 0, MPI_BYTE, &status);
+    }
+    if (errcode != MPI_SUCCESS)
+    {
+        fprintf(stderr, "Error: MPI_File_write_all of tess file %s failed\n", outfile);
+        MPI_Abort(comm, 1);
+    }
+
+    // trailing padding of the last section is not written
+    MPI_File_set_size(fd, header.file_size);
+    MPI_File_close(&fd);
+}
+
+// writes n bytes at an offset of a file descriptor; false on error, with errno set
+static bool write_at(int fd,
+                     const char* p,
+                     size_t n,
+                     uint64_t offset)
+{
+    while (n)
+    {
+        ssize_t written = pwrite(fd, p, n, offset);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+        {
+            if (!written)
+                errno = EIO;
+            return false;
+        }
+        p      += written;
+        n      -= written;
+        offset += written;
+    }
+    return true;
+}
+
+// body of the I/O thread: writes the head and the snapshot of a background write
+// plain POSIX I/O, no MPI, so that the thread needs no MPI_THREAD_MULTIPLE
+static void write_snapshot(TessFileWrite* w)
+{
+    if (w->head.empty() && w->data.empty())
+        return;
+    int fd = open(w->outfile.c_str(), O_WRONLY);
+    if (fd < 0)
+    {
+        w->error = errno;
+        return;
+    }
+    if ((!w->head.empty() && !write_at(fd, &w->head[0], w->head.size(), 0)) ||
+        (!w->data.empty() && !write_at(fd, &w->data[0], w->data.size(), w->offset)))
+        w->error = errno;
+    if (close(fd) && !w->error)
+        w->error = errno;
+}
+
+// starts writing the local blocks of a master to a tess file in the background (collective)
+//
+// the sections of the local blocks are copied into one buffer, laid out as in the file, so
+// that the blocks may change as soon as this returns; an I/O thread of every process then writes
+// its buffer to its contiguous range of the file while the caller goes on
+// tess_file_wait() finishes the write; a pending write of w is finished first
+// NB: all blocks need to be in memory
+//
+// master: diy master object
+// outfile: output file name
+// w: (output) the write in progress
+// extra: extra user data, written by rank 0 only
+// tet_codec: tet codec
+void tess_file_write_async(diy::Master& master,
+                           const char* outfile,
+                           TessFileWrite& w,
+                           const diy::MemoryBuffer& extra,
+                           tet_codec_t tet_codec)
+{
+    tess_file_wait(w);
+
+    MPI_Comm comm = master.communicator();
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    FileLayout layout;
+    file_layout(master, extra, tet_codec, layout);
+    const tess_file_header_t& header = layout.header;
+
+    // snapshot of the local sections, with the padding between them
+    w.data.assign(layout.local_size, 0);
+    for (size_t i = 0; i < layout.entries.size(); i++)
+        for (int s = 0; s < TESS_NUM_SECTIONS; s++)
+        {
+            const tess_file_block_t& e = layout.entries[i];
+            if (e.size[s])
+                memcpy(&w.data[e.offset[s] - layout.data_offset],
+                       layout.addrs[i * TESS_NUM_SECTIONS + s], e.size[s]);
+        }
+    w.offset = layout.data_offset;
+
+    // header, block table, and extra data, with the padding between them
+    w.head.clear();
+    if (rank == 0)
+    {
+        w.head.assign(header.extra_offset + header.extra_size, 0);
+        memcpy(&w.head[0], &header, sizeof(tess_file_header_t));
+        if (header.num_blocks)
+            memcpy(&w.head[header.table_offset], &layout.table[0],
+                   header.num_blocks * sizeof(tess_file_block_t));
+        if (header.extra_size)
+            memcpy(&w.head[header.extra_offset], &extra.buffer[0], header.extra_size);
+    }
+
+    // create the file at its final size; the ranges of the processes are disjoint
+    MPI_File fd = file_create(comm, outfile, header.file_size);
+    MPI_File_close(&fd);
+
+    w.outfile = outfile;
+    w.comm    = comm;
+    w.error   = 0;
+    w.pending = true;
+    w.thread  = std::thread(write_snapshot, &w);
+}
+
+// finishes a background write (collective): once it returns on any process, the whole file is
+// written; aborts if any process failed to write
+void tess_file_wait(TessFileWrite& w)
+{
+    if (!w.pending)
+        return;
+    w.thread.join();
+    w.pending = false;
+    std::vector<char>().swap(w.head);
+    std::vector<char>().swap(w.data);
+
+    int error = w.error, any_error;
+    MPI_Allreduce(&error, &any_error, 1, MPI_INT, MPI_MAX, w.comm);
+    if (error)
+        fprintf(stderr, "Error: unable to write tess file %s: %s\n", w.outfile.c_str(),
+                strerror(error));
+    if (any_error)
+        MPI_Abort(w.comm, 1);
+}
+
+// checks whether a file is a tess file (as opposed to a diy block file)
+bool tess_file_is_tess(const char* infile)
+{
+    char magic[8];
+    FILE* fd = fopen(infile, "rb");
+    if (!fd)
+        return false;
+    bool is_tess = fread(magic, 1, sizeof(magic), fd) == sizeof(magic) &&
+        !memcmp(magic, TESS_FILE_MAGIC, sizeof(magic));
+    fclose(fd);
+    return is_tess;
+}
+
+// maps a tess file into memory and checks its header and block table
+// the mapping is private: blocks may modify their arrays in place without changing the file
+//
+// infile: input file name
+// file: mapped file (output)
+//
+// returns: whether the file is a valid tess file
+bool tess_file_open(const char* infile,
+                    TessFile& file)
+{
+    int fd = open(infile, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error: unable to open tess file %s\n", infile);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(tess_file_header_t))
+    {
+        fprintf(stderr, "Error: %s is too small to be a tess file\n", infile);
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        fprintf(stderr, "Error: unable to map tess file %s\n", infile);
+        return false;
+    }
+
+    file.data   = shared_ptr<char>(static_cast<char*>(p), [size](char* q) { munmap(q, size); });
+    file.size   = size;
+    file.header = reinterpret_cast<const tess_file_header_t*>(file.data.get());
+    file.blocks = reinterpret_cast<const tess_file_block_t*>(file.data.get() +
+                                                            file.header->table_offset);
+
+    const tess_file_header_t& h = *file.header;
+    if (memcmp(h.magic, TESS_FILE_MAGIC, sizeof(h.magic)))
+    {
+        fprintf(stderr, "Error: %s is not a tess file\n", infile);
+        return false;
+    }
+    if (h.version != TESS_FILE_VERSION)
+    {
+        fprintf(stderr, "Error: %s has tess file version %u, expected %d\n",
+                infile, h.version, TESS_FILE_VERSION);
+        return false;
+    }
+    if (h.file_size != size ||
+        h.table_offset + (uint64_t)h.num_blocks * sizeof(tess_file_block_t) > size ||
+        h.extra_offset + h.extra_size > size)
+    {
+        fprintf(stderr, "Error: tess file %s is truncated\n", infile);
+        return false;
+    }
+    for (uint32_t i = 0; i < h.num_blocks; i++)
+        for (int s = 0; s < TESS_NUM_SECTIONS; s++)
+            if (file.blocks[i].offset[s] + file.blocks[i].size[s] > size)
+            {
+                fprintf(stderr, "Error: tess file %s has a corrupt block table\n", infile);
+                return false;
+            }
+
+    return true;
+}
+
+// finds a block in the block table
+//
+// returns: index of the block in the table, -1 if not found
+int tess_file_find(const TessFile& file,
+                   int gid)
+{
+    const tess_file_block_t* end = file.blocks + file.header->num_blocks;
+    const tess_file_block_t* e =
+        lower_bound(file.blocks, end, gid,
+                    [](const tess_file_block_t& a, int g) { return a.gid < g; });
+    return (e != end && e->gid == gid) ? e - file.blocks : -1;
+}
+
+// finds the blocks whose bounds intersect a box
+//
+// box: query box
+// gids: gids of intersecting blocks (output)
+void tess_file_query(const TessFile& file,
+                     const diy::ContinuousBounds& box,
+                     vector<int>& gids)
+{
+    gids.clear();
+    for (uint32_t i = 0; i < file.header->num_blocks; i++)
+    {
+        const float* bounds = file.blocks[i].bounds;
+        bool intersects = true;
+        for (int j = 0; j < 3; j++)
+            if (bounds[j] > box.max[j] || bounds[3 + j] < box.min[j])
+                intersects = false;
+        if (intersects)
+            gids.push_back(file.blocks[i].gid);
+    }
+}
+
+// creates a block whose arrays point into a mapped tess file, without copying
+// the block keeps the mapping alive; call make_writable before reallocating its arrays
+//
+// file: mapped tess file
+// i: index of the block in the block table
+// sections: bit mask of sections (1 << tess_section_t) to use; arrays of other sections are
+//   NULL, but their counts are still set; compressed tets are decoded when either tets or
+//   vert_to_tet is selected
+DBlock* tess_file_block(const TessFile& file,
+                        int i,
+                        unsigned sections)
+{
+    const tess_file_block_t& e = file.blocks[i];
+    DBlock* b = static_cast<DBlock*>(create_block());
+
+    b->storage      = file.data;
+    b->storage_size = file.size;
+
+    b->gid = e.gid;
+    b->complete = e.complete;
+    for (int j = 0; j < 3; j++)
+    {
+        b->bounds.min[j]      = e.bounds[j];
+        b->bounds.max[j]      = e.bounds[3 + j];
+        b->box.min[j]         = e.box[j];
+        b->box.max[j]         = e.box[3 + j];
+        b->data_bounds.min[j] = e.data_bounds[j];
+        b->data_bounds.max[j] = e.data_bounds[3 + j];
+    }
+    b->num_orig_particles = e.num_orig_particles;
+    b->num_particles      = e.num_particles;
+    b->num_attrs          = e.num_attrs;
+    b->num_tets           = e.num_tets;
+    b->num_grid_pts       = e.num_grid_pts;
+    b->num_fields         = e.num_fields;
+
+    b->particles   = section<float>(file, e, TESS_SEC_PARTICLES,   sections);
+    b->attrs       = section<float>(file, e, TESS_SEC_ATTRS,       sections);
+    b->rem_gids    = section<int>  (file, e, TESS_SEC_REM_GIDS,    sections);
+    b->rem_lids    = section<int>  (file, e, TESS_SEC_REM_LIDS,    sections);
+    b->tets        = section<tet_t>(file, e, TESS_SEC_TETS,        sections);
+    b->vert_to_tet = section<int>  (file, e, TESS_SEC_VERT_TO_TET, sections);
+    b->density     = section<float>(file, e, TESS_SEC_DENSITY,     sections);
+    b->fields      = section<float>(file, e, TESS_SEC_FIELDS,      sections);
+
+    // compressed tets are decoded into owned arrays; vert_to_tet is rebuilt from them
+    unsigned tet_sections = (1u << TESS_SEC_TETS) | (1u << TESS_SEC_VERT_TO_TET);
+    if (e.tet_codec != TET_CODEC_RAW && (sections & tet_sections))
+    {
+        const char*  stream    = section<const char> (file, e, TESS_SEC_TETS,      TESS_ALL_SECTIONS);
+        const float* particles = section<const float>(file, e, TESS_SEC_PARTICLES, TESS_ALL_SECTIONS);
+        b->tets = (tet_t*)tess_malloc(e.num_tets * sizeof(tet_t), MEM_TETS);
+        if (!decompress_tets(stream, e.size[TESS_SEC_TETS], particles, e.num_particles,
+                             b->tets, e.num_tets))
+        {
+            fprintf(stderr, "Error: corrupt compressed tets in block %d\n", e.gid);
+            assert(false);
+        }
+        if ((sections & (1u << TESS_SEC_VERT_TO_TET)) && e.num_particles)
+            fill_vert_to_tet(static_cast<dblock_t*>(b));
+        if (!(sections & (1u << TESS_SEC_TETS)))
+        {
+            tess_free(b->tets);
+            b->tets = NULL;
+        }
+    }
+
+    return b;
+}
+
+void tess_file_load(diy::Master& master,
+                    diy::StaticAssigner& assigner,
+                    const char* infile)
+{
+    diy::MemoryBuffer extra;
+    tess_file_load(master, assigner, infile, extra);
+}
+
+// loads the blocks assigned to this process from a tess file, zero-copy
+//
+// master: diy master object
+// assigner: diy assigner object, its number of blocks is set from the file
+// infile: input file name
+// extra: extra user data (output)
+// select: optional gids of the blocks to load; the assigner still covers all blocks in the
+//   file, so that the links of the loaded blocks remain valid, but blocks not in the list are
+//   skipped (NULL: load all)
+// sections: bit mask of sections (1 << tess_section_t) to load, see tess_file_block
+void tess_file_load(diy::Master& master,
+                    diy::StaticAssigner& assigner,
+                    const char* infile,
+                    diy::MemoryBuffer& extra,
+                    const vector<int>* select,
+                    unsigned sections)
+{
+    TessFile file;
+    if (!tess_file_open(infile, file))
+        MPI_Abort(master.communicator(), 1);
+
+    assigner.set_nblocks(file.header->num_blocks);
+    vector<int> gids;
+    assigner.local_gids(master.communicator().rank(), gids);
+
+    vector<int> selected;
+    if (select)
+    {
+        selected = *select;
+        sort(selected.begin(), selected.end());
+    }
+
+    for (size_t i = 0; i < gids.size(); i++)
+    {
+        if (select && !binary_search(selected.begin(), selected.end(), gids[i]))
+            continue;
+
+        int j = tess_file_find(file, gids[i]);
+        if (j < 0)
+        {
+            fprintf(stderr, "Error: block %d is missing from tess file %s\n", gids[i], infile);
+            MPI_Abort(master.communicator(), 1);
+        }
+
+        const tess_file_block_t& e = file.blocks[j];
+        diy::MemoryBuffer bb;
+        const char* l = file.data.get() + e.offset[TESS_SEC_LINK];
+        bb.buffer.assign(l, l + e.size[TESS_SEC_LINK]);
+        bb.reset();
+        diy::Link* link = diy::LinkFactory::load(bb);
+
+        master.add(gids[i], tess_file_block(file, j, sections), link);
+    }
+
+    const char* x = file.data.get() + file.header->extra_offset;
+    extra.buffer.assign(x, x + file.header->extra_size);
+    extra.reset();
+}
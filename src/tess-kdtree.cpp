@@ -1,28 +1,47 @@
 #include <vector>
 #include <cstdio>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <mutex>
 
 #include <diy/algorithms.hpp>
 
 #include "tess/tess.h"
 #include "tess/delaunay.hpp"
+#include "tess/tess.hpp"
 
-struct KDTreeBlock
+// N floats per point: 3 coordinates followed by up to N - 3 particle attributes
+// the kd-tree splits only on the coordinates; attributes ride along with their point
+template<unsigned N>
+struct KDTreeBlockN
 {
+    static const int max_attrs = N - 3;
+
     struct Point
     {
         float&          operator[](unsigned i)              { return data[i]; }
         const float&    operator[](unsigned i) const        { return data[i]; }
-        float           data[3];
+        float           data[N];
     };
     std::vector<Point>                points;
 };
 
+// points are sized by the smallest of these that holds all the attributes
+typedef KDTreeBlockN<3>               KDTreeBlock;
+typedef KDTreeBlockN<3 + 1>           KDTreeAttrBlock1;
+typedef KDTreeBlockN<3 + 2>           KDTreeAttrBlock2;
+typedef KDTreeBlockN<3 + 4>           KDTreeAttrBlock4;
+typedef KDTreeBlockN<3 + MAX_ATTRS>   KDTreeAttrBlock;
+
 struct WrapMaster
 {
     diy::Master* master;
     bool         wrap;
 };
 
+template<class Block>
 void populate_kdtree_block(DBlock*                         d,
                            const diy::Master::ProxyWithLink& cp,
                            diy::Master&                      kdtree_master,
@@ -30,7 +49,7 @@ void populate_kdtree_block(DBlock*                         d,
 {
     diy::ContinuousBounds domain = d->data_bounds;
 
-    KDTreeBlock* b = new KDTreeBlock;
+    Block* b = new Block;
     diy::RegularContinuousLink* l = new diy::RegularContinuousLink(3, domain, domain);
     kdtree_master.add(cp.gid(), b, l);
 
@@ -41,10 +60,14 @@ void populate_kdtree_block(DBlock*                         d,
         b->points[i][0] = d->particles[3*i + 0];
         b->points[i][1] = d->particles[3*i + 1];
         b->points[i][2] = d->particles[3*i + 2];
+        if (Block::max_attrs)
+            for (int j = 0; j < d->num_attrs; ++j)
+                b->points[i][3 + j] = d->attrs[d->num_attrs * i + j];
     }
 }
 
-void extract_kdtree_block(KDTreeBlock*                      b,
+template<class Block>
+void extract_kdtree_block(Block*                            b,
                           const diy::Master::ProxyWithLink& cp,
                           diy::Master&                      tess_master)
 {
@@ -52,14 +75,24 @@ void extract_kdtree_block(KDTreeBlock*                      b,
     DBlock* d  = (DBlock*) tess_master.block(tess_lid); // assumes all blocks in memory
 
     // copy out the particles
+    make_writable(d);
     d->num_particles = d->num_orig_particles = b->points.size();
-    d->particles = (float *)realloc(d->particles, b->points.size() * 3 * sizeof(float));
+    d->particles = (float *)tess_realloc(d->particles, b->points.size() * 3 * sizeof(float),
+                                         MEM_PARTICLES);
     for (size_t i = 0; i < d->num_orig_particles; ++i)
     {
         d->particles[3*i + 0] = b->points[i][0];
         d->particles[3*i + 1] = b->points[i][1];
         d->particles[3*i + 2] = b->points[i][2];
     }
+    if (Block::max_attrs && d->num_attrs)
+    {
+        d->attrs = (float *)tess_realloc(d->attrs, b->points.size() * d->num_attrs * sizeof(float),
+                                         MEM_PARTICLES);
+        for (size_t i = 0; i < d->num_orig_particles; ++i)
+            for (int j = 0; j < d->num_attrs; ++j)
+                d->attrs[d->num_attrs * i + j] = b->points[i][3 + j];
+    }
 
     //fprintf(stderr, "[%d]: %d particles copied out\n", cp.gid(), d->num_orig_particles);
 
@@ -80,28 +113,72 @@ void extract_kdtree_block(KDTreeBlock*                      b,
     delete b; // safe to do since kdtree_master doesn't own the blocks (no create/destroy supplied)
 }
 
-void tess_kdtree_exchange(diy::Master& master,
-                          const diy::Assigner& assigner,
-                          double* times,
-                          bool wrap,
-                          bool sampling)
+template<class Block>
+void kdtree_exchange(diy::Master& master,
+                     const diy::Assigner& assigner,
+                     bool wrap,
+                     bool sampling)
 {
-    timing(times, EXCH_TIME, -1, master.communicator());
-
     diy::Master kdtree_master(master.communicator(),  master.threads(), -1);
     master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
-                   { populate_kdtree_block(b, cp, kdtree_master, wrap); });
+                   { populate_kdtree_block<Block>(b, cp, kdtree_master, wrap); });
 
     int bins = 1024;      // histogram bins; TODO: make a function argument
     diy::ContinuousBounds domain = master.block<DBlock>(master.loaded_block())->data_bounds;
     if (sampling)
-        diy::kdtree_sampling(kdtree_master, assigner, 3, domain, &KDTreeBlock::points, bins, wrap);
+        diy::kdtree_sampling(kdtree_master, assigner, 3, domain, &Block::points, bins, wrap);
     else
-        diy::kdtree(kdtree_master, assigner, 3, domain, &KDTreeBlock::points, bins, wrap);
+        diy::kdtree(kdtree_master, assigner, 3, domain, &Block::points, bins, wrap);
 
-    kdtree_master.foreach([&](KDTreeBlock* b, const diy::Master::ProxyWithLink& cp)
-                          { extract_kdtree_block(b, cp, master); });
+    kdtree_master.foreach([&](Block* b, const diy::Master::ProxyWithLink& cp)
+                          { extract_kdtree_block<Block>(b, cp, master); });
     master.set_expected(kdtree_master.expected());
+}
+
+void tess_kdtree_exchange(diy::Master& master,
+                          const diy::Assigner& assigner,
+                          double* times,
+                          bool wrap,
+                          bool sampling)
+{
+    // diy's k-d tree needs all blocks in memory and, with wrap, enough blocks for the periodic
+    // neighbors to be distinct; the cost k-d tree without a ghost cost balances the number of
+    // points too and handles both (sampling does not apply to it)
+    if (master.limit() != -1 || (wrap && assigner.nblocks() < 64))
+    {
+        kdtree_cost_t cost;
+        cost.ghost = 0;
+        tess_cost_kdtree_exchange(master, assigner, times, wrap, cost);
+        return;
+    }
+
+    TESS_TRACE_SCOPE("tess_kdtree_exchange", -1, -1);
+    timing(times, EXCH_TIME, -1, master.communicator());
+
+    // points carry their attributes through the kd-tree only if there are any
+    // NB: assumes all blocks in memory, as does extract_kdtree_block
+    int num_attrs = 0;
+    for (size_t i = 0; i < master.size(); ++i)
+        num_attrs = std::max(num_attrs, master.block<DBlock>(i)->num_attrs);
+    int max_attrs;
+    MPI_Allreduce(&num_attrs, &max_attrs, 1, MPI_INT, MPI_MAX, master.communicator());
+    if (max_attrs > MAX_ATTRS)
+    {
+        fprintf(stderr, "Error: %d particle attributes exceeds MAX_ATTRS = %d\n",
+                max_attrs, MAX_ATTRS);
+        MPI_Abort(master.communicator(), 1);
+    }
+
+    if (max_attrs == 0)
+        kdtree_exchange<KDTreeBlock>(master, assigner, wrap, sampling);
+    else if (max_attrs <= KDTreeAttrBlock1::max_attrs)
+        kdtree_exchange<KDTreeAttrBlock1>(master, assigner, wrap, sampling);
+    else if (max_attrs <= KDTreeAttrBlock2::max_attrs)
+        kdtree_exchange<KDTreeAttrBlock2>(master, assigner, wrap, sampling);
+    else if (max_attrs <= KDTreeAttrBlock4::max_attrs)
+        kdtree_exchange<KDTreeAttrBlock4>(master, assigner, wrap, sampling);
+    else
+        kdtree_exchange<KDTreeAttrBlock>(master, assigner, wrap, sampling);
 
     timing(times, -1, EXCH_TIME, master.communicator());
 }
@@ -114,3 +191,638 @@ void tess_kdtree_exchange(diy::Master& master,
     double times[TESS_MAX_TIMES];
     tess_kdtree_exchange(master, assigner, times, wrap, sampling);
 }
+
+//
+// cost-driven k-d tree
+//
+
+// node of the cost-driven k-d tree; every process builds the whole tree
+struct CostKDNode
+{
+    diy::ContinuousBounds box;
+    int                   gid_min, gid_max;     // the node's blocks are [gid_min, gid_max)
+    int                   dim;                  // split dimension
+    float                 split;                // split coordinate
+    int                   left;                 // index of the left child, right is next; -1 = leaf
+
+    // split search: histogram range and number and weight of the points below it
+    float                 lo, hi;
+    double                below, below_weight;
+    double                total, total_weight;
+};
+
+// predicted cost of tessellating n points of total weight w in a box: the points themselves plus
+// the ghost points they pull in through the box faces, estimated as cost.ghost_layers layers of
+// the mean interparticle spacing (n / volume)^(-1/3) and weighted as the average point; faces on
+// the domain boundary have no ghosts unless the domain is periodic
+static double predicted_cost(double                         n,
+                             double                         w,
+                             const diy::ContinuousBounds&   box,
+                             const diy::ContinuousBounds&   domain,
+                             bool                           wrap,
+                             const kdtree_cost_t&           cost)
+{
+    double ext[3], vol = 1.0;
+    for (int d = 0; d < 3; ++d)
+    {
+        ext[d] = box.max[d] - box.min[d];
+        vol   *= ext[d];
+    }
+    if (n <= 0 || vol <= 0)
+        return w;
+
+    double surf = 0;
+    for (int d = 0; d < 3; ++d)
+    {
+        double area = ext[(d + 1) % 3] * ext[(d + 2) % 3];
+        if (wrap || box.min[d] > domain.min[d])
+            surf += area;
+        if (wrap || box.max[d] < domain.max[d])
+            surf += area;
+    }
+    double ghosts = cost.ghost_layers * surf * pow(n / vol, 2.0 / 3.0);
+
+    return w + cost.ghost * ghosts * (w / n);
+}
+
+// point location in the boxes of a cost map: a uniform grid over the domain whose cells list the
+// boxes that overlap them
+struct CostMapIndex
+{
+    CostMapIndex(const tess_cost_map_t& map_, const diy::ContinuousBounds& domain_):
+        map(map_), domain(domain_), mean(0)
+    {
+        int n = map.boxes.size(), nw = 0;
+        for (int i = 0; i < n; ++i)
+            if (map.weights[i] > 0)
+            {
+                mean += map.weights[i];
+                nw++;
+            }
+        mean = nw ? mean / nw : 1.0f;
+
+        g = std::min(64, std::max(1, 2 * (int)ceil(cbrt((double)n))));
+        cells.resize(g * g * g);
+        for (int i = 0; i < n; ++i)
+        {
+            int c0[3], c1[3];
+            for (int d = 0; d < 3; ++d)
+            {
+                c0[d] = cell(map.boxes[i].min[d], d);
+                c1[d] = cell(map.boxes[i].max[d], d);
+            }
+            for (int x = c0[0]; x <= c1[0]; ++x)
+                for (int y = c0[1]; y <= c1[1]; ++y)
+                    for (int z = c0[2]; z <= c1[2]; ++z)
+                        cells[(z * g + y) * g + x].push_back(i);
+        }
+    }
+
+    int         cell(float x, int d) const
+        {
+            int c = floor((x - domain.min[d]) / (domain.max[d] - domain.min[d]) * g);
+            return std::max(0, std::min(g - 1, c));
+        }
+
+    // measured cost of a point; the mean over the map where there is no measurement
+    float       weight(const float* p) const
+        {
+            const std::vector<int>& c = cells[(cell(p[2], 2) * g + cell(p[1], 1)) * g + cell(p[0], 0)];
+            for (size_t i = 0; i < c.size(); ++i)
+            {
+                const diy::ContinuousBounds& box = map.boxes[c[i]];
+                if (p[0] >= box.min[0] && p[0] <= box.max[0] &&
+                    p[1] >= box.min[1] && p[1] <= box.max[1] &&
+                    p[2] >= box.min[2] && p[2] <= box.max[2])
+                    return map.weights[c[i]] > 0 ? map.weights[c[i]] : mean;
+            }
+            return mean;
+        }
+
+    const tess_cost_map_t&              map;
+    diy::ContinuousBounds               domain;
+    float                               mean;
+    int                                 g;
+    std::vector< std::vector<int> >     cells;
+};
+
+// gathers the measured tessellation cost of all blocks (see DBlock::local_time), for weighing
+// the points of the next decomposition (kdtree_cost_t::map)
+//
+// the cost of a block is the time it spent in local_cells() and incomplete_cells(), spread
+// evenly over its original particles
+void tess_cost_map(diy::Master& master,
+                   const diy::Assigner& assigner,
+                   tess_cost_map_t& map)
+{
+    struct record_t
+    {
+        int   gid;
+        float box[6];
+        float weight;
+    };
+
+    std::vector<record_t> local(master.size());
+    master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+    {
+        record_t& r = local[cp.master()->lid(cp.gid())];
+        r.gid = cp.gid();
+        for (int d = 0; d < 3; ++d)
+        {
+            r.box[d]     = b->bounds.min[d];
+            r.box[3 + d] = b->bounds.max[d];
+        }
+        r.weight = b->num_orig_particles ?
+            (b->local_time + b->incomplete_time) / b->num_orig_particles : 0;
+    });
+
+    MPI_Comm comm = master.communicator();
+    int size;
+    MPI_Comm_size(comm, &size);
+    int nlocal = local.size() * sizeof(record_t);
+    std::vector<int> counts(size), displs(size + 1, 0);
+    MPI_Allgather(&nlocal, 1, MPI_INT, &counts[0], 1, MPI_INT, comm);
+    for (int i = 0; i < size; ++i)
+        displs[i + 1] = displs[i] + counts[i];
+
+    std::vector<record_t> all(displs[size] / sizeof(record_t) + 1);
+    MPI_Allgatherv(local.empty() ? NULL : &local[0], nlocal, MPI_BYTE,
+                   &all[0], &counts[0], &displs[0], MPI_BYTE, comm);
+
+    map.boxes.assign(assigner.nblocks(), diy::ContinuousBounds(3));
+    map.weights.assign(assigner.nblocks(), 0.0f);
+    for (size_t i = 0; i < displs[size] / sizeof(record_t); ++i)
+    {
+        const record_t& r = all[i];
+        for (int d = 0; d < 3; ++d)
+        {
+            map.boxes[r.gid].min[d] = r.box[d];
+            map.boxes[r.gid].max[d] = r.box[3 + d];
+        }
+        map.weights[r.gid] = r.weight;
+    }
+}
+
+// link of a block from the boxes of all blocks, by gid: all blocks whose boxes touch or overlap its
+// box, including across the periodic boundary if wrap is on (then possibly the block itself)
+// an empty box (min > max) touches nothing
+RCLink* touching_link(int                                          gid,
+                      const std::vector<diy::ContinuousBounds>&    boxes,
+                      const diy::ContinuousBounds&                 domain,
+                      const diy::Assigner&                         assigner,
+                      bool                                         wrap)
+{
+    const diy::ContinuousBounds& box = boxes[gid];
+    RCLink* link = new RCLink(3, box, box);
+
+    float size[3], eps[3];
+    for (int d = 0; d < 3; ++d)
+    {
+        size[d] = domain.max[d] - domain.min[d];
+        eps[d]  = 1e-5 * size[d];           // shifted boxes are touching up to rounding
+    }
+
+    int w = wrap ? 1 : 0;
+    for (int nbr = 0; nbr < (int)boxes.size(); ++nbr)
+        for (int i = -w; i <= w; ++i)
+        for (int j = -w; j <= w; ++j)
+        for (int k = -w; k <= w; ++k)
+        {
+            if (nbr == gid && !i && !j && !k)
+                continue;
+
+            int                 offset[3] = { i, j, k };
+            diy::Direction      dir, wrap_dir;
+            bool                touching = true;
+            for (int d = 0; d < 3; ++d)
+            {
+                float min = boxes[nbr].min[d] + offset[d] * size[d];
+                float max = boxes[nbr].max[d] + offset[d] * size[d];
+                if (min > box.max[d] + eps[d] || max < box.min[d] - eps[d])
+                    touching = false;
+                dir[d]      = (max <= box.min[d] + eps[d]) ? -1 : (min >= box.max[d] - eps[d]) ? 1 : 0;
+                wrap_dir[d] = offset[d];
+            }
+            if (!touching)
+                continue;
+
+            diy::BlockID bid;
+            bid.gid  = nbr;
+            bid.proc = assigner.rank(nbr);
+            link->add_neighbor(bid);
+            link->add_direction(dir);
+            link->add_bounds(boxes[nbr]);
+            link->add_wrap(wrap_dir);
+        }
+
+    return link;
+}
+
+// leaf of the cost k-d tree that contains a point
+static int find_leaf(const std::vector<CostKDNode>& nodes,
+                     const float*                   p)
+{
+    int n = 0;
+    while (nodes[n].left >= 0)
+        n = nodes[n].left + (p[nodes[n].dim] >= nodes[n].split ? 1 : 0);
+    return n;
+}
+
+// moves the particles of every block to the leaf of the tree that contains them, through the diy
+// queues, so that blocks can be out of core; every block first gets a temporary link to the blocks
+// it sends to and receives from
+static void send_to_leaves(diy::Master&                     master,
+                           const diy::Assigner&             assigner,
+                           const std::vector<CostKDNode>&   nodes)
+{
+    // destinations of every block
+    std::vector< std::vector<int> > dests(master.size());
+    master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+    {
+        std::vector<int>& d = dests[cp.master()->lid(cp.gid())];
+        for (int j = 0; j < b->num_particles; ++j)
+            d.push_back(nodes[find_leaf(nodes, &b->particles[3 * j])].gid_min);
+        std::sort(d.begin(), d.end());
+        d.erase(std::unique(d.begin(), d.end()), d.end());
+    });
+
+    // sources of every block: send the (destination, source) pairs to the destination's process
+    MPI_Comm comm = master.communicator();
+    int size;
+    MPI_Comm_size(comm, &size);
+    std::vector< std::vector<int> > pairs(size);
+    for (size_t i = 0; i < master.size(); ++i)
+        for (size_t j = 0; j < dests[i].size(); ++j)
+            if (dests[i][j] != master.gid(i))
+            {
+                pairs[assigner.rank(dests[i][j])].push_back(dests[i][j]);
+                pairs[assigner.rank(dests[i][j])].push_back(master.gid(i));
+            }
+    std::vector<int> send_counts(size), send_displs(size + 1, 0), send;
+    for (int r = 0; r < size; ++r)
+    {
+        send_counts[r]     = pairs[r].size();
+        send_displs[r + 1] = send_displs[r] + send_counts[r];
+        send.insert(send.end(), pairs[r].begin(), pairs[r].end());
+    }
+    std::vector<int> recv_counts(size), recv_displs(size + 1, 0);
+    MPI_Alltoall(&send_counts[0], 1, MPI_INT, &recv_counts[0], 1, MPI_INT, comm);
+    for (int r = 0; r < size; ++r)
+        recv_displs[r + 1] = recv_displs[r] + recv_counts[r];
+    std::vector<int> recv(recv_displs[size] + 1);
+    send.push_back(0);
+    MPI_Alltoallv(&send[0], &send_counts[0], &send_displs[0], MPI_INT,
+                  &recv[0], &recv_counts[0], &recv_displs[0], MPI_INT, comm);
+
+    // temporary links: the union of the destinations and the sources, so that links are symmetric
+    std::vector< std::vector<int> > nbrs(dests);
+    for (int j = 0; j < recv_displs[size]; j += 2)
+        nbrs[master.lid(recv[j])].push_back(recv[j + 1]);
+    for (size_t i = 0; i < master.size(); ++i)
+    {
+        std::vector<int>& n = nbrs[i];
+        n.erase(std::remove(n.begin(), n.end(), master.gid(i)), n.end());
+        std::sort(n.begin(), n.end());
+        n.erase(std::unique(n.begin(), n.end()), n.end());
+
+        diy::Link* link = new diy::Link;
+        for (size_t j = 0; j < n.size(); ++j)
+        {
+            diy::BlockID bid;
+            bid.gid  = n[j];
+            bid.proc = assigner.rank(n[j]);
+            link->add_neighbor(bid);
+        }
+        master.replace_link(i, link);
+    }
+
+    // bucket the particles by destination with a counting sort and enqueue each slice
+    // message format: number of points, then their coordinates, then their attributes
+    master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+    {
+        make_writable(b);
+        int                     na   = b->num_attrs;
+        diy::Link*              link = cp.link();
+        std::vector<int>        loc(b->num_particles);
+        std::vector<int>        offsets(link->size() + 2, 0);     // last slot: this block
+        for (int j = 0; j < b->num_particles; ++j)
+        {
+            int gid = nodes[find_leaf(nodes, &b->particles[3 * j])].gid_min;
+            loc[j]  = (gid == cp.gid()) ? link->size() : link->find(gid);
+            offsets[loc[j] + 1]++;
+        }
+        for (size_t k = 0; k < link->size() + 1; ++k)
+            offsets[k + 1] += offsets[k];
+
+        float* particles = (float*)tess_malloc((size_t)b->num_particles * 3 * sizeof(float),
+                                               MEM_EXCHANGE);
+        float* attrs     = na ? (float*)tess_malloc((size_t)b->num_particles * na * sizeof(float),
+                                                    MEM_EXCHANGE) : NULL;
+        std::vector<int> pos(offsets.begin(), offsets.end() - 1);
+        for (int j = 0; j < b->num_particles; ++j)
+        {
+            int p = pos[loc[j]]++;
+            memcpy(&particles[3 * p], &b->particles[3 * j], 3 * sizeof(float));
+            if (na)
+                memcpy(&attrs[na * p], &b->attrs[na * j], na * sizeof(float));
+        }
+
+        for (size_t k = 0; k < link->size(); ++k)
+        {
+            int npts = offsets[k + 1] - offsets[k];
+            cp.enqueue(link->target(k), npts);
+            if (npts)
+            {
+                cp.enqueue(link->target(k), particles + 3 * offsets[k], 3 * npts);
+                if (na)
+                    cp.enqueue(link->target(k), attrs + na * offsets[k], na * npts);
+            }
+        }
+
+        // keep own points
+        int npts = offsets[link->size() + 1] - offsets[link->size()];
+        tess_free(b->particles);
+        tess_free(b->attrs);
+        b->particles = (float*)tess_malloc((size_t)npts * 3 * sizeof(float), MEM_PARTICLES);
+        b->attrs     = na ? (float*)tess_malloc((size_t)npts * na * sizeof(float), MEM_PARTICLES) :
+                            NULL;
+        memcpy(b->particles, particles + 3 * offsets[link->size()],
+               (size_t)npts * 3 * sizeof(float));
+        if (na)
+            memcpy(b->attrs, attrs + na * offsets[link->size()], (size_t)npts * na * sizeof(float));
+        b->num_particles = b->num_orig_particles = npts;
+        tess_free(particles);
+        tess_free(attrs);
+    });
+
+    master.exchange();
+
+    master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+    {
+        int         na   = b->num_attrs;
+        diy::Link*  link = cp.link();
+        std::vector<int> npts(link->size());
+        long long tot = 0;
+        for (size_t k = 0; k < link->size(); ++k)
+        {
+            cp.dequeue(link->target(k).gid, npts[k]);
+            tot += npts[k];
+        }
+        check_num_particles(b, tot);
+        b->particles = (float*)tess_realloc(b->particles,
+                                            (size_t)(b->num_particles + tot) * 3 * sizeof(float),
+                                            MEM_PARTICLES);
+        if (na)
+            b->attrs = (float*)tess_realloc(b->attrs,
+                                            (size_t)(b->num_particles + tot) * na * sizeof(float),
+                                            MEM_PARTICLES);
+        for (size_t k = 0; k < link->size(); ++k)
+        {
+            if (!npts[k])
+                continue;
+            cp.dequeue(link->target(k).gid, b->particles + 3 * b->num_particles, 3 * npts[k]);
+            if (na)
+                cp.dequeue(link->target(k).gid, b->attrs + na * b->num_particles, na * npts[k]);
+            b->num_particles += npts[k];
+        }
+        b->num_orig_particles = b->num_particles;
+    });
+}
+
+// k-d tree decomposition that balances the predicted tessellation cost of the blocks (see
+// predicted_cost()) instead of their number of points
+//
+// with a cost map (kdtree_cost_t::map), points are weighted by the measured cost of the block
+// that contained them in a previous tessellation, e.g., of the previous time step, which moves
+// the split planes away from the blocks that were stragglers; the measured cost already includes
+// ghosts, so cost.ghost then only accounts for the change in block shapes and can be lowered;
+// with cost.ghost = 0 and no map, this is a plain k-d tree balancing the number of points
+//
+// every process builds the whole tree: each level takes one allreduce of the histograms of all
+// nodes of the level along their longest dimension, plus cost.refine allreduces of finer
+// histograms around the best split so far; a node with n blocks is split so that its two halves
+// of floor(n / 2) and ceil(n / 2) blocks have the same predicted cost per block
+//
+// blocks are only accessed through foreach() and particles move through the diy queues, so
+// blocks can be out of core; no per-point state is kept between passes (points find their node
+// by descending the tree)
+// the links are rebuilt from the leaf boxes and include all periodic neighbors, the block itself
+// included, so wrap works with any number of blocks
+void tess_cost_kdtree_exchange(diy::Master& master,
+                               const diy::Assigner& assigner,
+                               double* times,
+                               bool wrap,
+                               const kdtree_cost_t& cost)
+{
+    TESS_TRACE_SCOPE("tess_cost_kdtree_exchange", -1, -1);
+    timing(times, EXCH_TIME, -1, master.communicator());
+
+    int nblocks = assigner.nblocks();
+    int bins    = cost.bins;
+
+    // data bounds are the same in every block
+    diy::ContinuousBounds domain(3);
+    float dmin[3] = {  std::numeric_limits<float>::max(),  std::numeric_limits<float>::max(),
+                       std::numeric_limits<float>::max() };
+    float dmax[3] = { -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(),
+                      -std::numeric_limits<float>::max() };
+    std::mutex mutex;
+    master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int d = 0; d < 3; ++d)
+        {
+            dmin[d] = std::min(dmin[d], b->data_bounds.min[d]);
+            dmax[d] = std::max(dmax[d], b->data_bounds.max[d]);
+        }
+    });
+    float gmin[3], gmax[3];
+    MPI_Allreduce(dmin, gmin, 3, MPI_FLOAT, MPI_MIN, master.communicator());
+    MPI_Allreduce(dmax, gmax, 3, MPI_FLOAT, MPI_MAX, master.communicator());
+    for (int d = 0; d < 3; ++d)
+    {
+        domain.min[d] = gmin[d];
+        domain.max[d] = gmax[d];
+    }
+
+    std::vector<CostKDNode> nodes(1);
+    nodes[0].box     = domain;
+    nodes[0].gid_min = 0;
+    nodes[0].gid_max = nblocks;
+    nodes[0].left    = -1;
+
+    // point weights from the measured cost of a previous tessellation
+    CostMapIndex* index = cost.map ? new CostMapIndex(*cost.map, domain) : NULL;
+
+    std::vector<int> active;
+    if (nblocks > 1)
+        active.push_back(0);
+
+    while (!active.empty())
+    {
+        std::vector<int> slot(nodes.size(), -1);
+        for (size_t a = 0; a < active.size(); ++a)
+        {
+            CostKDNode& n = nodes[active[a]];
+            n.dim = 0;
+            for (int d = 1; d < 3; ++d)
+                if (n.box.max[d] - n.box.min[d] > n.box.max[n.dim] - n.box.min[n.dim])
+                    n.dim = d;
+            n.lo    = n.box.min[n.dim];
+            n.hi    = n.box.max[n.dim];
+            n.below = n.below_weight = 0;
+            n.split = (n.lo + n.hi) / 2;
+            slot[active[a]] = a;
+        }
+
+        // point counts of all active nodes, followed by their weights
+        size_t              nh = active.size() * bins;
+        std::vector<double> hist(2 * nh), global_hist(2 * nh);
+        for (int pass = 0; pass <= cost.refine; ++pass)
+        {
+            // histograms of the active nodes over their search ranges; the first pass covers
+            // the whole node, points outside the domain go to the end bins
+            std::fill(hist.begin(), hist.end(), 0.0);
+            master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+            {
+                std::vector< std::pair<size_t, float> > h;      // (bin, weight)
+                for (int j = 0; j < b->num_particles; ++j)
+                {
+                    const float* p = &b->particles[3 * j];
+                    int          l = find_leaf(nodes, p);
+                    int          a = slot[l];
+                    if (a < 0)
+                        continue;
+                    const CostKDNode& n = nodes[l];
+                    if (n.hi <= n.lo)
+                        continue;
+                    int bin = floor((p[n.dim] - n.lo) / (n.hi - n.lo) * bins);
+                    if (pass == 0)
+                        bin = std::max(0, std::min(bins - 1, bin));
+                    else if (bin < 0 || bin >= bins)
+                        continue;
+                    h.push_back(std::make_pair(a * bins + bin, index ? index->weight(p) : 1.0f));
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                for (size_t k = 0; k < h.size(); ++k)
+                {
+                    hist[h[k].first]      += 1.0;
+                    hist[nh + h[k].first] += h[k].second;
+                }
+            });
+            MPI_Allreduce(&hist[0], &global_hist[0], hist.size(), MPI_DOUBLE, MPI_SUM,
+                          master.communicator());
+
+            // best split among the bin edges
+            for (size_t a = 0; a < active.size(); ++a)
+            {
+                CostKDNode& n  = nodes[active[a]];
+                const double* h = &global_hist[a * bins];
+                const double* hw = &global_hist[nh + a * bins];
+                if (pass == 0)
+                {
+                    n.total = n.total_weight = 0;
+                    for (int k = 0; k < bins; ++k)
+                    {
+                        n.total        += h[k];
+                        n.total_weight += hw[k];
+                    }
+                }
+                if (n.hi <= n.lo)
+                    continue;
+
+                int    nl = (n.gid_max - n.gid_min) / 2;
+                int    nr = (n.gid_max - n.gid_min) - nl;
+                diy::ContinuousBounds left = n.box, right = n.box;
+
+                std::vector<double> cum(bins + 1), cum_weight(bins + 1);
+                cum[0]        = n.below;
+                cum_weight[0] = n.below_weight;
+                for (int k = 0; k < bins; ++k)
+                {
+                    cum[k + 1]        = cum[k] + h[k];
+                    cum_weight[k + 1] = cum_weight[k] + hw[k];
+                }
+
+                int    best     = -1;
+                double best_obj = 0;
+                for (int k = 0; k <= bins; ++k)
+                {
+                    float x = n.lo + (n.hi - n.lo) * k / bins;
+                    left.max[n.dim]  = x;
+                    right.min[n.dim] = x;
+                    double obj = std::max(predicted_cost(cum[k], cum_weight[k],
+                                                         left, domain, wrap, cost) / nl,
+                                          predicted_cost(n.total - cum[k], n.total_weight - cum_weight[k],
+                                                         right, domain, wrap, cost) / nr);
+                    if (best < 0 || obj < best_obj)
+                    {
+                        best     = k;
+                        best_obj = obj;
+                    }
+                }
+
+                // without any points, keep the midpoint
+                if (n.total > 0)
+                    n.split = n.lo + (n.hi - n.lo) * best / bins;
+
+                // refine around the best edge
+                int   k0 = std::max(best - 1, 0);
+                int   k1 = std::min(best + 1, bins);
+                float lo = n.lo + (n.hi - n.lo) * k0 / bins;
+                float hi = n.lo + (n.hi - n.lo) * k1 / bins;
+                n.below         = cum[k0];
+                n.below_weight  = cum_weight[k0];
+                n.lo     = lo;
+                n.hi     = hi;
+            }
+        }
+
+        // split the active nodes
+        std::vector<int> next;
+        for (size_t a = 0; a < active.size(); ++a)
+        {
+            int l = nodes.size();
+            nodes.resize(l + 2);
+            CostKDNode& n = nodes[active[a]];
+            n.left = l;
+
+            int nl = (n.gid_max - n.gid_min) / 2;
+            nodes[l]     = n;
+            nodes[l + 1] = n;
+            nodes[l].box.max[n.dim]     = n.split;
+            nodes[l].gid_max            = n.gid_min + nl;
+            nodes[l + 1].box.min[n.dim] = n.split;
+            nodes[l + 1].gid_min        = n.gid_min + nl;
+            nodes[l].left = nodes[l + 1].left = -1;
+
+            if (nodes[l].gid_max - nodes[l].gid_min > 1)
+                next.push_back(l);
+            if (nodes[l + 1].gid_max - nodes[l + 1].gid_min > 1)
+                next.push_back(l + 1);
+        }
+        active.swap(next);
+    }
+    delete index;
+
+    // move the particles to their leaves
+    send_to_leaves(master, assigner, nodes);
+
+    std::vector<diy::ContinuousBounds> boxes(nblocks);
+    for (size_t n = 0; n < nodes.size(); ++n)
+        if (nodes[n].left < 0)
+            boxes[nodes[n].gid_min] = nodes[n].box;
+    master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+    {
+        for (int d = 0; d < 3; ++d)
+        {
+            b->box.min[d]    = b->bounds.min[d] = boxes[cp.gid()].min[d];
+            b->box.max[d]    = b->bounds.max[d] = boxes[cp.gid()].max[d];
+        }
+    });
+    for (size_t i = 0; i < master.size(); ++i)
+        master.replace_link(i, touching_link(master.gid(i), boxes, domain, assigner, wrap));
+
+    timing(times, -1, EXCH_TIME, master.communicator());
+}
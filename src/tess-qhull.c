@@ -31,13 +31,14 @@ void local_cells(struct dblock_t *dblock)
   FILE *dev_null; /* file descriptor for writing to /dev/null */
   int i, j;
   int dim = 3; /* 3d */
+  struct tess_scratch_mark_t mark = tess_scratch_mark();
 
   dev_null = fopen("/dev/null", "w");
   assert(dev_null != NULL);
 
-  /* deep copy from float to double (qhull API is double) */
+  /* deep copy from float to double (qhull API is double), in scratch memory */
   double *pts =
-    (double *)malloc(dblock->num_particles * 3 * sizeof(double));
+    (double *)tess_scratch_alloc((size_t)dblock->num_particles * 3 * sizeof(double));
   for (j = 0; j < 3 * dblock->num_particles; j++)
     pts[j] = dblock->particles[j];
 
@@ -49,7 +50,7 @@ void local_cells(struct dblock_t *dblock)
   exitcode = qh_new_qhull(dim, dblock->num_particles, pts, ismalloc,
                           flags, dev_null, stderr);
 
-  free(pts);
+  tess_scratch_release(mark);
 
   /* process delaunay output */
   if (!exitcode)
@@ -72,6 +73,23 @@ void local_cells(struct dblock_t *dblock)
 
 }
 /*--------------------------------------------------------------------------*/
+/*
+  moves the vertices of the particles whose positions changed (tess_update)
+
+  qhull keeps no triangulation between calls and local_cells() recomputes it from the
+  particles, so there is nothing to move
+
+  dblock: local block
+  moved, num_moved: indices of the particles that moved
+  in_place, reinserted: (output) number of vertices moved in place, removed and reinserted
+*/
+void move_vertices(struct dblock_t *dblock, const int *moved, int num_moved, int *in_place,
+                   int *reinserted)
+{
+  *in_place = 0;
+  *reinserted = 0;
+}
+/*--------------------------------------------------------------------------*/
 /*
   generates delaunay output from qhull
 
@@ -96,7 +114,9 @@ void gen_delaunay_output(facetT *facetlist, struct dblock_t *dblock) {
   }
 
   dblock->num_tets = numfacets;
-  dblock->tets = (struct tet_t *)malloc(numfacets * sizeof(struct tet_t));
+  /* reuses the tets of the previous round (see reset_block) */
+  dblock->tets = (struct tet_t *)tess_reserve(dblock->tets,
+                                              (size_t)numfacets * sizeof(struct tet_t), MEM_TETS);
 
   /* for all tets, get vertices */
   t = 0;
@@ -1,38 +1,68 @@
 #include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 
 #include <diy/reduce.hpp>
 #include <diy/partners/swap.hpp>
 
 #include "tess/tess.hpp"
 
+// one round of the swap-based redistribution
+//
+// the outgoing particles are bucketed by destination with a two-pass counting sort (histogram,
+// prefix sum, scatter into one buffer) and each destination's contiguous slice is enqueued as is;
+// incoming particles are dequeued straight into the block arrays, grown once per round
+//
+// message format: number of points, then their coordinates, then their attributes
 void redistribute(void* b_,
                   const diy::ReduceProxy& srp,
                   const diy::RegularSwapPartners& partners)
 {
     DBlock*                   b        = static_cast<DBlock*>(b_);
     unsigned                  round    = srp.round();
+    int                       na       = b->num_attrs;
+    TESS_TRACE_SCOPE("redistribute", srp.gid(), round);
+
+    make_writable(b);        // particles get reallocated below
 
     //fprintf(stderr, "in_link.size():  %d\n", srp.in_link().size());
     //fprintf(stderr, "out_link.size(): %d\n", srp.out_link().size());
 
     // step 1: dequeue and merge
-    // dequeue all the incoming points and add them to this block's vector
-    // could use srp.incoming() instead
+    // sizes first, so that the block arrays are grown once
+    std::vector<int> in_npts(srp.in_link().size(), 0);
+    long long        tot_in = 0;
     for (unsigned i = 0; i < srp.in_link().size(); ++i)
     {
         int nbr_gid = srp.in_link().target(i).gid;
         if (nbr_gid == srp.gid())
             continue;
-
-        std::vector<float>    in_points;
-        srp.dequeue(nbr_gid, in_points);
-        int npts = in_points.size() / 3;
+        srp.dequeue(nbr_gid, in_npts[i]);
+        tot_in += in_npts[i];
+    }
+    check_num_particles(b, tot_in);
+    if (tot_in)
+    {
+        b->particles = (float *)tess_realloc(b->particles,
+                                             (size_t)(b->num_particles + tot_in) * 3 * sizeof(float),
+                                             MEM_PARTICLES);
+        if (na)
+            b->attrs = (float *)tess_realloc(b->attrs,
+                                             (size_t)(b->num_particles + tot_in) * na * sizeof(float),
+                                             MEM_PARTICLES);
+    }
+    for (unsigned i = 0; i < srp.in_link().size(); ++i)
+    {
+        int npts = in_npts[i];
+        if (!npts)
+            continue;
+        int nbr_gid = srp.in_link().target(i).gid;
 
         //fprintf(stderr, "[%d] Received %d points from [%d]\n", srp.gid(), npts, nbr_gid);
-        b->particles = (float *)realloc(b->particles, (b->num_particles + npts) * 3 * sizeof(float));
-        size_t o = b->num_particles * 3;
-        for (size_t j = 0; j < in_points.size(); ++j)
-            b->particles[o++] = in_points[j];
+        srp.dequeue(nbr_gid, b->particles + 3 * b->num_particles, 3 * npts);
+        if (na)
+            srp.dequeue(nbr_gid, b->attrs + na * b->num_particles, na * npts);
         b->num_particles += npts;
     }
     b->num_orig_particles = b->num_particles;
@@ -42,63 +72,104 @@ void redistribute(void* b_,
     if (srp.out_link().size() == 0)        // final round; nothing needs to be sent
         return;
 
-    std::vector< std::vector<float> > out_points(srp.out_link().size());
     int group_size = srp.out_link().size();
     int cur_dim    = partners.dim(round);
+
+    // pass 1: destination of every point and histogram of destinations
+    std::vector<int> locs(b->num_particles);
+    std::vector<int> offsets(group_size + 1, 0);
     for (size_t i = 0; i < b->num_particles; ++i)
     {
         int loc = floor((b->particles[3*i + cur_dim] - b->box.min[cur_dim]) /
                         (b->box.max[cur_dim] - b->box.min[cur_dim]) *
                         group_size);
-        if ((loc >= out_points.size() && b->particles[3*i + cur_dim] > b->box.max[cur_dim]) ||
+        if ((loc >= group_size && b->particles[3*i + cur_dim] > b->box.max[cur_dim]) ||
             loc < 0)
-            fprintf(stderr, "Warning: loc=%d < 0 || loc >= %lu : %f vs [%f,%f]\n",
-                    loc, out_points.size(),
+            fprintf(stderr, "Warning: loc=%d < 0 || loc >= %d : %f vs [%f,%f]\n",
+                    loc, group_size,
                     b->particles[3*i + cur_dim],
                     b->box.min[cur_dim], b->box.max[cur_dim]
                 );
-        if (loc == out_points.size())
-            loc -= 1;
+        if (loc >= group_size)
+            loc = group_size - 1;
         if (loc < 0)
             loc = 0;
 
-        out_points[loc].push_back(b->particles[3*i]);
-        out_points[loc].push_back(b->particles[3*i + 1]);
-        out_points[loc].push_back(b->particles[3*i + 2]);
+        locs[i] = loc;
+        offsets[loc + 1]++;
     }
-    int pos = -1;
     for (int i = 0; i < group_size; ++i)
+        offsets[i + 1] += offsets[i];
+
+    // pass 2: scatter into buffers grouped by destination
+    float* particles = (float *)tess_malloc((size_t)b->num_particles * 3 * sizeof(float),
+                                            MEM_PARTICLES);
+    float* attrs     = na ? (float *)tess_malloc((size_t)b->num_particles * na * sizeof(float),
+                                                 MEM_PARTICLES) : NULL;
+    std::vector<int> pos(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < b->num_particles; ++i)
     {
+        int j = pos[locs[i]]++;
+        particles[3*j    ] = b->particles[3*i    ];
+        particles[3*j + 1] = b->particles[3*i + 1];
+        particles[3*j + 2] = b->particles[3*i + 2];
+        for (int k = 0; k < na; ++k)
+            attrs[na*j + k] = b->attrs[na*i + k];
+    }
+    tess_free(b->particles);
+    tess_free(b->attrs);
+    b->particles = particles;
+    b->attrs     = attrs;
+
+    int pos_self = -1;
+    for (int i = 0; i < group_size; ++i)
+    {
+        int npts = offsets[i + 1] - offsets[i];
         if (srp.out_link().target(i).gid == srp.gid())
         {
-            b->particles     = (float *)realloc(b->particles, out_points[i].size() * sizeof(float));
-            for (size_t j = 0; j < out_points[i].size(); ++j)
-                b->particles[j] = out_points[i][j];
-            b->num_particles = out_points[i].size() / 3;
-            b->num_orig_particles = b->num_particles;
-            pos = i;
+            pos_self = i;
+            continue;
         }
-        else
+        srp.enqueue(srp.out_link().target(i), npts);
+        if (npts)
         {
-            srp.enqueue(srp.out_link().target(i), out_points[i]);
-            //fprintf(stderr, "[%d] Sent %d points to [%d]\n", srp.gid(), (int) out_points[i].size() / 3, srp.out_link().target(i).gid);
+            srp.enqueue(srp.out_link().target(i), b->particles + 3 * offsets[i], 3 * npts);
+            if (na)
+                srp.enqueue(srp.out_link().target(i), b->attrs + na * offsets[i], na * npts);
         }
+        //fprintf(stderr, "[%d] Sent %d points to [%d]\n", srp.gid(), npts, srp.out_link().target(i).gid);
     }
-    float new_min = b->box.min[cur_dim] + (b->box.max[cur_dim] - b->box.min[cur_dim])/group_size*pos;
-    float new_max = b->box.min[cur_dim] + (b->box.max[cur_dim] - b->box.min[cur_dim])/group_size*(pos + 1);
+
+    // keep own slice
+    int npts = offsets[pos_self + 1] - offsets[pos_self];
+    memmove(b->particles, b->particles + 3 * offsets[pos_self], (size_t)npts * 3 * sizeof(float));
+    b->particles = (float *)tess_realloc(b->particles, (size_t)npts * 3 * sizeof(float),
+                                         MEM_PARTICLES);
+    if (na)
+    {
+        memmove(b->attrs, b->attrs + na * offsets[pos_self], (size_t)npts * na * sizeof(float));
+        b->attrs = (float *)tess_realloc(b->attrs, (size_t)npts * na * sizeof(float), MEM_PARTICLES);
+    }
+    b->num_particles = npts;
+    b->num_orig_particles = b->num_particles;
+
+    float new_min = b->box.min[cur_dim] + (b->box.max[cur_dim] - b->box.min[cur_dim])/group_size*pos_self;
+    float new_max = b->box.min[cur_dim] + (b->box.max[cur_dim] - b->box.min[cur_dim])/group_size*(pos_self + 1);
     b->box.min[cur_dim] = new_min;
     b->box.max[cur_dim] = new_max;
 }
 
+// k: radix of the swap reduction; fewer, wider rounds trade message count for round count
 void tess_exchange(diy::Master& master,
                    const diy::Assigner& assigner,
-                   double* times)
+                   double* times,
+                   int k)
 {
     int rank, size;
     MPI_Comm_rank(master.communicator(), &rank);
     MPI_Comm_size(master.communicator(), &size);
+    TESS_TRACE_SCOPE("tess_exchange", -1, -1);
     timing(times, EXCH_TIME, -1, master.communicator());
-    int k = 2;
 
     diy::ContinuousBounds                       domain =
         master.block<DBlock>(master.loaded_block())->data_bounds;
@@ -115,3 +186,175 @@ void tess_exchange(diy::Master& master,
     double times[TESS_MAX_TIMES];
     tess_exchange(master, assigner, times);
 }
+
+// gid of the block of a regular decomposition of domain that contains a point
+// points outside the domain go to the nearest block, as in redistribute()
+static int point_to_gid(const float*                       p,
+                        const diy::ContinuousBounds&       domain,
+                        const std::vector<int>&            divs)
+{
+    int gid    = 0;
+    int stride = 1;
+    for (int d = 0; d < 3; ++d)
+    {
+        int c = floor((p[d] - domain.min[d]) / (domain.max[d] - domain.min[d]) * divs[d]);
+        c = std::max(0, std::min(divs[d] - 1, c));
+        gid    += c * stride;
+        stride *= divs[d];
+    }
+    return gid;
+}
+
+// moves every particle of the local blocks to the block with the gid in dests, which has an entry
+// for every particle of every local block, in local block order
+//
+// particles are bucketed by destination process with a two-pass counting sort and moved with a
+// single MPI_Alltoallv; the particles of every local block are replaced by those it receives
+// requires all blocks in memory
+void send_particles(diy::Master& master,
+                    const diy::Assigner& assigner,
+                    std::vector< std::vector<int> >& dests)
+{
+    MPI_Comm comm = master.communicator();
+    int size;
+    MPI_Comm_size(comm, &size);
+
+    int na = 0, max_na;
+    for (size_t i = 0; i < master.size(); ++i)
+        na = std::max(na, master.block<DBlock>(i)->num_attrs);
+    MPI_Allreduce(&na, &max_na, 1, MPI_INT, MPI_MAX, comm);
+    na = max_na;
+
+    // a record is the destination gid followed by the coordinates and attributes
+    int rec = 1 + 3 + na;
+    MPI_Datatype rec_type;
+    MPI_Type_contiguous(rec * sizeof(float), MPI_BYTE, &rec_type);
+    MPI_Type_commit(&rec_type);
+
+    // pass 1: count the particles going to each process
+    std::vector<int> send_counts(size, 0);
+    for (size_t i = 0; i < master.size(); ++i)
+        for (size_t j = 0; j < dests[i].size(); ++j)
+            send_counts[assigner.rank(dests[i][j])]++;
+
+    std::vector<int> send_displs(size + 1, 0);
+    for (int r = 0; r < size; ++r)
+        send_displs[r + 1] = send_displs[r] + send_counts[r];
+
+    // pass 2: scatter the records into one buffer, grouped by destination process
+    std::vector<float> send(std::max(1, send_displs[size]) * rec);
+    tess_mem_track(&send[0], send.size() * sizeof(float), MEM_EXCHANGE);
+    std::vector<int>   pos(send_displs.begin(), send_displs.end() - 1);
+    for (size_t i = 0; i < master.size(); ++i)
+    {
+        DBlock* b = master.block<DBlock>(i);
+        for (int j = 0; j < b->num_particles; ++j)
+        {
+            float* r = &send[(size_t)pos[assigner.rank(dests[i][j])]++ * rec];
+            memcpy(r, &dests[i][j], sizeof(int));
+            memcpy(r + 1, &b->particles[3 * j], 3 * sizeof(float));
+            for (int k = 0; k < na; ++k)
+                r[4 + k] = k < b->num_attrs ? b->attrs[b->num_attrs * j + k] : 0.0f;
+        }
+        std::vector<int>().swap(dests[i]);
+    }
+
+    std::vector<int> recv_counts(size);
+    MPI_Alltoall(&send_counts[0], 1, MPI_INT, &recv_counts[0], 1, MPI_INT, comm);
+    std::vector<int> recv_displs(size + 1, 0);
+    for (int r = 0; r < size; ++r)
+        recv_displs[r + 1] = recv_displs[r] + recv_counts[r];
+
+    std::vector<float> recv(std::max(1, recv_displs[size]) * rec);
+    tess_mem_track(&recv[0], recv.size() * sizeof(float), MEM_EXCHANGE);
+    MPI_Alltoallv(&send[0], &send_counts[0], &send_displs[0], rec_type,
+                  &recv[0], &recv_counts[0], &recv_displs[0], rec_type, comm);
+    tess_mem_untrack(&send[0]);
+    std::vector<float>().swap(send);
+    MPI_Type_free(&rec_type);
+
+    // count the received particles of each local block and replace the block particles
+    int nrecv = recv_displs[size];
+    std::vector<int> block_counts(master.size(), 0);
+    std::vector<int> lids(nrecv);
+    for (int j = 0; j < nrecv; ++j)
+    {
+        int gid;
+        memcpy(&gid, &recv[(size_t)j * rec], sizeof(int));
+        lids[j] = master.lid(gid);
+        block_counts[lids[j]]++;
+    }
+
+    for (size_t i = 0; i < master.size(); ++i)
+    {
+        DBlock* b = master.block<DBlock>(i);
+        make_writable(b);
+        tess_free(b->particles);
+        tess_free(b->attrs);
+        b->num_attrs          = na;
+        b->num_particles      = block_counts[i];
+        b->num_orig_particles = block_counts[i];
+        b->particles          = (float*)tess_malloc((size_t)block_counts[i] * 3 * sizeof(float),
+                                                    MEM_PARTICLES);
+        b->attrs              = na ? (float*)tess_malloc((size_t)block_counts[i] * na * sizeof(float),
+                                                         MEM_PARTICLES) : NULL;
+        block_counts[i] = 0;
+    }
+
+    for (int j = 0; j < nrecv; ++j)
+    {
+        DBlock*      b = master.block<DBlock>(lids[j]);
+        size_t       p = block_counts[lids[j]]++;
+        const float* r = &recv[(size_t)j * rec];
+        memcpy(&b->particles[3 * p], r + 1, 3 * sizeof(float));
+        if (na)
+            memcpy(&b->attrs[na * p], r + 4, na * sizeof(float));
+    }
+    tess_mem_untrack(&recv[0]);
+}
+
+// sends every particle straight to the block of the regular decomposition that contains it
+//
+// a drop-in replacement for tess_exchange() when all blocks are in memory: the destination of a
+// particle depends only on its coordinates, so instead of log_k(nblocks) rounds of swaps, in
+// which a particle may move again and again, all particles move once (see send_particles())
+void tess_direct_exchange(diy::Master& master,
+                          const diy::Assigner& assigner,
+                          double* times)
+{
+    TESS_TRACE_SCOPE("tess_direct_exchange", -1, -1);
+    timing(times, EXCH_TIME, -1, master.communicator());
+
+    diy::ContinuousBounds                       domain =
+        master.block<DBlock>(master.loaded_block())->data_bounds;
+    diy::RegularDecomposer<diy::ContinuousBounds> decomposer(3, domain, assigner.nblocks());
+    const std::vector<int>&                     divs = decomposer.divisions;
+
+    std::vector< std::vector<int> > dests(master.size());
+    for (size_t i = 0; i < master.size(); ++i)
+    {
+        DBlock* b = master.block<DBlock>(i);
+        dests[i].resize(b->num_particles);
+        for (int j = 0; j < b->num_particles; ++j)
+            dests[i][j] = point_to_gid(&b->particles[3 * j], domain, divs);
+    }
+
+    send_particles(master, assigner, dests);
+
+    // the box of a block is its cell of the regular decomposition, as after the swaps
+    for (size_t i = 0; i < master.size(); ++i)
+    {
+        DBlock* b   = master.block<DBlock>(i);
+        int     gid = master.gid(i);
+        for (int d = 0; d < 3; ++d)
+        {
+            int   c = gid % divs[d];
+            float w = (domain.max[d] - domain.min[d]) / divs[d];
+            gid /= divs[d];
+            b->box.min[d] = domain.min[d] + w * c;
+            b->box.max[d] = domain.min[d] + w * (c + 1);
+        }
+    }
+
+    timing(times, -1, EXCH_TIME, master.communicator());
+}
@@ -0,0 +1,272 @@
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdint.h>
+
+#include "tess/tess.hpp"
+
+// decomposition along a space-filling curve
+//
+// particles are quantized to a 2^SFC_BITS grid over the domain and ordered by their Morton or
+// Hilbert key; a sample sort cuts the curve into nblocks contiguous segments of about the same
+// number of particles, and every particle moves straight to the block of its segment
+//
+// the bounds of a block are the bounding box of its curve segment, so the bounds of neighboring
+// blocks overlap (incomplete_cells() tests for this), but every point of the domain lies in the
+// segment of exactly one block
+
+#define SFC_BITS        21              // bits per dimension, 3 * SFC_BITS bits per key
+#define SFC_SAMPLES     64              // samples per block for choosing the splitters
+
+// key of a point on the quantized grid
+// Hilbert keys follow Skilling, "Programming the Hilbert curve", AIP Conf. Proc. 707, 2004
+static uint64_t sfc_key(const uint32_t* q,
+                        bool            hilbert)
+{
+    uint32_t x[3] = { q[0], q[1], q[2] };
+
+    if (hilbert)
+    {
+        // inverse undo
+        for (uint32_t Q = 1u << (SFC_BITS - 1); Q > 1; Q >>= 1)
+        {
+            uint32_t P = Q - 1;
+            for (int i = 0; i < 3; ++i)
+            {
+                if (x[i] & Q)
+                    x[0] ^= P;
+                else
+                {
+                    uint32_t t = (x[0] ^ x[i]) & P;
+                    x[0] ^= t;
+                    x[i] ^= t;
+                }
+            }
+        }
+
+        // Gray encode
+        for (int i = 1; i < 3; ++i)
+            x[i] ^= x[i - 1];
+        uint32_t t = 0;
+        for (uint32_t Q = 1u << (SFC_BITS - 1); Q > 1; Q >>= 1)
+            if (x[2] & Q)
+                t ^= Q - 1;
+        for (int i = 0; i < 3; ++i)
+            x[i] ^= t;
+    }
+
+    // interleave the bits, most significant first
+    uint64_t key = 0;
+    for (int b = SFC_BITS - 1; b >= 0; --b)
+        for (int i = 0; i < 3; ++i)
+            key = (key << 1) | ((x[i] >> b) & 1);
+    return key;
+}
+
+// coordinates on the quantized grid of one dimension, read from and written to every third
+// entry of the interleaved arrays x and q; points outside the domain go to the nearest cell
+static void quantize(const float*                       x,
+                     int64_t                            n,
+                     float                              min,
+                     float                              max,
+                     uint32_t*                          q)
+{
+    const double cells = (double)(1u << SFC_BITS);
+    double       scale = max > min ? cells / ((double)max - min) : 0;
+    for (int64_t i = 0; i < n; ++i)
+    {
+        double c = floor((x[3 * i] - min) * scale);
+        q[3 * i] = (uint32_t)std::max(0.0, std::min(cells - 1, c));
+    }
+}
+
+// grows box by the bounding box of the part of the curve segment [lo, hi] (inclusive) that lies
+// in the cell c of the given level of the octree over the quantized grid
+//
+// every octree cell is a contiguous range of keys on both curves, so only the cells that contain
+// lo or hi are split further, and the recursion visits O(8 * SFC_BITS) cells
+static void segment_bounds(uint64_t                         lo,
+                           uint64_t                         hi,
+                           bool                             hilbert,
+                           const uint32_t*                  c,
+                           int                              level,
+                           const diy::ContinuousBounds&     domain,
+                           diy::ContinuousBounds&           box)
+{
+    int      shift = SFC_BITS - level;
+    uint32_t q[3]  = { c[0] << shift, c[1] << shift, c[2] << shift };
+    uint64_t mask  = (uint64_t(1) << (3 * shift)) - 1;
+    uint64_t k0    = sfc_key(q, hilbert) & ~mask;
+    uint64_t k1    = k0 | mask;
+    if (k1 < lo || k0 > hi)
+        return;
+
+    float cell_min[3], cell_max[3];
+    bool  inside = true;                    // cell already inside box
+    for (int d = 0; d < 3; ++d)
+    {
+        float w     = (domain.max[d] - domain.min[d]) / (1u << level);
+        cell_min[d] = domain.min[d] + w * c[d];
+        cell_max[d] = (c[d] + 1 == (1u << level)) ? domain.max[d] : domain.min[d] + w * (c[d] + 1);
+        if (cell_min[d] < box.min[d] || cell_max[d] > box.max[d])
+            inside = false;
+    }
+    if (inside)
+        return;
+
+    if ((k0 >= lo && k1 <= hi) || shift == 0)
+    {
+        for (int d = 0; d < 3; ++d)
+        {
+            box.min[d] = std::min(box.min[d], cell_min[d]);
+            box.max[d] = std::max(box.max[d], cell_max[d]);
+        }
+        return;
+    }
+
+    for (int i = 0; i < 8; ++i)
+    {
+        uint32_t child[3] = { 2 * c[0] + (i & 1), 2 * c[1] + ((i >> 1) & 1), 2 * c[2] + (i >> 2) };
+        segment_bounds(lo, hi, hilbert, child, level + 1, domain, box);
+    }
+}
+
+// redistributes the particles to blocks that are contiguous segments of a space-filling curve
+//
+// an alternative to tess_exchange() and tess_kdtree_exchange(): the splitters come from one
+// allgather of key samples and the particles move with a single all-to-all (send_particles()),
+// instead of log(nblocks) rounds of histograms or swaps; requires all blocks in memory
+//
+// wrap: periodic boundary conditions
+// hilbert: Hilbert curve, else Morton (Z-order) curve; Hilbert segments are more compact and
+//          have fewer neighbors
+void tess_sfc_exchange(diy::Master& master,
+                       const diy::Assigner& assigner,
+                       double* times,
+                       bool wrap,
+                       bool hilbert)
+{
+    TESS_TRACE_SCOPE("tess_sfc_exchange", -1, -1);
+    timing(times, EXCH_TIME, -1, master.communicator());
+
+    MPI_Comm comm    = master.communicator();
+    int      nblocks = assigner.nblocks();
+    int      size;
+    MPI_Comm_size(comm, &size);
+
+    // data bounds are the same in every block
+    diy::ContinuousBounds domain(3);
+    float dmin[3], dmax[3];
+    for (int d = 0; d < 3; ++d)
+    {
+        dmin[d] =  std::numeric_limits<float>::max();
+        dmax[d] = -std::numeric_limits<float>::max();
+    }
+    for (size_t i = 0; i < master.size(); ++i)
+    {
+        DBlock* b = master.block<DBlock>(i);
+        for (int d = 0; d < 3; ++d)
+        {
+            dmin[d] = std::min(dmin[d], b->data_bounds.min[d]);
+            dmax[d] = std::max(dmax[d], b->data_bounds.max[d]);
+        }
+    }
+    float gmin[3], gmax[3];
+    MPI_Allreduce(dmin, gmin, 3, MPI_FLOAT, MPI_MIN, comm);
+    MPI_Allreduce(dmax, gmax, 3, MPI_FLOAT, MPI_MAX, comm);
+    for (int d = 0; d < 3; ++d)
+    {
+        domain.min[d] = gmin[d];
+        domain.max[d] = gmax[d];
+    }
+
+    // keys of the local particles, quantized one coordinate at a time
+    std::vector< std::vector<uint64_t> > keys(master.size());
+    std::vector<uint64_t>                sorted;
+    for (size_t i = 0; i < master.size(); ++i)
+    {
+        DBlock*                 b  = master.block<DBlock>(i);
+        int64_t                 np = b->num_particles;
+        std::vector<uint32_t>   q(3 * np);
+        for (int d = 0; d < 3; ++d)
+            quantize(b->particles + d, np, domain.min[d], domain.max[d], q.data() + d);
+
+        keys[i].resize(np);
+        for (int64_t j = 0; j < np; ++j)
+            keys[i][j] = sfc_key(&q[3 * j], hilbert);
+        sorted.insert(sorted.end(), keys[i].begin(), keys[i].end());
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    // every process contributes samples in proportion to its particles, evenly spaced in key order
+    long long n = sorted.size(), total;
+    MPI_Allreduce(&n, &total, 1, MPI_LONG_LONG, MPI_SUM, comm);
+
+    long long target = (long long)SFC_SAMPLES * nblocks;
+    int       ns     = total ? (int)std::min(n, (n * target + total - 1) / total) : 0;
+    std::vector<uint64_t> samples(ns);
+    for (int s = 0; s < ns; ++s)
+        samples[s] = sorted[(size_t)((s + 0.5) * n / ns)];
+    std::vector<uint64_t>().swap(sorted);
+
+    std::vector<int> counts(size), displs(size + 1, 0);
+    MPI_Allgather(&ns, 1, MPI_INT, &counts[0], 1, MPI_INT, comm);
+    for (int r = 0; r < size; ++r)
+        displs[r + 1] = displs[r] + counts[r];
+    std::vector<uint64_t> all_samples(std::max(1, displs[size]));
+    MPI_Allgatherv(ns ? &samples[0] : NULL, ns, MPI_UNSIGNED_LONG_LONG,
+                   &all_samples[0], &counts[0], &displs[0], MPI_UNSIGNED_LONG_LONG, comm);
+    all_samples.resize(displs[size]);
+    std::sort(all_samples.begin(), all_samples.end());
+
+    // block gid owns the keys [splitters[gid], splitters[gid + 1])
+    std::vector<uint64_t> splitters(nblocks + 1);
+    splitters[0]       = 0;
+    splitters[nblocks] = uint64_t(1) << (3 * SFC_BITS);
+    for (int g = 1; g < nblocks; ++g)
+        splitters[g] = all_samples.empty() ? splitters[nblocks] / nblocks * g :
+                                             all_samples[(size_t)g * all_samples.size() / nblocks];
+
+    // move the particles to the blocks of their segments
+    std::vector< std::vector<int> > dests(master.size());
+    for (size_t i = 0; i < master.size(); ++i)
+    {
+        dests[i].resize(keys[i].size());
+        for (size_t j = 0; j < keys[i].size(); ++j)
+            dests[i][j] = std::upper_bound(splitters.begin() + 1, splitters.end() - 1, keys[i][j]) -
+                          (splitters.begin() + 1);
+        std::vector<uint64_t>().swap(keys[i]);
+    }
+    send_particles(master, assigner, dests);
+
+    // bounds of all segments, the same on every process; an empty segment has an empty box
+    std::vector<diy::ContinuousBounds> boxes(nblocks, diy::ContinuousBounds(3));
+    for (int g = 0; g < nblocks; ++g)
+    {
+        for (int d = 0; d < 3; ++d)
+        {
+            boxes[g].min[d] =  std::numeric_limits<float>::max();
+            boxes[g].max[d] = -std::numeric_limits<float>::max();
+        }
+        if (splitters[g] < splitters[g + 1])
+        {
+            uint32_t root[3] = { 0, 0, 0 };
+            segment_bounds(splitters[g], splitters[g + 1] - 1, hilbert, root, 0, domain, boxes[g]);
+        }
+    }
+
+    for (size_t i = 0; i < master.size(); ++i)
+    {
+        DBlock* b   = master.block<DBlock>(i);
+        int     gid = master.gid(i);
+        for (int d = 0; d < 3; ++d)
+        {
+            b->box.min[d] = b->bounds.min[d] = boxes[gid].min[d];
+            b->box.max[d] = b->bounds.max[d] = boxes[gid].max[d];
+        }
+        master.replace_link(i, touching_link(gid, boxes, domain, assigner, wrap));
+    }
+
+    timing(times, -1, EXCH_TIME, master.communicator());
+}
@@ -0,0 +1,314 @@
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+
+#include "tess/tess.hpp"
+
+// incremental tessellation of a time series
+//
+// between two snapshots the particles keep their blocks: a block takes the new positions of its
+// original particles, and its bounds grow to cover them (so that the bounds of neighboring
+// blocks may overlap, as with tess_sfc_exchange(); incomplete_cells() tests for this)
+//
+// every block records the ghosts it sent (DBlock::sent), so the first snapshot needs
+// tess(master, quants, times, true), which records them, and then tess_update() for every later
+// one, which keeps recording; a moved particle refreshes its ghost
+// copies at the neighbors, and the triangulation moves the vertices of the moved particles and
+// ghosts (move_vertices()); the usual rounds of tess() then send only ghosts that the neighbors
+// do not hold yet
+//
+// the first round skips the tessellation of a block none of whose particles or ghosts moved, and
+// the search for new ghosts of a block whose neighbors also kept their bounds
+//
+// ghosts are never dropped: a block keeps the ghosts of earlier steps that it no longer needs
+//
+// in a periodic domain, a new position is taken as the periodic image nearest to the old one, so
+// a particle crossing the domain boundary stays next to its old position (outside the domain)
+// instead of jumping across it; this keeps the bounds of its block small, and the wraps recorded
+// for its ghosts valid
+
+// whether two links have the same bounds and the same neighbors, wraps, and bounds in the
+// same order
+static bool same_link(const RCLink& a,
+                      const RCLink& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (int d = 0; d < 3; ++d)
+        if (a.bounds().min[d] != b.bounds().min[d] || a.bounds().max[d] != b.bounds().max[d])
+            return false;
+    for (int i = 0; i < a.size(); ++i)
+    {
+        if (a.target(i).gid != b.target(i).gid ||
+            tess_wrap_code(a.wrap(i)) != tess_wrap_code(b.wrap(i)))
+            return false;
+        for (int d = 0; d < 3; ++d)
+            if (a.bounds(i).min[d] != b.bounds(i).min[d] || a.bounds(i).max[d] != b.bounds(i).max[d])
+                return false;
+    }
+    return true;
+}
+
+// tessellates the next snapshot of a time series, updating the tessellation of the previous one
+// in master (from tess() with record_ghosts or tess_update())
+//
+// master: diy master object
+// assigner: diy assigner object of the blocks
+// positions: new positions of the original particles of every local block (by local block
+//            index), 3 floats per particle in the order of the block's particles; with wrap,
+//            any periodic image (e.g. wrapped into the domain)
+// wrap: whether the domain is periodic
+// stats: (output) the work done and skipped, over all blocks
+// times: timing
+//
+// returns the number of rounds of ghost exchange
+size_t tess_update(diy::Master& master,
+                   const diy::Assigner& assigner,
+                   const std::vector<float*>& positions,
+                   bool wrap,
+                   tess_update_stats_t& stats,
+                   double* times)
+{
+    TESS_TRACE_SCOPE("tess_update", -1, -1);
+    timing(times, EXCH_TIME, -1, master.communicator());
+
+    assert(positions.size() == master.size());
+
+    // counts of every block, summed at the end
+    enum { MOVED, REFRESHED, IN_PLACE, REINSERTED, NEW_GHOSTS, BLOCKS, KEPT_TETS, KEPT_GHOSTS,
+           NO_REFRESH, NUM_COUNTS };
+    std::vector< std::vector<long long> > counts(master.size(),
+                                                 std::vector<long long>(NUM_COUNTS, 0));
+
+    std::vector< std::vector<int> > moved(master.size());   // moved particles and ghosts, by block
+    std::vector< std::set<int> >    partners(master.size());
+    std::vector<diy::ContinuousBounds> domains(master.size(), diy::ContinuousBounds(3));
+    std::vector<long long>          ghosts(master.size(), 0);   // ghosts held, by block
+
+    // new positions of the original particles, unwrapped to the image nearest the old ones;
+    // the bounds of a block grow to cover them
+    master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+    {
+        int          lid = cp.master()->lid(cp.gid());
+        const float* x   = positions[lid];
+
+        float period[3];
+        for (int d = 0; d < 3; ++d)
+            period[d] = b->data_bounds.max[d] - b->data_bounds.min[d];
+
+        make_writable(b);
+        for (int p = 0; p < b->num_orig_particles; ++p)
+        {
+            float* y = &b->particles[3 * p];
+            float  z[3];
+            for (int d = 0; d < 3; ++d)
+            {
+                z[d] = x[3 * p + d];
+                if (wrap && period[d] > 0)
+                    z[d] -= period[d] * rintf((z[d] - y[d]) / period[d]);
+            }
+            if (z[0] == y[0] && z[1] == y[1] && z[2] == y[2])
+                continue;
+            for (int d = 0; d < 3; ++d)
+            {
+                y[d]             = z[d];
+                b->bounds.min[d] = std::min(b->bounds.min[d], y[d]);
+                b->bounds.max[d] = std::max(b->bounds.max[d], y[d]);
+            }
+            moved[lid].push_back(p);
+        }
+        b->box       = b->bounds;
+        domains[lid] = b->data_bounds;
+        counts[lid][MOVED] = moved[lid].size();
+
+        // blocks this block exchanged ghosts with, in either direction
+        for (size_t i = 0; i < b->sent.size(); ++i)
+            partners[lid].insert(b->sent[i].gid);
+        for (int i = 0; i < b->num_particles - b->num_orig_particles; ++i)
+            partners[lid].insert(b->rem_gids[i]);
+        counts[lid][NEW_GHOSTS] = -(long long)b->sent.size();
+        ghosts[lid] = b->num_particles - b->num_orig_particles;
+    });
+
+    // blocks hold ghosts, but none were recorded as sent: the previous tessellation did not record
+    // them, and every ghost would be sent again
+    long long sent_held[2] = { 0, 0 };
+    for (size_t i = 0; i < master.size(); ++i)
+    {
+        sent_held[0] -= counts[i][NEW_GHOSTS];
+        sent_held[1] += ghosts[i];
+    }
+    MPI_Allreduce(MPI_IN_PLACE, sent_held, 2, MPI_LONG_LONG, MPI_SUM, master.communicator());
+    if (sent_held[0] == 0 && sent_held[1] > 0)
+    {
+        if (master.communicator().rank() == 0)
+            fprintf(stderr, "Error: tess_update() needs the ghosts recorded by "
+                    "tess(master, quants, times, true)\n");
+        MPI_Abort(master.communicator(), 1);
+    }
+
+    // refresh the ghosts of the moved particles, over links to the ghost partners (symmetric:
+    // a block holds ghosts of exactly the blocks that sent it some)
+    std::vector<RCLink> old_links;
+    for (size_t i = 0; i < master.size(); ++i)
+    {
+        old_links.push_back(*dynamic_cast<RCLink*>(master.link(i)));
+        RCLink* link = new RCLink(3, old_links[i].bounds(), old_links[i].bounds());
+        for (std::set<int>::iterator it = partners[i].begin(); it != partners[i].end(); ++it)
+        {
+            diy::BlockID bid;
+            bid.gid  = *it;
+            bid.proc = assigner.rank(*it);
+            link->add_neighbor(bid);
+            link->add_direction(diy::Direction());
+            link->add_bounds(old_links[i].bounds());
+            link->add_wrap(diy::Direction());
+        }
+        master.replace_link(i, link);
+    }
+
+    master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+    {
+        int               lid = cp.master()->lid(cp.gid());
+        std::vector<char> is_moved(b->num_orig_particles, 0);
+        for (size_t i = 0; i < moved[lid].size(); ++i)
+            is_moved[moved[lid][i]] = 1;
+
+        point_t rp;
+        for (size_t i = 0; i < b->sent.size(); ++i)
+        {
+            const tess_sent_t& s = b->sent[i];
+            if (!is_moved[s.particle])
+                continue;
+            rp.x   = b->particles[3 * s.particle];
+            rp.y   = b->particles[3 * s.particle + 1];
+            rp.z   = b->particles[3 * s.particle + 2];
+            rp.gid = b->gid;
+            rp.lid = s.particle;
+            wrap_pt(rp, tess_wrap_dir(s.wrap), b->data_bounds);
+
+            diy::BlockID bid;
+            bid.gid  = s.gid;
+            bid.proc = assigner.rank(s.gid);
+            cp.enqueue(bid, rp);
+            counts[lid][REFRESHED]++;
+        }
+        counts[lid][NO_REFRESH] = !counts[lid][REFRESHED];
+    });
+    master.exchange();
+
+    // update the ghosts; a ghost with several (periodic) copies updates the nearest one
+    master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+    {
+        int lid = cp.master()->lid(cp.gid());
+        int nrem = b->num_particles - b->num_orig_particles;
+
+        std::vector< std::pair<std::pair<int, int>, int> > ghosts(nrem);  // (owner, lid) -> index
+        for (int i = 0; i < nrem; ++i)
+            ghosts[i] = std::make_pair(std::make_pair(b->rem_gids[i], b->rem_lids[i]),
+                                       b->num_orig_particles + i);
+        std::sort(ghosts.begin(), ghosts.end());
+
+        std::vector<int> in;
+        cp.incoming(in);
+        for (size_t i = 0; i < in.size(); ++i)
+        {
+            diy::MemoryBuffer& in_queue = cp.incoming(in[i]);
+            while (in_queue.position < in_queue.size())
+            {
+                point_t pt;
+                diy::load(in_queue, pt);
+                float x[3] = { pt.x, pt.y, pt.z };
+
+                std::pair<int, int> key(pt.gid, pt.lid);
+                std::vector< std::pair<std::pair<int, int>, int> >::iterator it =
+                    std::lower_bound(ghosts.begin(), ghosts.end(), std::make_pair(key, -1));
+                int   nearest = -1;
+                float min_dist = 0;
+                for (; it != ghosts.end() && it->first == key; ++it)
+                {
+                    float dist = distance(x, &b->particles[3 * it->second]);
+                    if (nearest < 0 || dist < min_dist)
+                    {
+                        nearest  = it->second;
+                        min_dist = dist;
+                    }
+                }
+                if (nearest < 0)
+                    continue;
+                for (int d = 0; d < 3; ++d)
+                    b->particles[3 * nearest + d] = x[d];
+                moved[lid].push_back(nearest);
+            }
+        }
+
+        int in_place, reinserted;
+        move_vertices(b, moved[lid].empty() ? NULL : &moved[lid][0], moved[lid].size(),
+                      &in_place, &reinserted);
+        counts[lid][IN_PLACE]   = in_place;
+        counts[lid][REINSERTED] = reinserted;
+        b->stale_tets = !moved[lid].empty();
+    });
+
+    // links between the new bounds
+    tess_cost_map_t map;
+    tess_cost_map(master, assigner, map);
+    std::vector<char> same(master.size());
+    for (size_t i = 0; i < master.size(); ++i)
+    {
+        RCLink* link = touching_link(master.gid(i), map.boxes, domains[i], assigner, wrap);
+        same[i]      = same_link(*link, old_links[i]);
+        master.replace_link(i, link);
+    }
+
+    master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+    {
+        int lid         = cp.master()->lid(cp.gid());
+        b->stale_ghosts = b->stale_tets || !same[lid];
+    });
+
+    timing(times, -1, EXCH_TIME, master.communicator());
+
+    // rounds of tessellation and exchange of the new ghosts
+    quants_t quants;
+    timing(times, DEL_TIME, -1, master.communicator());
+    stats.rounds = tess_rounds(master, quants, true, true);
+    timing(times, -1, DEL_TIME, master.communicator());
+
+    master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+    {
+        int lid = cp.master()->lid(cp.gid());
+        counts[lid][NEW_GHOSTS] += b->sent.size();
+        counts[lid][BLOCKS]      = 1;
+        counts[lid][KEPT_TETS]   = !b->stale_tets;
+        counts[lid][KEPT_GHOSTS] = !b->stale_ghosts;
+        b->stale_tets   = true;
+        b->stale_ghosts = true;
+    });
+
+    long long total[NUM_COUNTS] = { 0 };
+    for (size_t i = 0; i < master.size(); ++i)
+        for (int j = 0; j < NUM_COUNTS; ++j)
+            total[j] += counts[i][j];
+    MPI_Allreduce(MPI_IN_PLACE, total, NUM_COUNTS, MPI_LONG_LONG, MPI_SUM,
+                  master.communicator());
+    stats.moved          = total[MOVED];
+    stats.refreshed      = total[REFRESHED];
+    stats.moved_in_place = total[IN_PLACE];
+    stats.reinserted     = total[REINSERTED];
+    stats.new_ghosts     = total[NEW_GHOSTS];
+    stats.blocks         = total[BLOCKS];
+    stats.kept_tets      = total[KEPT_TETS];
+    stats.kept_ghosts    = total[KEPT_GHOSTS];
+    stats.no_refresh     = total[NO_REFRESH];
+
+    if (master.communicator().rank() == 0)
+        fprintf(stderr, "Update: %lld particles moved, %lld ghosts refreshed, %lld new ghosts; "
+                "%lld of %lld blocks kept their tets, %lld their ghosts, %lld sent no refresh\n",
+                stats.moved, stats.refreshed, stats.new_ghosts, stats.kept_tets, stats.blocks,
+                stats.kept_ghosts, stats.no_refresh);
+
+    return stats.rounds;
+}
@@ -17,6 +17,7 @@
 
 #include <stddef.h>
 #include <stdio.h>
+#include <limits.h>
 #include <math.h>
 #include <unistd.h>
 #include <sys/resource.h>
@@ -30,6 +31,10 @@
 #include "tess/tess.hpp"
 #include "tess/tet.hpp"
 #include "tess/tet-neighbors.h"
+#include "tess/compress.hpp"
+#include "tess/tess-file.hpp"
+#include "tess/profile.hpp"
+#include "tess/scratch.hpp"
 
 #include <diy/point.hpp>
 
@@ -49,9 +54,12 @@ size_t tess(diy::Master& master)
     return tess(master, quants, times);
 }
 
+// record_ghosts: every block records the ghosts it sends (DBlock::sent); needed by a later
+//   tess_update() of the blocks, and otherwise only memory
 size_t tess(diy::Master& master,
             quants_t& quants,
-            double* times)
+            double* times,
+            bool record_ghosts)
 {
 #ifdef TIMING
     // if (master.threads() != 1)
@@ -59,8 +67,22 @@ size_t tess(diy::Master& master,
     //           "it's not compatible with using multiple threads\n");
 #endif
 
+    TESS_TRACE_SCOPE("tess", -1, -1);
     timing(times, DEL_TIME, -1, master.communicator());
+    size_t rounds = tess_rounds(master, quants, false, record_ghosts);
+    timing(times, -1, DEL_TIME, master.communicator());
+
+    return rounds;
+}
 
+// rounds of local tessellation and ghost exchange until every block is complete
+// update: the blocks keep their ghosts and tets from an earlier tessellation (tess_update())
+// record_ghosts: the blocks record the ghosts they send (DBlock::sent)
+size_t tess_rounds(diy::Master& master,
+                   quants_t& quants,
+                   bool update,
+                   bool record_ghosts)
+{
     // save the original link for every block in master
     LinkVector   original_links;
     for (size_t i = 0; i < master.size(); ++i)
@@ -79,11 +101,20 @@ size_t tess(diy::Master& master,
     while (!done)
     {
         rounds++;
+        TESS_TRACE_SCOPE("round", -1, rounds);
 
         double start = MPI_Wtime();
         master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
-                       { delaunay(b, cp, original_links, last_neighbors, first); });
-        master.exchange();
+                       { delaunay(b, cp, original_links, last_neighbors, first, update,
+                                  record_ghosts); });
+
+        tess_profile_record_t rec(rounds);
+        {
+            TESS_TRACE_SCOPE("exchange", -1, rounds);
+            TessTimer timer(rec.times[PHASE_EXCHANGE]);
+            master.exchange();
+        }
+        tess_profile_add(rec);
 
         if (master.communicator().rank() == 0)
             fprintf(stderr, "[%d]: Time for round %lu = %f s\n",
@@ -93,9 +124,24 @@ size_t tess(diy::Master& master,
         done = master.proxy(master.loaded_block()).read<int>();
 
 #ifdef MEMORY
+        // the received particles wait in the diy queues until the next round
+        size_t queued = 0;
+        for (size_t i = 0; i < master.size(); ++i)
+        {
+            diy::Master::ProxyWithLink cp = master.proxy(i);
+            std::vector<int> in;
+            cp.incoming(in);
+            for (size_t j = 0; j < in.size(); ++j)
+                queued += cp.incoming(in[j]).size();
+        }
+        tess_mem_track(&master, queued, MEM_EXCHANGE);
+
         get_mem(rounds, master.communicator());
 #endif
     }
+#ifdef MEMORY
+    tess_mem_untrack(&master);
+#endif
 
     // this is not ideal, but need to do this to collect statistics and mark
     // blocks as complete; TODO: this of how to get rid of this
@@ -110,8 +156,6 @@ size_t tess(diy::Master& master,
     for (size_t i = 0; i < master.size(); ++i)
         master.replace_link(i, new RCLink(original_links[i]));
 
-    timing(times, -1, DEL_TIME, master.communicator());
-
     return rounds;
 }
 
@@ -120,7 +164,30 @@ void tess_save(diy::Master& master,
                const diy::MemoryBuffer& extra)
 {
     double times[TESS_MAX_TIMES]; // timing
-    tess_save(master, outfile, times);
+    tess_save(master, outfile, times, extra);
+}
+
+// writes the output of tess_save() and tess_save_async() (collective)
+// the mappable tess file needs all blocks in memory; when any block of any process is out of
+// core, a diy block file is written instead, synchronously
+// otherwise pending, if given, receives the tess file write in the background
+static void save_output(diy::Master& master,
+                        const char* outfile,
+                        const diy::MemoryBuffer& extra,
+                        TessFileWrite* pending)
+{
+    int out_of_core = 0, any_out_of_core;
+    for (size_t i = 0; i < master.size(); i++)
+        if (!master.block(i))
+            out_of_core = 1;
+    MPI_Allreduce(&out_of_core, &any_out_of_core, 1, MPI_INT, MPI_MAX, master.communicator());
+
+    if (any_out_of_core)
+        diy::io::write_blocks(outfile, master.communicator(), master, extra, &save_block_light);
+    else if (pending)
+        tess_file_write_async(master, outfile, *pending, extra);
+    else
+        tess_file_write(master, outfile, extra);
 }
 
 void tess_save(diy::Master& master,
@@ -129,26 +196,165 @@ void tess_save(diy::Master& master,
                const diy::MemoryBuffer& extra)
 {
     // write output
+    TESS_TRACE_SCOPE("tess_save", -1, -1);
     timing(times, OUT_TIME, -1, master.communicator());
     if (outfile[0])
-        diy::io::write_blocks(outfile, master.communicator(), master, extra, &save_block_light);
+        save_output(master, outfile, extra, NULL);
+
+    timing(times, -1, OUT_TIME, master.communicator());
+}
+
+// starts writing the output in the background, overlapping it with what the caller does next
+//
+// master: diy master object
+// outfile: output file name
+// pending: (output) the write in progress, for tess_save_wait(); a pending write is waited for
+//          first
+// times: timing; OUT_TIME is the time the caller is blocked, tess_save_wait() adds its own
+// extra: extra user data
+//
+// the blocks are copied before returning and may change right after; a diy block file (when
+// blocks are out of core) is written synchronously
+void tess_save_async(diy::Master& master,
+                     const char* outfile,
+                     TessFileWrite& pending,
+                     double* times,
+                     const diy::MemoryBuffer& extra)
+{
+    TESS_TRACE_SCOPE("tess_save_async", -1, -1);
+    tess_save_wait(pending);
+    timing(times, OUT_TIME, -1, master.communicator());
+    if (outfile[0])
+        save_output(master, outfile, extra, &pending);
 
     timing(times, -1, OUT_TIME, master.communicator());
 }
 
+// waits for the output started by tess_save_async() (collective)
+void tess_save_wait(TessFileWrite& pending,
+                    double* times)
+{
+    if (!pending.pending)
+        return;
+    TESS_TRACE_SCOPE("tess_save_wait", -1, -1);
+    if (!times)
+    {
+        tess_file_wait(pending);
+        return;
+    }
+    double posted = times[OUT_TIME];
+    MPI_Comm comm = pending.comm;
+    timing(times, OUT_TIME, -1, comm);
+    tess_file_wait(pending);
+    timing(times, -1, OUT_TIME, comm);
+#ifdef TIMING
+    times[OUT_TIME] += posted;
+#endif
+}
+
 void tess_load(diy::Master& master,
                diy::StaticAssigner& assigner,
                const char* infile)
 {
-    diy::io::read_blocks(infile, master.communicator(), assigner, master, &load_block_light);
+    diy::MemoryBuffer extra;
+    tess_load(master, assigner, infile, extra);
 }
 
+// reads either a tess file (mapped, zero-copy) or a diy block file
 void tess_load(diy::Master& master,
                diy::StaticAssigner& assigner,
                const char* infile,
                diy::MemoryBuffer& extra)
 {
-    diy::io::read_blocks(infile, master.communicator(), assigner, master, extra, &load_block_light);
+    if (tess_file_is_tess(infile))
+        tess_file_load(master, assigner, infile, extra);
+    else
+        diy::io::read_blocks(infile, master.communicator(), assigner, master, extra,
+                             &load_block_light);
+}
+
+// keeps only the local blocks with the given gids and the given sections of those
+static void select_blocks(diy::Master& master,
+                          const vector<int>& gids,
+                          unsigned sections)
+{
+    vector<int> selected(gids);
+    sort(selected.begin(), selected.end());
+
+    // releasing a block renumbers the ones after it, so go backwards
+    for (int i = master.size() - 1; i >= 0; i--)
+    {
+        if (!binary_search(selected.begin(), selected.end(), master.gid(i)))
+            destroy_block(master.release(i));
+        else
+            drop_sections(master.block<DBlock>(i), sections);
+    }
+}
+
+// region-of-interest loading: reads only the blocks whose bounds intersect a box
+//
+// master: diy master object
+// assigner: diy assigner object, its number of blocks is set from the file
+// infile: input file name
+// box: region of interest
+// sections: bit mask of sections (1 << tess_section_t) to keep, e.g., only tets and vert_to_tet
+//
+// the assigner covers all blocks in the file, so links of the loaded blocks refer to the original
+// gids, but some processes may end up with no blocks
+// a tess file is queried with its block table and only the selected blocks and sections are
+// mapped; a diy block file has no index, so all blocks are read and the rest are discarded
+void tess_load(diy::Master& master,
+               diy::StaticAssigner& assigner,
+               const char* infile,
+               const diy::ContinuousBounds& box,
+               unsigned sections)
+{
+    if (tess_file_is_tess(infile))
+    {
+        TessFile file;
+        if (!tess_file_open(infile, file))
+            MPI_Abort(master.communicator(), 1);
+        vector<int> gids;
+        tess_file_query(file, box, gids);
+        diy::MemoryBuffer extra;
+        tess_file_load(master, assigner, infile, extra, &gids, sections);
+        return;
+    }
+
+    diy::MemoryBuffer extra;
+    diy::io::read_blocks(infile, master.communicator(), assigner, master, extra,
+                         &load_block_light);
+    vector<int> gids;
+    for (size_t i = 0; i < master.size(); i++)
+    {
+        DBlock* b = master.block<DBlock>(i);
+        bool intersects = true;
+        for (int j = 0; j < 3; j++)
+            if (b->bounds.min[j] > box.max[j] || b->bounds.max[j] < box.min[j])
+                intersects = false;
+        if (intersects)
+            gids.push_back(b->gid);
+    }
+    select_blocks(master, gids, sections);
+}
+
+// region-of-interest loading: reads only the blocks with the given gids
+// see tess_load above for the other arguments
+void tess_load(diy::Master& master,
+               diy::StaticAssigner& assigner,
+               const char* infile,
+               const vector<int>& gids,
+               unsigned sections)
+{
+    diy::MemoryBuffer extra;
+    if (tess_file_is_tess(infile))
+        tess_file_load(master, assigner, infile, extra, &gids, sections);
+    else
+    {
+        diy::io::read_blocks(infile, master.communicator(), assigner, master, extra,
+                             &load_block_light);
+        select_blocks(master, gids, sections);
+    }
 }
 
 //
@@ -167,15 +373,25 @@ void destroy_block(void* b_)
     DBlock* b = static_cast<DBlock*>(b_);
 
     // particles and tets
-    if (b->particles)     free(b->particles);
-    if (b->tets)          free(b->tets);
-    if (b->rem_gids)      free(b->rem_gids);
-    if (b->rem_lids)      free(b->rem_lids);
-    if (b->vert_to_tet)   free(b->vert_to_tet);
-
-    // density
-    if (b->density)
+    // arrays that alias the block storage (e.g., a mapped file) are released with it
+    if (b->particles   && !b->aliased(b->particles))     tess_free(b->particles);
+    if (b->attrs       && !b->aliased(b->attrs))         tess_free(b->attrs);
+    if (b->tets        && !b->aliased(b->tets))          tess_free(b->tets);
+    if (b->rem_gids    && !b->aliased(b->rem_gids))      tess_free(b->rem_gids);
+    if (b->rem_lids    && !b->aliased(b->rem_lids))      tess_free(b->rem_lids);
+    if (b->vert_to_tet && !b->aliased(b->vert_to_tet))   tess_free(b->vert_to_tet);
+
+    // density and attribute fields
+    if (b->density && !b->aliased(b->density))
+    {
+        tess_mem_untrack(b->density);
         delete[] b->density;   // allocated with new, freed with delete
+    }
+    if (b->fields && !b->aliased(b->fields))
+    {
+        tess_mem_untrack(b->fields);
+        delete[] b->fields;
+    }
 
     if (b->Dt)
         clean_delaunay_data_structure(b);
@@ -195,27 +411,107 @@ void load_block(void* b,
     diy::load(bb, *static_cast<DBlock*>(b));
 }
 
+// writes the magic word, version, and gid that start a serialized block
+void save_block_header(diy::BinaryBuffer& bb,
+                       const DBlock& d)
+{
+    int magic   = TESS_BLOCK_MAGIC;
+    int version = TESS_BLOCK_VERSION;
+    diy::save(bb, magic);
+    diy::save(bb, version);
+    diy::save(bb, d.gid);
+}
+
+// reads the start of a serialized block into d.gid
+// returns: the version of the block, 1 for the original layout without magic word; aborts on
+// a version newer than this library
+int load_block_header(diy::BinaryBuffer& bb,
+                      DBlock& d)
+{
+    int word;
+    diy::load(bb, word);
+    if (word != TESS_BLOCK_MAGIC)
+    {
+        d.gid = word;
+        return 1;
+    }
+
+    int version;
+    diy::load(bb, version);
+    diy::load(bb, d.gid);
+    if (version > TESS_BLOCK_VERSION)
+    {
+        fprintf(stderr, "Error: block %d has version %d, newer than this library (%d)\n",
+                d.gid, version, TESS_BLOCK_VERSION);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return version;
+}
+
+// reads an array of the original block layout: no alignment padding, own allocation
+template<class T>
+static void load_array_v1(diy::BinaryBuffer& bb,
+                          T*& x,
+                          size_t n,
+                          int category)
+{
+    x = n ? (T*)tess_malloc(n * sizeof(T), category) : NULL;
+    diy::load(bb, x, n);
+}
+
+// reads the rest of a block of the original layout (version 1, written by save_block_light()
+// before attributes, compression, and the block header), after its gid
+// up-converts it to a block without attributes or fields
+static void load_block_v1(diy::BinaryBuffer& bb,
+                          DBlock& d)
+{
+    diy::load(bb, d.bounds);
+    diy::load(bb, d.box);
+    diy::load(bb, d.data_bounds);
+    diy::load(bb, d.num_orig_particles);
+    diy::load(bb, d.num_particles);
+    load_array_v1(bb, d.particles, 3 * d.num_particles, MEM_PARTICLES);
+    d.num_attrs = 0;
+    d.attrs     = NULL;
+    load_array_v1(bb, d.rem_gids, d.num_particles - d.num_orig_particles, MEM_PARTICLES);
+    load_array_v1(bb, d.rem_lids, d.num_particles - d.num_orig_particles, MEM_PARTICLES);
+    diy::load(bb, d.num_grid_pts);
+    d.density = new float[d.num_grid_pts];
+    tess_mem_track(d.density, d.num_grid_pts * sizeof(float), MEM_DENSITY);
+    diy::load(bb, d.density, d.num_grid_pts);
+    d.num_fields = 0;
+    d.fields     = NULL;
+
+    diy::load(bb, d.complete);
+    diy::load(bb, d.num_tets);
+    load_array_v1(bb, d.tets, d.num_tets, MEM_TETS);
+    load_array_v1(bb, d.vert_to_tet, d.num_particles, MEM_VERT_TO_TET);
+}
+
 void save_block_light(const void* b_,
                       diy::BinaryBuffer& bb)
 {
     const DBlock& d = *static_cast<const DBlock*>(b_);
 
-    diy::save(bb, d.gid);
+    save_block_header(bb, d);
     diy::save(bb, d.bounds);
     diy::save(bb, d.box);
     diy::save(bb, d.data_bounds);
     diy::save(bb, d.num_orig_particles);
     diy::save(bb, d.num_particles);
-    diy::save(bb, d.particles, 3 * d.num_particles);
-    diy::save(bb, d.rem_gids, d.num_particles - d.num_orig_particles);
-    diy::save(bb, d.rem_lids, d.num_particles - d.num_orig_particles);
+    save_array(bb, d.particles, 3 * d.num_particles);
+    diy::save(bb, d.num_attrs);
+    save_array(bb, d.attrs, d.num_attrs * d.num_particles);
+    save_array(bb, d.rem_gids, d.num_particles - d.num_orig_particles);
+    save_array(bb, d.rem_lids, d.num_particles - d.num_orig_particles);
+    // density and fields are mostly zeros in voids; store them compressed
     diy::save(bb, d.num_grid_pts);
-    diy::save(bb, d.density, d.num_grid_pts);
+    save_compressed(bb, d.density, d.num_grid_pts);
+    diy::save(bb, d.num_fields);
+    save_compressed(bb, d.fields, d.num_fields * d.num_grid_pts);
 
     diy::save(bb, d.complete);
-    diy::save(bb, d.num_tets);
-    diy::save(bb, d.tets, d.num_tets);
-    diy::save(bb, d.vert_to_tet, d.num_particles);
+    save_tets(bb, d, TET_CODEC_DEFAULT);
 }
 
 void load_block_light(void* b_,
@@ -223,7 +519,11 @@ void load_block_light(void* b_,
 {
     DBlock& d = *static_cast<DBlock*>(b_);
 
-    diy::load(bb, d.gid);
+    if (load_block_header(bb, d) == 1)
+    {
+        load_block_v1(bb, d);
+        return;
+    }
     // debug
     // fprintf(stderr, "Loading block gid %d\n", d.gid);
     diy::load(bb, d.bounds);
@@ -231,31 +531,204 @@ void load_block_light(void* b_,
     diy::load(bb, d.data_bounds);
     diy::load(bb, d.num_orig_particles);
     diy::load(bb, d.num_particles);
-    d.particles = NULL;
-    if (d.num_particles)
-        d.particles = (float*)malloc(d.num_particles * 3 * sizeof(float));
-    diy::load(bb, d.particles, 3 * d.num_particles);
-    d.rem_gids = NULL;
-    d.rem_lids = NULL;
-    if (d.num_particles - d.num_orig_particles)
-    {
-        d.rem_gids = (int*)malloc((d.num_particles - d.num_orig_particles) * sizeof(int));
-        d.rem_lids = (int*)malloc((d.num_particles - d.num_orig_particles) * sizeof(int));
-    }
-    diy::load(bb, d.rem_gids, d.num_particles - d.num_orig_particles);
-    diy::load(bb, d.rem_lids, d.num_particles - d.num_orig_particles);
+    load_array(bb, d.particles, 3 * d.num_particles);
+    diy::load(bb, d.num_attrs);
+    load_array(bb, d.attrs, d.num_attrs * d.num_particles);
+    load_array(bb, d.rem_gids, d.num_particles - d.num_orig_particles);
+    load_array(bb, d.rem_lids, d.num_particles - d.num_orig_particles);
     diy::load(bb, d.num_grid_pts);
     d.density = new float[d.num_grid_pts];
-    diy::load(bb, d.density, d.num_grid_pts);
+    tess_mem_track(d.density, d.num_grid_pts * sizeof(float), MEM_DENSITY);
+    load_compressed(bb, d.density, d.num_grid_pts);
+    diy::load(bb, d.num_fields);
+    d.fields = NULL;
+    if (d.num_fields && d.num_grid_pts)
+    {
+        d.fields = new float[d.num_fields * d.num_grid_pts];
+        tess_mem_track(d.fields, d.num_fields * d.num_grid_pts * sizeof(float), MEM_DENSITY);
+    }
+    load_compressed(bb, d.fields, d.num_fields * d.num_grid_pts);
 
     diy::load(bb, d.complete);
+    load_tets(bb, d);
+
+    load_finish(bb, d);
+}
+
+// serializes tets and vert_to_tet
+// the compact tet codecs store neither adjacency nor vert_to_tet; both are rebuilt on load
+// from the vertices, which needs the particles to be loaded first
+void save_tets(diy::BinaryBuffer& bb,
+               const DBlock& d,
+               tet_codec_t codec)
+{
+    diy::save(bb, d.num_tets);
+    char c = codec;
+    diy::save(bb, c);
+    if (codec == TET_CODEC_RAW)
+    {
+        save_array(bb, d.tets, d.num_tets);
+        save_array(bb, d.vert_to_tet, d.num_particles);
+        return;
+    }
+
+    vector<char> out;
+    size_t nbytes = compress_tets(d.tets, d.num_tets, d.particles, d.num_particles, codec, out);
+    diy::save(bb, nbytes);
+    diy::save(bb, &out[0], nbytes);
+}
+
+// deserializes tets and vert_to_tet (see load_array)
+void load_tets(diy::BinaryBuffer& bb,
+               DBlock& d)
+{
     diy::load(bb, d.num_tets);
-    d.tets = (tet_t*)malloc(d.num_tets * sizeof(tet_t));
-    diy::load(bb, d.tets, d.num_tets);
+    char codec;
+    diy::load(bb, codec);
+    if (codec == TET_CODEC_RAW)
+    {
+        load_array(bb, d.tets, d.num_tets);
+        load_array(bb, d.vert_to_tet, d.num_particles);
+        return;
+    }
+
+    size_t nbytes;
+    diy::load(bb, nbytes);
+    vector<char> in(nbytes);
+    diy::load(bb, &in[0], nbytes);
+    d.tets = (tet_t*)tess_malloc(d.num_tets * sizeof(tet_t), MEM_TETS);
     d.vert_to_tet = NULL;
+    if (!decompress_tets(&in[0], nbytes, d.particles, d.num_particles, d.tets, d.num_tets))
+    {
+        fprintf(stderr, "Error: corrupt compressed tets in block %d\n", d.gid);
+        assert(false);
+    }
     if (d.num_particles)
-        d.vert_to_tet = (int*)malloc(d.num_particles * sizeof(int));
-    diy::load(bb, d.vert_to_tet, d.num_particles);
+        fill_vert_to_tet(static_cast<dblock_t*>(&d));
+}
+
+// copies an array that aliases the block storage into its own allocation
+template<class T>
+static void own_array(const DBlock* b,
+                      T*& x,
+                      size_t n,
+                      int category,
+                      bool use_new = false)
+{
+    if (!x || !b->aliased(x))
+        return;
+    T* y;
+    if (use_new)
+    {
+        y = new T[n];
+        tess_mem_track(y, n * sizeof(T), category);
+    }
+    else
+        y = (T*)tess_malloc(n * sizeof(T), category);
+    memcpy(y, x, n * sizeof(T));
+    x = y;
+}
+
+// frees an array unless it aliases the block storage
+template<class T>
+static void drop_array(const DBlock* b,
+                       T*& x,
+                       bool use_new = false)
+{
+    if (x && !b->aliased(x))
+    {
+        if (use_new)
+        {
+            tess_mem_untrack(x);
+            delete[] x;
+        }
+        else
+            tess_free(x);
+    }
+    x = NULL;
+}
+
+// aborts if receiving incoming more particles would overflow the int particle count of a block
+void check_num_particles(const DBlock* b,
+                         long long incoming)
+{
+    long long n = (long long)b->num_particles + incoming;
+    if (n > INT_MAX)
+    {
+        fprintf(stderr, "Error: block %d would hold %lld particles, more than the %d its int "
+                "counts allow; use more blocks\n", b->gid, n, INT_MAX);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+}
+
+// copy on write: gives a block its own copies of the arrays that alias its storage (a mapped
+// file or a deserialization buffer) and releases the storage
+// call before reallocating or freeing any block array
+void make_writable(DBlock* b)
+{
+    if (!b->storage)
+        return;
+
+    size_t np   = b->num_particles;
+    size_t nrem = b->num_particles - b->num_orig_particles;
+    size_t ng   = b->num_grid_pts;
+    own_array(b, b->particles,   3 * np,              MEM_PARTICLES);
+    own_array(b, b->attrs,       b->num_attrs * np,   MEM_PARTICLES);
+    own_array(b, b->rem_gids,    nrem,                MEM_PARTICLES);
+    own_array(b, b->rem_lids,    nrem,                MEM_PARTICLES);
+    own_array(b, b->tets,        (size_t)b->num_tets, MEM_TETS);
+    own_array(b, b->vert_to_tet, np,                  MEM_VERT_TO_TET);
+    own_array(b, b->density,     ng,                  MEM_DENSITY, true);
+    own_array(b, b->fields,      b->num_fields * ng,  MEM_DENSITY, true);
+
+    b->storage.reset();
+    b->storage_size = 0;
+}
+
+// frees the arrays of a block that are not in a bit mask of sections (1 << tess_section_t); their
+// counts are kept
+// the remaining arrays are made writable, so that the block does not keep its whole storage alive
+void drop_sections(DBlock* b,
+                   unsigned sections)
+{
+    if (!(sections & (1u << TESS_SEC_PARTICLES)))   drop_array(b, b->particles);
+    if (!(sections & (1u << TESS_SEC_ATTRS)))       drop_array(b, b->attrs);
+    if (!(sections & (1u << TESS_SEC_REM_GIDS)))    drop_array(b, b->rem_gids);
+    if (!(sections & (1u << TESS_SEC_REM_LIDS)))    drop_array(b, b->rem_lids);
+    if (!(sections & (1u << TESS_SEC_TETS)))        drop_array(b, b->tets);
+    if (!(sections & (1u << TESS_SEC_VERT_TO_TET))) drop_array(b, b->vert_to_tet);
+    if (!(sections & (1u << TESS_SEC_DENSITY)))     drop_array(b, b->density, true);
+    if (!(sections & (1u << TESS_SEC_FIELDS)))      drop_array(b, b->fields, true);
+
+    make_writable(b);
+}
+
+// completes loading a block whose arrays may alias its memory buffer (see load_array)
+// if the block extends to the end of the buffer, it takes over the buffer and keeps the arrays
+// in place; otherwise the aliased arrays are copied out
+void load_finish(diy::BinaryBuffer& bb,
+                 DBlock& d)
+{
+    diy::MemoryBuffer* mb = dynamic_cast<diy::MemoryBuffer*>(&bb);
+    if (!mb || mb->buffer.empty())
+        return;
+
+    if (mb->position == mb->buffer.size())
+    {
+        // moving the vector contents keeps the array addresses
+        shared_ptr< vector<char> > buf = make_shared< vector<char> >();
+        buf->swap(mb->buffer);
+        mb->position   = 0;
+        d.storage      = shared_ptr<char>(buf, &(*buf)[0]);
+        d.storage_size = buf->size();
+    }
+    else
+    {
+        // non-owning view of the buffer, only for make_writable to find the aliased arrays
+        d.storage      = shared_ptr<char>(shared_ptr<char>(), &mb->buffer[0]);
+        d.storage_size = mb->buffer.size();
+        make_writable(&d);
+    }
 }
 
 //
@@ -274,7 +747,7 @@ int gen_particles(DBlock* b,
     sizes[1] = (int)(b->bounds.max[1] - b->bounds.min[1] + 1);
     sizes[2] = (int)(b->bounds.max[2] - b->bounds.min[2] + 1);
     num_particles = sizes[0] * sizes[1] * sizes[2];
-    b->particles = (float *)malloc(num_particles * 3 * sizeof(float));
+    b->particles = (float *)tess_malloc((size_t)num_particles * 3 * sizeof(float), MEM_PARTICLES);
     float *p = b->particles;
 
     // assign particles
@@ -352,19 +825,40 @@ void delaunay(DBlock*                           b,
               const diy::Master::ProxyWithLink& cp,
               const LinkVector&                 links,
               LastNeighbors&                    neighbors,
-              bool                              first)
+              bool                              first,
+              bool                              update,
+              bool                              record_ghosts)
 {
     int               lid           = cp.master()->lid(cp.gid());
     const RCLink&     original_link = links[lid];
     size_t&           last_neighbor = neighbors[lid];
     RCLink*           link          = dynamic_cast<RCLink*>(cp.link());
 
+    // temporaries of this round come from the scratch arena of the thread
+    ScratchScope      scratch;
+
     // cleanup block
-    reset_block(b);
+    // the first round of an update keeps the tets of a block whose particles did not move
+    bool keep_tets = first && update && !b->stale_tets;
+    if (!keep_tets)
+        reset_block(b);
 
     // clear collectives
     cp.collectives()->clear();
 
+    if (first)
+    {
+        b->local_time      = 0;
+        b->incomplete_time = 0;
+        b->rounds          = 0;
+        if (!update)
+            b->sent.clear();
+    }
+    b->rounds++;
+
+    tess_profile_record_t rec(b->rounds, cp.gid());
+    TESS_TRACE_SCOPE("delaunay", cp.gid(), b->rounds);
+
     LinkVector in_links;
     if (!first)       // we don't receive on the first round
     {
@@ -381,7 +875,11 @@ void delaunay(DBlock*                           b,
         last_neighbor = link->size();       // update last_neighbor
 
         // parse received particles
-        neighbor_particles(b, cp);
+        {
+            TESS_TRACE_SCOPE("neighbor_particles", cp.gid(), b->rounds);
+            TessTimer timer(rec.times[PHASE_NEIGHBOR_PARTICLES]);
+            neighbor_particles(b, cp, &rec);
+        }
 
         // update the links, taking care of duplicates
 
@@ -434,10 +932,17 @@ void delaunay(DBlock*                           b,
     //fprintf(stderr, "Links updated; last_neighbor = %lu\n", last_neighbor);
 
     // compute (or update) the local tessellation
-    if (b->num_orig_particles)
-        local_cells(b);
-    else
-        fill_vert_to_tet(b);
+    double t0 = MPI_Wtime();
+    {
+        TESS_TRACE_SCOPE("local_cells", cp.gid(), b->rounds);
+        if (!keep_tets && b->num_orig_particles)
+            local_cells(b);
+        else if (!keep_tets)
+            fill_vert_to_tet(b);
+    }
+    rec.times[PHASE_LOCAL_CELLS] = MPI_Wtime() - t0;
+    rec.counts[COUNT_TETS]        = b->num_tets;
+    b->local_time += rec.times[PHASE_LOCAL_CELLS];
 
     // enqueue the original link to the new neighbors
     for (size_t i = last_neighbor; i < link->size(); ++i)
@@ -447,13 +952,22 @@ void delaunay(DBlock*                           b,
     }
 
     // enqueue points to neighbors
+    // (in the first round of an update, a block sends nothing new unless its particles or the bounds
+    // of its neighbors changed)
     int done = 1;
-    if (b->num_orig_particles)
+    if (b->num_orig_particles && !(first && update && !b->stale_ghosts))
     {
-        size_t num = incomplete_cells(b, cp, last_neighbor);
+        TESS_TRACE_SCOPE("incomplete_cells", cp.gid(), b->rounds);
+        t0 = MPI_Wtime();
+        size_t num = incomplete_cells(b, cp, last_neighbor, &rec, update, record_ghosts);
+        double t   = MPI_Wtime() - t0;
+        b->incomplete_time += t;
+        rec.times[PHASE_INCOMPLETE_CELLS] = t - rec.times[PHASE_ENQUEUE];
         done = (num == 0);
     }
     cp.all_reduce(done, std::logical_and<int>());
+
+    tess_profile_add(rec);
 }
 
 void finalize(DBlock*                         b,
@@ -491,10 +1005,32 @@ void finalize(DBlock*                         b,
 
 size_t incomplete_cells(struct DBlock *dblock,
                         const diy::Master::ProxyWithLink& cp,
-                        size_t last_neighbor)
+                        size_t last_neighbor,
+                        tess_profile_record_t* rec,
+                        bool update,
+                        bool record_ghosts)
 {
     RCLink* l = dynamic_cast<RCLink*>(cp.link());
-    std::vector< std::set<int> > to_send(dblock->num_orig_particles);
+
+    // (particle, neighbor) pairs to send, with duplicates until sorted
+    typedef std::pair<int, int>                                         dest_t;
+    std::vector< dest_t, ScratchAllocator<dest_t> >                     to_send;
+
+    // a circumsphere deep inside the block can still contain particles of neighbors whose bounds
+    // overlap the block (e.g., space-filling curve segments, tess_sfc_exchange())
+    bool overlapping = false;
+    for (int i = 0; i < l->size() && !overlapping; ++i)
+    {
+        diy::ContinuousBounds neigh_bounds = l->bounds(i);
+        diy::wrap_bounds(neigh_bounds, l->wrap(i), dblock->data_bounds);
+
+        int j;
+        for (j = 0; j < 3; ++j)
+            if (neigh_bounds.min[j] >= l->bounds().max[j] ||
+                neigh_bounds.max[j] <= l->bounds().min[j])
+                break;
+        overlapping = (j == 3);
+    }
 
     // for all tets
     for (int t = 0; t < dblock->num_tets; t++)
@@ -545,19 +1081,22 @@ size_t incomplete_cells(struct DBlock *dblock,
                     if (p >= dblock->num_orig_particles)
                         continue;
 
-                    to_send[p].insert(i);
+                    to_send.push_back(dest_t(p, i));
                 }
             }
         }
 
         // check if the circumsphere is too deep inside the block to be able to stick out
-        for (j = 0; j < 3; ++j)
+        if (!overlapping)
         {
-            if (center[j] - l->bounds().min[j] <= rad) break;
-            if (l->bounds().max[j] - center[j] <= rad) break;
+            for (j = 0; j < 3; ++j)
+            {
+                if (center[j] - l->bounds().min[j] <= rad) break;
+                if (l->bounds().max[j] - center[j] <= rad) break;
+            }
+            if (j == 3)	// the circumsphere is too deep inside the block
+                continue;
         }
-        if (j == 3)	// the circumsphere is too deep inside the block
-            continue;
 
         // find nearby blocks within radius of circumcenter
         for (int i = last_neighbor; i < l->size(); ++i)
@@ -574,7 +1113,7 @@ size_t incomplete_cells(struct DBlock *dblock,
                     if (p >= dblock->num_orig_particles)
                         continue;
 
-                    to_send[p].insert(i);
+                    to_send.push_back(dest_t(p, i));
                 }
             }
         }
@@ -595,35 +1134,59 @@ size_t incomplete_cells(struct DBlock *dblock,
             }
 
             for (int i = last_neighbor; i < l->size(); ++i)
-                to_send[p].insert(i);
+                to_send.push_back(dest_t(p, i));
         }
     }
 
-    // enqueue the particles
+    // enqueue the particles, in order of particle and then of neighbor
+    // with record_ghosts, every ghost sent is recorded; in an update, the neighbors already hold
+    // (refreshed copies of) the ghosts sent in earlier time steps, and those are skipped
+    double t0 = MPI_Wtime();
+    std::sort(to_send.begin(), to_send.end());
+    to_send.erase(std::unique(to_send.begin(), to_send.end()), to_send.end());
+    if (update)
+        std::sort(dblock->sent.begin(), dblock->sent.end());
+    size_t num_sent = dblock->sent.size();
     size_t enqueued = 0;
     //size_t convex_hull = 0;
     point_t rp; // particle being sent
-    for (int p = 0; p < dblock->num_orig_particles; p++)
+    for (size_t k = 0; k < to_send.size(); k++)
     {
-        for (set<int>::iterator it  = to_send[p].begin();
-             it != to_send[p].end();
-             it++)
-        {
-            rp.x   = dblock->particles[3 * p];
-            rp.y   = dblock->particles[3 * p + 1];
-            rp.z   = dblock->particles[3 * p + 2];
-            rp.gid = dblock->gid;
-            rp.lid = p;
-            wrap_pt(rp, l->wrap(*it), dblock->data_bounds);
-            cp.enqueue(l->target(*it), rp);
-            ++enqueued;
-
-            //if (!complete(p, dblock->tets, dblock->num_tets, dblock->vert_to_tet[p]))
-            //  ++convex_hull;
-        }
+        int p = to_send[k].first;
+        int i = to_send[k].second;
+
+        tess_sent_t s = { p, l->target(i).gid, tess_wrap_code(l->wrap(i)) };
+        if (update && std::binary_search(dblock->sent.begin(), dblock->sent.begin() + num_sent, s))
+            continue;
+        if (record_ghosts)
+            dblock->sent.push_back(s);
+
+        rp.x   = dblock->particles[3 * p];
+        rp.y   = dblock->particles[3 * p + 1];
+        rp.z   = dblock->particles[3 * p + 2];
+        rp.gid = dblock->gid;
+        rp.lid = p;
+        wrap_pt(rp, l->wrap(i), dblock->data_bounds);
+        cp.enqueue(l->target(i), rp);
+        // attributes, if any, follow their point
+        if (dblock->num_attrs)
+            cp.enqueue(l->target(i), &dblock->attrs[dblock->num_attrs * p],
+                       dblock->num_attrs);
+        ++enqueued;
+
+        //if (!complete(p, dblock->tets, dblock->num_tets, dblock->vert_to_tet[p]))
+        //  ++convex_hull;
     }
     //fprintf(stderr, "[%d]: %lu convex hull particles; %lu total\n", cp.gid(), convex_hull, enqueued);
 
+    if (rec)
+    {
+        rec->times[PHASE_ENQUEUE]          += MPI_Wtime() - t0;
+        rec->counts[COUNT_SENT_PARTICLES]  += enqueued;
+        rec->counts[COUNT_SENT_BYTES]      += enqueued *
+            (sizeof(point_t) + dblock->num_attrs * sizeof(float));
+    }
+
     return enqueued;
 }
 
@@ -631,46 +1194,64 @@ size_t incomplete_cells(struct DBlock *dblock,
 // parse received particles
 //
 void neighbor_particles(DBlock* b,
-                        const diy::Master::ProxyWithLink& cp)
+                        const diy::Master::ProxyWithLink& cp,
+                        tess_profile_record_t* rec)
 {
     diy::Link* l = cp.link();
     std::vector<int> in; // gids of sources
     cp.incoming(in);
 
+    // each incoming point is followed by its num_attrs attributes
+    size_t pt_size = sizeof(point_t) + b->num_attrs * sizeof(float);
+
     // count total number of incoming points
-    int numpts = 0;
+    size_t tot = 0;
     for (int i = 0; i < (int)in.size(); i++)
     {
         diy::MemoryBuffer& in_queue = cp.incoming(in[i]);
-        numpts += (in_queue.size() - in_queue.position) / sizeof(point_t);
+        tot += (in_queue.size() - in_queue.position) / pt_size;
+    }
+    check_num_particles(b, tot);
+    int numpts = tot;
+    if (rec)
+    {
+        rec->counts[COUNT_RECV_PARTICLES] += numpts;
+        rec->counts[COUNT_RECV_BYTES]     += numpts * pt_size;
     }
 
-    // grow space for remote particles
+    // grow space for remote particles; the arrays grow geometrically over the rounds
     int n = (b->num_particles - b->num_orig_particles);
     if (numpts)
     {
-        b->particles =
-            (float *)realloc(b->particles, (b->num_particles + numpts) * 3 * sizeof(float));
-        b->rem_gids  = (int*)realloc(b->rem_gids, (n + numpts) * sizeof(int));
-        b->rem_lids  = (int*)realloc(b->rem_lids, (n + numpts) * sizeof(int));
+        make_writable(b);
+        size_t np    = (size_t)b->num_particles + numpts;
+        b->particles = (float*)tess_reserve(b->particles, np * 3 * sizeof(float), MEM_PARTICLES);
+        b->rem_gids  = (int*)tess_reserve(b->rem_gids, (size_t)(n + numpts) * sizeof(int),
+                                          MEM_PARTICLES);
+        b->rem_lids  = (int*)tess_reserve(b->rem_lids, (size_t)(n + numpts) * sizeof(int),
+                                          MEM_PARTICLES);
+        if (b->num_attrs)
+            b->attrs = (float*)tess_reserve(b->attrs, np * b->num_attrs * sizeof(float),
+                                            MEM_PARTICLES);
     }
 
     // copy received particles
     for (int i = 0; i < (int)in.size(); i++)
     {
         diy::MemoryBuffer& in_queue = cp.incoming(in[i]);
-        numpts = (in_queue.size() - in_queue.position) / sizeof(point_t);
-        vector<point_t> pts;
-        pts.resize(numpts);
-        diy::load(in_queue, &pts[0], numpts);
+        numpts = (in_queue.size() - in_queue.position) / pt_size;
 
         for (int j = 0; j < numpts; j++)
         {
-            b->particles[3 * b->num_particles    ] = pts[j].x;
-            b->particles[3 * b->num_particles + 1] = pts[j].y;
-            b->particles[3 * b->num_particles + 2] = pts[j].z;
-            b->rem_gids[n] = pts[j].gid;
-            b->rem_lids[n] = pts[j].lid;
+            point_t pt;
+            diy::load(in_queue, pt);
+            b->particles[3 * b->num_particles    ] = pt.x;
+            b->particles[3 * b->num_particles + 1] = pt.y;
+            b->particles[3 * b->num_particles + 2] = pt.z;
+            if (b->num_attrs)
+                diy::load(in_queue, &b->attrs[b->num_attrs * b->num_particles], b->num_attrs);
+            b->rem_gids[n] = pt.gid;
+            b->rem_lids[n] = pt.lid;
 
             b->num_particles++;
             n++;
@@ -679,20 +1260,18 @@ void neighbor_particles(DBlock* b,
 }
 //
 // cleans a block in between phases
-// (deletes tets but keeps delauany data structure and convex hull particles, sent particles)
+// (empties tets but keeps delauany data structure and convex hull particles, sent particles)
+// the tets and vert_to_tet arrays keep their allocations for local_cells() to reuse; arrays
+// that alias the block storage are dropped instead
 //
 void reset_block(struct DBlock* &dblock)
 {
-    // free old data
-    if (dblock->tets)
-        free(dblock->tets);
-    if (dblock->vert_to_tet)
-        free(dblock->vert_to_tet);
+    if (dblock->tets && dblock->aliased(dblock->tets))
+        dblock->tets = NULL;
+    if (dblock->vert_to_tet && dblock->aliased(dblock->vert_to_tet))
+        dblock->vert_to_tet = NULL;
 
-    // initialize new data
     dblock->num_tets = 0;
-    dblock->tets = NULL;
-    dblock->vert_to_tet = NULL;
 }
 //
 // wraps point coordinates
@@ -724,8 +1303,21 @@ void tess_stats(diy::Master& master,
     MPI_Reduce(quants.sum_quants, global_sum_quants, MAX_QUANTS, MPI_INT, MPI_SUM, 0,
                master.communicator());
 
+    // measured tessellation cost per process; the maximum over the average is the time lost to
+    // load imbalance
+    vector<double> block_costs(master.size(), 0.0);
+    master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+                   { block_costs[cp.master()->lid(cp.gid())] = b->local_time + b->incomplete_time; });
+    double cost = 0, min_cost, max_cost, sum_cost;
+    for (size_t i = 0; i < block_costs.size(); i++)
+        cost += block_costs[i];
+    MPI_Reduce(&cost, &min_cost, 1, MPI_DOUBLE, MPI_MIN, 0, master.communicator());
+    MPI_Reduce(&cost, &max_cost, 1, MPI_DOUBLE, MPI_MAX, 0, master.communicator());
+    MPI_Reduce(&cost, &sum_cost, 1, MPI_DOUBLE, MPI_SUM, 0, master.communicator());
+
     if (master.communicator().rank() == 0)
     {
+        double avg_cost = sum_cost / master.communicator().size();
         fprintf(stderr, "----------------- global stats ------------------\n");
         fprintf(stderr, "particle exchange time        = %.3lf s\n", times[EXCH_TIME]);
         fprintf(stderr, "delaunay computation time     = %.3lf s\n", times[DEL_TIME]);
@@ -749,6 +1341,8 @@ void tess_stats(diy::Master& master,
                 global_min_quants[NUM_TETS],
                 global_sum_quants[NUM_TETS] / global_sum_quants[NUM_LOC_BLOCKS],
                 global_max_quants[NUM_TETS]);
+        fprintf(stderr, "cost per process   = [%.3lf, %.3lf, %.3lf] s, imbalance %.2lf\n",
+                min_cost, avg_cost, max_cost, avg_cost > 0 ? max_cost / avg_cost : 1.0);
         fprintf(stderr, "-------------------------------------------------\n");
     }
 }
@@ -758,6 +1352,7 @@ void tess_stats(diy::Master& master,
 //
 void fill_vert_to_tet(DBlock* dblock)
 {
+    make_writable(dblock);
     fill_vert_to_tet(static_cast<dblock_t*>(dblock));
 }
 //
@@ -769,7 +1364,8 @@ void fill_vert_to_tet(dblock_t* dblock)
     //fprintf(stderr, "fill_vert_to_tet(): %d %d\n", dblock->num_particles, dblock->num_tets);
 
     dblock->vert_to_tet =
-        (int*)realloc(dblock->vert_to_tet, sizeof(int) * dblock->num_particles);
+        (int*)tess_reserve(dblock->vert_to_tet, sizeof(int) * (size_t)dblock->num_particles,
+                           MEM_VERT_TO_TET);
 
     for (int p = 0; p < dblock->num_particles; ++p)
         dblock->vert_to_tet[p] = -1;
@@ -873,6 +1469,9 @@ void get_mem(int breakpoint,
 
 #endif // BGQ
 
+    // what the memory is used for
+    tess_mem_report(breakpoint, comm);
+
 #endif // MEMORY
 }
 
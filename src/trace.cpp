@@ -0,0 +1,192 @@
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <cstdio>
+
+#include "tess/trace.hpp"
+
+struct trace_event_t
+{
+    const char* name;
+    double      start;                  // seconds since tess_trace_start()
+    double      end;
+    int         gid;
+    int         round;
+};
+
+// ring buffer of one thread; only the owning thread writes to it
+struct TraceBuffer
+{
+    std::vector<trace_event_t>  events;
+    size_t                      next;   // number of events ever recorded
+    int                         tid;
+};
+
+static std::atomic<bool>            enabled(false);
+static double                       start_time = 0;
+static size_t                       buffer_capacity = 0;
+static std::mutex                   buffers_mutex;          // guards registration only
+static std::vector<TraceBuffer*>    buffers;
+static std::vector<TraceBuffer*>    free_buffers;           // of threads that exited
+
+// the buffer of a thread: a free one if any, otherwise a new one; it goes back to the free list
+// when the thread exits, with its events, so the worker threads diy creates for every foreach
+// take turns on a few buffers (and tids) instead of registering one each
+struct TraceBufferLease
+{
+    TraceBufferLease():
+        buffer(NULL)                                                    {}
+    ~TraceBufferLease()
+    {
+        if (!buffer)
+            return;
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        free_buffers.push_back(buffer);
+    }
+
+    TraceBuffer*    buffer;
+};
+
+static thread_local TraceBufferLease local_buffer;
+
+static TraceBuffer* thread_buffer()
+{
+    if (!local_buffer.buffer)
+    {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        if (!free_buffers.empty())
+        {
+            local_buffer.buffer = free_buffers.back();
+            free_buffers.pop_back();
+        }
+        else
+        {
+            TraceBuffer* buf = new TraceBuffer;
+            buf->events.resize(buffer_capacity);
+            buf->next = 0;
+            buf->tid  = buffers.size();
+            buffers.push_back(buf);
+            local_buffer.buffer = buf;
+        }
+    }
+    return local_buffer.buffer;
+}
+
+TessTraceScope::TessTraceScope(const char* name, int gid, int round):
+    name_(name), gid_(gid), round_(round),
+    start_(enabled.load(std::memory_order_relaxed) ? MPI_Wtime() - start_time : -1.0)
+{}
+
+TessTraceScope::~TessTraceScope()
+{
+    if (start_ < 0 || !enabled.load(std::memory_order_relaxed))
+        return;
+
+    TraceBuffer*   buf = thread_buffer();
+    trace_event_t& e   = buf->events[buf->next++ % buf->events.size()];
+    e.name  = name_;
+    e.start = start_;
+    e.end   = MPI_Wtime() - start_time;
+    e.gid   = gid_;
+    e.round = round_;
+}
+
+// starts recording, dropping any earlier events
+// collective over comm: one barrier aligns the time origin of all ranks
+//
+// capacity: events kept per thread
+void tess_trace_start(MPI_Comm comm,
+                      size_t capacity)
+{
+    {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        buffer_capacity = capacity > 0 ? capacity : 1;
+        for (size_t i = 0; i < buffers.size(); i++)
+        {
+            buffers[i]->events.resize(buffer_capacity);
+            buffers[i]->next = 0;
+        }
+    }
+
+    MPI_Barrier(comm);
+    start_time = MPI_Wtime();
+    enabled.store(true);
+}
+
+void tess_trace_stop()
+{
+    enabled.store(false);
+}
+
+// writes the events of all ranks and threads to one Chrome trace (JSON array) file
+// collective over comm; no thread may be recording at the same time
+//
+// pid is the rank, tid the buffer in the order buffers were first used (a buffer passes from
+// a thread that exited to the next new thread); timestamps are in
+// microseconds since tess_trace_start()
+void tess_trace_write(MPI_Comm comm,
+                      const char* outfile)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    std::string out;
+    char        line[256];
+    if (rank == 0)
+        out += "[\n";
+    snprintf(line, sizeof(line),
+             "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"rank %d\"}},\n",
+             rank, rank);
+    out += line;
+    snprintf(line, sizeof(line),
+             "{\"name\":\"process_sort_index\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"sort_index\":%d}},\n",
+             rank, rank);
+    out += line;
+
+    {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        for (size_t i = 0; i < buffers.size(); i++)
+        {
+            const TraceBuffer& buf   = *buffers[i];
+            size_t             cap   = buf.events.size();
+            size_t             first = buf.next > cap ? buf.next - cap : 0;
+            for (size_t j = first; j < buf.next; j++)
+            {
+                const trace_event_t& e = buf.events[j % cap];
+                snprintf(line, sizeof(line),
+                         "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3lf,\"dur\":%.3lf,\"pid\":%d,\"tid\":%d,"
+                         "\"args\":{\"gid\":%d,\"round\":%d}},\n",
+                         e.name, e.start * 1e6, (e.end - e.start) * 1e6, rank, buf.tid, e.gid, e.round);
+                out += line;
+            }
+        }
+    }
+
+    // the last rank closes the array
+    if (rank == size - 1)
+    {
+        out.resize(out.size() - 2);
+        out += "\n]\n";
+    }
+
+    long long bytes = out.size(), offset = 0;
+    MPI_Exscan(&bytes, &offset, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    if (rank == 0)
+        offset = 0;
+
+    MPI_File fh;
+    int      ret = MPI_File_open(comm, (char*)outfile, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                                 MPI_INFO_NULL, &fh);
+    if (ret != MPI_SUCCESS)
+    {
+        if (rank == 0)
+            fprintf(stderr, "Error: cannot open trace file %s\n", outfile);
+        return;
+    }
+    MPI_File_set_size(fh, 0);
+    MPI_Status status;
+    MPI_File_write_at_all(fh, offset, &out[0], (int)out.size(), MPI_BYTE, &status);
+    MPI_File_close(&fh);
+}
@@ -0,0 +1,58 @@
+// checks the binary CGAL triangulation serializer, as used for out-of-core swaps: triangulates
+// random points, and then saves and reloads the triangulation several times, checking that every
+// reload is valid, has the same cells, and saves to the same bytes
+
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+
+#include <diy/serialization.hpp>
+#include "tess/tess.h"
+#include "tess/tess-cgal.h"
+
+int main(int argc, char** argv) {
+
+  int n      = argc > 1 ? atoi(argv[1]) : 10000;   // number of points
+  int swaps  = argc > 2 ? atoi(argv[2]) : 4;       // number of save/load cycles
+
+  std::vector<float> particles(3 * n);
+  srand(0);
+  for (size_t i = 0; i < particles.size(); i++)
+    particles[i] = rand() / (float)RAND_MAX;
+
+  Delaunay3D Dt;
+  construct_delaunay(Dt, n, &particles[0]);
+  size_t cells = Dt.tds().number_of_cells();
+
+  diy::MemoryBuffer first;
+  diy::save(first, Dt);
+
+  int errors = 0;
+  diy::MemoryBuffer bb;
+  bb.buffer = first.buffer;
+  for (int s = 0; s < swaps; s++)
+  {
+    bb.reset();
+    Delaunay3D loaded;
+    diy::load(bb, loaded);
+
+    diy::MemoryBuffer again;
+    diy::save(again, loaded);
+
+    bool valid = loaded.is_valid();
+    bool same  = loaded.tds().number_of_cells() == cells &&
+      again.buffer.size() == first.buffer.size() &&
+      !memcmp(&again.buffer[0], &first.buffer[0], first.buffer.size());
+    if (!valid || !same)
+    {
+      fprintf(stderr, "swap %d: %s, %lu cells (expected %lu), %lu bytes (expected %lu)\n",
+              s, valid ? "valid" : "invalid", loaded.tds().number_of_cells(), cells,
+              again.buffer.size(), first.buffer.size());
+      errors++;
+    }
+    bb.buffer.swap(again.buffer);
+  }
+
+  fprintf(stderr, "%d points, %lu cells, %d swaps: %d errors\n", n, cells, swaps, errors);
+  return errors != 0;
+}
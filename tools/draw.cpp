@@ -223,8 +223,8 @@ int main(int argc, char** argv) {
                                      &create_block,
                                      &destroy_block);
 
-    diy::ContiguousAssigner   assigner(world.size(), -1);	// num blocks will be set by read_blocks()
-    diy::io::read_blocks(argv[1], world, assigner, master, &load_block_light);
+    diy::ContiguousAssigner   assigner(world.size(), -1);	// num blocks will be set by tess_load()
+    tess_load(master, assigner, argv[1]);
 
     tot_blocks = nblocks = master.size();
     ::master = &master;
@@ -10,29 +10,33 @@ void print_block_info(void* b_, const diy::Master::ProxyWithLink& cp)
          b->gid, b->num_orig_particles, b->num_particles, b->num_tets);
 }
 
-void sum_edges(void* b_, const diy::Master::ProxyWithLink& cp)
+struct edge_sums_t
 {
-  dblock_t* b = static_cast<dblock_t*>(b_);
+  size_t edges;
+  size_t particles;
+};
+
+// blocks may run on several threads, so each block adds into its own entry (by local id)
+void sum_edges(void* b_, const diy::Master::ProxyWithLink& cp, void* args)
+{
+  dblock_t*    b    = static_cast<dblock_t*>(b_);
+  edge_sums_t* sums = &(*static_cast<std::vector<edge_sums_t>*>(args))[cp.master()->lid(cp.gid())];
 
   std::vector< std::pair<int, int> > nbrs;
-  size_t total_edges = 0;
   for (size_t v = 0; v < b->num_orig_particles; ++v)
   {
     neighbor_edges(nbrs, v, b->tets, b->vert_to_tet[v]);
-    total_edges += nbrs.size();
+    sums->edges += nbrs.size();
     nbrs.clear();
   }
-
-  cp.all_reduce(total_edges, std::plus<size_t>());
-  size_t nparticles = b->num_orig_particles;
-  cp.all_reduce(nparticles, std::plus<size_t>());
+  sums->particles += b->num_orig_particles;
 }
 
 
 int main(int argc, char** argv) {
 
-  if (argc < 2) {
-    fprintf(stderr, "Usage: stats <filename>\n");
+  if (argc != 2 && argc != 8) {
+    fprintf(stderr, "Usage: stats <filename> [xmin ymin zmin xmax ymax zmax]\n");
     exit(0);
   }
 
@@ -43,22 +47,42 @@ int main(int argc, char** argv) {
                                    &create_block,
                                    &destroy_block);
 
-  diy::ContiguousAssigner   assigner(world.size(), -1);	    // number of blocks will be set by read_blocks()
-  diy::io::read_blocks(argv[1], world, assigner, master, &load_block_light);
+  diy::ContiguousAssigner   assigner(world.size(), -1);	    // number of blocks will be set by tess_load()
+  if (argc == 8)
+  {
+    // only the blocks intersecting the box, and only the arrays needed for the edges
+    diy::ContinuousBounds box(3);
+    for (int i = 0; i < 3; i++)
+    {
+      box.min[i] = atof(argv[2 + i]);
+      box.max[i] = atof(argv[5 + i]);
+    }
+    tess_load(master, assigner, argv[1], box,
+              (1u << TESS_SEC_TETS) | (1u << TESS_SEC_VERT_TO_TET));
+  }
+  else
+    tess_load(master, assigner, argv[1]);
 
   printf("Blocks read: %d\n", master.size());
 
   master.foreach(print_block_info);
 
-  master.foreach(sum_edges);
-  master.exchange();	// process collectives
+  // some processes may have no blocks when loading a box, so reduce over processes
+  edge_sums_t zero = { 0, 0 };
+  std::vector<edge_sums_t> sums(master.size(), zero);
+  master.foreach(&sum_edges, &sums);
+  unsigned long local[2] = { 0, 0 };
+  for (size_t i = 0; i < sums.size(); i++)
+  {
+    local[0] += sums[i].edges;
+    local[1] += sums[i].particles;
+  }
+  unsigned long total[2];
+  MPI_Reduce(local, total, 2, MPI_UNSIGNED_LONG, MPI_SUM, 0, world);
 
   if (world.rank() == 0)
   {
-    size_t total_edges     = master.proxy(0).get<size_t>();
-    size_t total_particles = master.proxy(0).get<size_t>();
-
-    printf("Total edges:  %lu\n", total_edges);
-    printf("Total points: %lu\n", total_particles);
+    printf("Total edges:  %lu\n", total[0]);
+    printf("Total points: %lu\n", total[1]);
   }
 }
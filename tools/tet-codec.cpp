@@ -0,0 +1,111 @@
+// measures size and encode/decode throughput of the tet codecs on a tessellation file
+// decoding includes rebuilding the tet adjacency and vert_to_tet, as on load
+
+#include <string.h>
+#include <algorithm>
+
+#include <diy/master.hpp>
+#include "tess/tess.hpp"
+#include "tess/compress.hpp"
+
+struct codec_stats_t
+{
+  double raw_bytes;
+  double bytes;
+  double encode_time;
+  double decode_time;
+  int    errors;
+};
+
+void measure(void* b_, const diy::Master::ProxyWithLink& cp, void* args)
+{
+  DBlock*        b     = static_cast<DBlock*>(b_);
+  codec_stats_t* stats = static_cast<codec_stats_t*>(args);
+
+  if (!b->tets || !b->num_tets)
+    return;
+
+  for (int c = TET_CODEC_RAW; c < TET_CODEC_NUM_CODECS; c++)
+  {
+    std::vector<char> out;
+    double t0 = MPI_Wtime();
+    compress_tets(b->tets, b->num_tets, b->particles, b->num_particles, (tet_codec_t)c, out);
+    double t1 = MPI_Wtime();
+
+    dblock_t d = *b;
+    d.tets = (tet_t*)malloc(b->num_tets * sizeof(tet_t));
+    d.vert_to_tet = NULL;
+    bool ok = decompress_tets(&out[0], out.size(), b->particles, b->num_particles,
+                              d.tets, d.num_tets);
+    if (c != TET_CODEC_RAW)
+      fill_vert_to_tet(&d);
+    double t2 = MPI_Wtime();
+
+    // the decoded tets must be the same set of vertex quadruples
+    std::vector< std::vector<int> > orig(b->num_tets), dec(b->num_tets);
+    for (int t = 0; ok && t < b->num_tets; t++)
+    {
+      orig[t].assign(b->tets[t].verts, b->tets[t].verts + 4);
+      dec[t].assign(d.tets[t].verts, d.tets[t].verts + 4);
+      std::sort(orig[t].begin(), orig[t].end());
+      std::sort(dec[t].begin(), dec[t].end());
+    }
+    std::sort(orig.begin(), orig.end());
+    std::sort(dec.begin(), dec.end());
+    if (!ok || orig != dec)
+      stats[c].errors++;
+
+    stats[c].raw_bytes   += b->num_tets * sizeof(tet_t) + b->num_particles * sizeof(int);
+    stats[c].bytes       += out.size() + (c == TET_CODEC_RAW ? b->num_particles * sizeof(int) : 0);
+    stats[c].encode_time += t1 - t0;
+    stats[c].decode_time += t2 - t1;
+
+    free(d.tets);
+    free(d.vert_to_tet);
+  }
+}
+
+int main(int argc, char** argv) {
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: tet-codec <filename>\n");
+    exit(0);
+  }
+
+  diy::mpi::environment	    env(argc, argv);
+  diy::mpi::communicator    world;
+
+  // one thread, so that the blocks are timed one at a time and add into stats in turn
+  diy::Master               master(world, 1, -1,
+                                   &create_block,
+                                   &destroy_block);
+
+  diy::ContiguousAssigner   assigner(world.size(), -1);	    // number of blocks will be set by tess_load()
+  tess_load(master, assigner, argv[1]);
+
+  codec_stats_t stats[TET_CODEC_NUM_CODECS];
+  memset(stats, 0, sizeof(stats));
+  master.foreach(&measure, stats);
+
+  // times are the maximum over processes, sizes and errors the sum
+  const char* names[TET_CODEC_NUM_CODECS] = { "raw", "varint", "delta16" };
+  for (int c = 0; c < TET_CODEC_NUM_CODECS; c++)
+  {
+    double sums[3] = { stats[c].raw_bytes, stats[c].bytes, (double)stats[c].errors };
+    double maxs[2] = { stats[c].encode_time, stats[c].decode_time };
+    double tot_sums[3], tot_maxs[2];
+    MPI_Reduce(sums, tot_sums, 3, MPI_DOUBLE, MPI_SUM, 0, world);
+    MPI_Reduce(maxs, tot_maxs, 2, MPI_DOUBLE, MPI_MAX, 0, world);
+
+    // throughput is in raw (tet_t and vert_to_tet) bytes per second, comparable to I/O bandwidth
+    if (world.rank() == 0)
+      fprintf(stderr, "%-8s: %.3lf MB -> %.3lf MB (%.2lfx), encode %.1lf MB/s, decode %.1lf MB/s, "
+              "%d errors\n", names[c], tot_sums[0] / 1048576, tot_sums[1] / 1048576,
+              tot_sums[1] ? tot_sums[0] / tot_sums[1] : 0.0,
+              tot_maxs[0] ? tot_sums[0] / 1048576 / tot_maxs[0] : 0.0,
+              tot_maxs[1] ? tot_sums[0] / 1048576 / tot_maxs[1] : 0.0,
+              (int)tot_sums[2]);
+  }
+
+  return 0;
+}